@@ -25,6 +25,8 @@ uniform bool blendNoTexAlpha;
 
 uniform float alphaThreshold;
 uniform bool forceVertexColor = false;
+uniform bool showLods = false;
+uniform vec3 lodColor = vec3(1.0);
 
 uniform bool fogEnabled = false;
 uniform int fogMode = 3;
@@ -89,6 +91,11 @@ void main(){
 	}
 	
 
+	// Debug view of the level of detail drawn.
+	if(showLods){
+		fCurrColor = mix(fCurrColor, lodColor, 0.6);
+	}
+
 	fragColor = vec4(fCurrColor, fCurrAlpha);
 	
 	
@@ -0,0 +1,133 @@
+#version 330
+
+// Layers evaluated in a single pass, Object::kCompositeLayers. Each layer is blended over the result
+// of the previous ones as the fixed function blending would have done, the result is then blended
+// with the framebuffer by the hardware, using a second output as the destination factor.
+#define MAX_LAYERS 4
+
+in INTERFACE {
+	vec4 camPos;
+	vec4 camNor;
+	vec4 colors[MAX_LAYERS];
+	vec3 uvs[MAX_LAYERS];
+} In ;
+
+uniform int layerCount;
+
+uniform int useTextures[MAX_LAYERS];
+uniform sampler2D textures0;
+uniform sampler2D textures1;
+uniform sampler2D textures2;
+uniform sampler2D textures3;
+uniform samplerCube cubemaps0;
+uniform samplerCube cubemaps1;
+uniform samplerCube cubemaps2;
+uniform samplerCube cubemaps3;
+
+uniform bool blendInvertColors[MAX_LAYERS];
+uniform bool blendInvertAlphas[MAX_LAYERS];
+uniform bool blendNoTexColors[MAX_LAYERS];
+uniform bool blendNoVtxAlphas[MAX_LAYERS];
+uniform bool blendNoTexAlphas[MAX_LAYERS];
+
+// Blend factors of each layer, with the following codes:
+// 0: zero, 1: one, 2: src alpha, 3: 1 - src alpha, 4: src color, 5: 1 - src color.
+uniform ivec2 blendFactors[MAX_LAYERS];
+
+uniform float alphaThresholds[MAX_LAYERS];
+uniform bool fogEnableds[MAX_LAYERS];
+uniform bool forceVertexColor = false;
+uniform bool showLods = false;
+uniform vec3 lodColor = vec3(1.0);
+
+uniform int fogMode = 3;
+uniform vec3 fogInfos = vec3(-1500.0, 2000.0, 1.0);
+uniform vec3 fogColor = vec3(0.4, 0.3, 0.1);
+
+// The framebuffer receives fragColor + blendFactor * dst.
+layout(location = 0, index = 0) out vec4 fragColor;
+layout(location = 0, index = 1) out vec4 blendFactor;
+
+vec3 factor(int code, vec4 src){
+	switch(code){
+		case 1: return vec3(1.0);
+		case 2: return vec3(src.a);
+		case 3: return vec3(1.0 - src.a);
+		case 4: return src.rgb;
+		case 5: return 1.0 - src.rgb;
+		default: return vec3(0.0);
+	}
+}
+
+vec4 evaluateLayer(int layer, sampler2D tex, samplerCube cube){
+	vec4 vertexColor = In.colors[layer];
+	if (useTextures[layer]==0 || forceVertexColor) {
+		return vertexColor;
+	}
+	vec4 img = (useTextures[layer]==1) ? texture(tex, In.uvs[layer].xy) : texture(cube, normalize(In.uvs[layer]));
+	vec3 texColor = blendInvertColors[layer] ? (1.0 - img.rgb) : img.rgb;
+	float texAlpha = blendInvertAlphas[layer] ? (1.0 - img.a) : img.a;
+	
+	vec4 color;
+	if(blendNoVtxAlphas[layer]){
+		color.a = texAlpha;
+	} else if(blendNoTexAlphas[layer]){
+		color.a = vertexColor.a;
+	} else {
+		color.a = vertexColor.a * texAlpha;
+	}
+	color.rgb = blendNoTexColors[layer] ? vertexColor.rgb : vertexColor.rgb * texColor;
+	return color;
+}
+
+vec3 applyFog(vec3 color){
+	if(fogMode == 0){
+		float fogFactor = (fogInfos.y - length(In.camPos.xyz))/(fogInfos.y - fogInfos.x);
+		return mix(fogColor, color, fogFactor);
+	} else if (fogMode == 1){
+		float d = length(In.camPos.xyz) * fogInfos.z;
+		return mix(fogColor, color, 1.0 / exp(d));
+	} else if (fogMode == 2){
+		float d = length(In.camPos.xyz) * fogInfos.z;
+		return mix(fogColor, color, 1.0 / exp(d*d));
+	}
+	return color;
+}
+
+void main(){
+	vec4 layers[MAX_LAYERS];
+	layers[0] = evaluateLayer(0, textures0, cubemaps0);
+	layers[1] = layerCount > 1 ? evaluateLayer(1, textures1, cubemaps1) : vec4(0.0);
+	layers[2] = layerCount > 2 ? evaluateLayer(2, textures2, cubemaps2) : vec4(0.0);
+	layers[3] = layerCount > 3 ? evaluateLayer(3, textures3, cubemaps3) : vec4(0.0);
+	
+	// The result is kept as color + scale * dst, dst being the framebuffer color before the first layer.
+	vec3 color = vec3(0.0);
+	vec3 scale = vec3(1.0);
+	bool drawn = false;
+	for(int i = 0; i < layerCount; ++i){
+		vec4 src = layers[i];
+		// A layer failing its alpha test leaves the result untouched.
+		if(src.a < alphaThresholds[i]){
+			continue;
+		}
+		drawn = true;
+		if(fogEnableds[i]){
+			src.rgb = applyFog(src.rgb);
+		}
+		// Debug view of the level of detail drawn.
+		if(showLods){
+			src.rgb = mix(src.rgb, lodColor, 0.6);
+		}
+		// The framebuffer clamps the source color before blending.
+		src = clamp(src, 0.0, 1.0);
+		vec3 dstFactor = factor(blendFactors[i].y, src);
+		color = factor(blendFactors[i].x, src) * src.rgb + dstFactor * color;
+		scale = dstFactor * scale;
+	}
+	if(!drawn){
+		discard;
+	}
+	fragColor = vec4(color, 0.0);
+	blendFactor = vec4(scale, 1.0);
+}
@@ -0,0 +1,174 @@
+#version 330
+
+// Attributes
+layout(location = 0) in vec3 v;
+layout(location = 1) in vec2 n; // Octahedral encoding.
+layout(location = 2) in vec4 col;
+layout(location = 3) in vec3 uv0;
+layout(location = 4) in vec3 uv1;
+layout(location = 5) in vec3 uv2;
+layout(location = 6) in vec3 uv3;
+layout(location = 7) in vec3 uv4;
+layout(location = 8) in vec3 uv5;
+layout(location = 9) in vec3 uv6;
+layout(location = 10) in vec3 uv7;
+
+// Layers evaluated in a single pass, Object::kCompositeLayers. See object_layers.frag.
+#define MAX_LAYERS 4
+
+uniform int layerCount;
+
+// Per layer material, sources are packed as (diffuse, ambient, specular, emissive).
+uniform vec4 globalAmbients[MAX_LAYERS];
+uniform vec4 ambients[MAX_LAYERS];
+uniform vec4 diffuses[MAX_LAYERS];
+uniform vec4 emissives[MAX_LAYERS];
+uniform vec4 sources[MAX_LAYERS];
+uniform bool invertVertexAlphas[MAX_LAYERS];
+
+uniform mat4 mvp;
+uniform mat4 mv;
+uniform mat3 normalMatrix;
+uniform mat4 invV;
+
+// Per layer UV source: normal -1, position -2, reflect -3, else the UV channel.
+uniform bool useReflectionXforms[MAX_LAYERS];
+uniform bool useRefractionXforms[MAX_LAYERS];
+uniform mat4 uvMatrices[MAX_LAYERS];
+uniform int uvSources[MAX_LAYERS];
+uniform int useTextures[MAX_LAYERS];
+uniform bvec2 clampedTextures[MAX_LAYERS];
+
+uniform bool forceLighting = false;
+uniform bool forceNoLighting = false;
+
+// Output: position in view space, and color and uv of each layer.
+out INTERFACE {
+	vec4 camPos;
+	vec4 camNor;
+	vec4 colors[MAX_LAYERS];
+	vec3 uvs[MAX_LAYERS];
+} Out ;
+
+
+uniform bool noLights;
+
+struct Light {
+	vec4 posdir;
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+	vec3 attenuations;
+	float scale;
+	bool enabled;
+};
+
+uniform Light lights[8];
+
+vec3 evaluateUV(int layer, vec4 camPos, vec4 camNor){
+	mat4 matrix;
+	if (useReflectionXforms[layer] || useRefractionXforms[layer]) {
+		matrix = invV;
+		matrix[0][3] = matrix[1][3] = matrix[2][3] = 0.0;
+		
+		float temp = matrix[1][0];
+		matrix[1][0] = matrix[2][0];
+		matrix[2][0] = temp;
+		
+		temp = matrix[1][1];
+		matrix[1][1] = matrix[2][1];
+		matrix[2][1] = temp;
+		
+		temp = matrix[1][2];
+		matrix[1][2] = matrix[2][2];
+		matrix[2][2] = temp;
+		
+		if (useRefractionXforms[layer]) {
+			matrix[0][2] = -matrix[0][2];
+			matrix[1][2] = -matrix[1][2];
+			matrix[2][2] = -matrix[2][2];
+		}
+	} else {
+		matrix = uvMatrices[layer];
+	}
+	
+	vec4 coords;
+	switch (uvSources[layer]) {
+		case -1:
+			// Should probably normalize.
+			coords = matrix * camNor;
+			break;
+		case -2:
+			coords = matrix * camPos;
+			break;
+		case -3:
+			coords = matrix * invV * reflect(normalize(camPos), normalize(camNor));
+			break;
+		default:
+			int uvId = uvSources[layer];
+			vec3 selectedUV = (uvId == 0 ? uv0 : (uvId == 1 ? uv1 : (uvId == 2 ? uv2 : (uvId == 3 ? uv3 : (uvId == 4 ? uv4 : (uvId == 5 ? uv5 : (uvId == 6 ? uv6 : uv7 )))))));
+			coords = matrix * vec4(selectedUV, 1.0);
+			break;
+	}
+	
+	coords.x = clampedTextures[layer].x ? clamp(coords.x, 0.0, 0.99) : coords.x;
+	coords.y = clampedTextures[layer].y ? clamp(coords.y, 0.0, 0.99) : coords.y;
+	return coords.xyz;
+}
+
+/// Decode a direction stored with an octahedral mapping.
+vec3 decodeNormal(vec2 e){
+	vec3 dir = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if(dir.z < 0.0){
+		dir.xy = (1.0 - abs(dir.yx)) * vec2(dir.x >= 0.0 ? 1.0 : -1.0, dir.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return normalize(dir);
+}
+
+void main(){
+	
+	vec4 viewPos = mv * vec4(v, 1.0);
+	Out.camPos = viewPos;
+	Out.camNor = vec4(normalMatrix * decodeNormal(n), 1.0);
+	
+	gl_Position = mvp * vec4(v, 1.0);
+	
+	// The lights are shared by all layers, only the material changes.
+	vec3 LAmbient = vec3(0.0);
+	vec3 LDiffuse = vec3(0.0);
+	
+	if(!noLights && !forceNoLighting){
+		vec3 NDirection = normalize(Out.camNor.xyz);
+		for (int i = 0; i < 8; i++) {
+			if(!lights[i].enabled){
+				break;
+			}
+			vec3 v2l = vec3(lights[i].posdir - Out.camPos*lights[i].posdir.w);
+			float distance = length(v2l);
+			vec3 direction = normalize(v2l);
+			float attenuation = mix(1.0, 1.0/(lights[i].attenuations.x+lights[i].attenuations.y*distance + lights[i].attenuations.z * distance * distance), lights[i].posdir.w);
+			LAmbient = LAmbient + attenuation*(lights[i].ambient*lights[i].scale);
+			LDiffuse = LDiffuse + (lights[i].diffuse*lights[i].scale)*max(0.0, dot(NDirection, direction)*attenuation);
+		}
+	}
+	
+	vec4 vertexCol = col;
+	for(int i = 0; i < MAX_LAYERS; ++i){
+		if(i >= layerCount){
+			Out.colors[i] = vec4(0.0);
+			Out.uvs[i] = vec3(0.0);
+			continue;
+		}
+		vec4 MAmbient = mix(vertexCol, ambients[i], sources[i].y);
+		vec4 MDiffuse = mix(vertexCol, diffuses[i], sources[i].x);
+		vec4 MEmissive = mix(vertexCol, emissives[i], sources[i].w);
+		
+		vec4 ambientFinal = forceLighting ? vec4(1.0) : clamp(MAmbient*(globalAmbients[i]+vec4(LAmbient, 0.0)), 0.0, 1.0);
+		vec4 diffuseFinal = clamp(vec4(MDiffuse.xyz*LDiffuse, 0.0), 0.0, 1.0);
+		vec4 material = clamp(ambientFinal + diffuseFinal + MEmissive, 0.0, 1.0);
+		
+		float baseAlpha = invertVertexAlphas[i] ? (1.0 - MDiffuse.a) : MDiffuse.a;
+		Out.colors[i] = vec4(material.rgb, baseAlpha);
+		Out.uvs[i] = useTextures[i] > 0 ? evaluateUV(i, Out.camPos, Out.camNor) : vec3(0.0);
+	}
+}
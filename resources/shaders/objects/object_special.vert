@@ -2,7 +2,7 @@
 
 // Attributes
 layout(location = 0) in vec3 v;
-layout(location = 1) in vec3 n;
+layout(location = 1) in vec2 n; // Octahedral encoding.
 layout(location = 2) in vec4 col;
 layout(location = 3) in vec3 uv0;
 layout(location = 4) in vec3 uv1;
@@ -123,11 +123,20 @@ vec3 evaluateUV(mat4 uvMatrixA, int uvSourceA, bvec2 clampedTextureA, bool useRe
 	return coords.xyz;
 }
 
+/// Decode a direction stored with an octahedral mapping.
+vec3 decodeNormal(vec2 e){
+	vec3 dir = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if(dir.z < 0.0){
+		dir.xy = (1.0 - abs(dir.yx)) * vec2(dir.x >= 0.0 ? 1.0 : -1.0, dir.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return normalize(dir);
+}
+
 void main(){
 	
 	vec4 viewPos = mv * vec4(v, 1.0);
 	Out.camPos = viewPos;
-	Out.camNor = vec4(normalMatrix * n, 1.0);
+	Out.camNor = vec4(normalMatrix * decodeNormal(n), 1.0);
 	
 	vec4 clipPos = mvp * vec4(v, 1.0);
 	gl_Position = clipPos;
@@ -1,13 +1,30 @@
 #include "Age.hpp"
 #include "helpers/Logger.hpp"
 #include "resources/ResourcesManager.hpp"
+#include "helpers/ThreadUtilities.hpp"
+#include "helpers/MappedFile.hpp"
+#include "helpers/MappedStream.hpp"
+#include "Material.hpp"
+#include "helpers/VertexUtilities.hpp"
+#include "helpers/HashUtilities.hpp"
+#include "helpers/Profiler.hpp"
+#include "PageCache.hpp"
 #include <glm/gtc/matrix_transform.hpp>
 #include <string>
+#include <chrono>
+#include <set>
+#include <stdexcept>
+#include <tuple>
+#include <algorithm>
+#include <cctype>
+#include <limits>
+#include <ghc/filesystem.hpp>
 #include <ResManager/plResManager.h>
 #include <Debug/hsExceptions.hpp>
 #include <Stream/hsStdioStream.h>
 #include <Stream/hsStream.h>
 #include <PRP/plSceneNode.h>
+#include <PRP/KeyedObject/hsKeyedObject.h>
 #include <PRP/Object/plSceneObject.h>
 #include <PRP/Object/plDrawInterface.h>
 #include <PRP/Object/plCoordinateInterface.h>
@@ -30,6 +47,7 @@
 #include <cstring>
 #include <time.h>
 #include <fstream>
+#include <stdexcept>
 
 #ifndef M_PI_2
 #define M_PI_2 1.57079632679489661923
@@ -61,39 +79,420 @@ std::vector<std::string> split(const std::string & str){
 
 
 
-Age::Age(){
+Age::Age() : _cancel(false), _converted(true), _pagesRead(0), _pagesConverted(0), _loaded(true) {
 	_name = "None";
+	_fogEnv = NULL;
 }
 
-Age::Age(const std::string & path){
+Age::Age(const std::string & path, unsigned int threadCount, bool background, const std::string & cacheDirectory, const std::vector<std::string> & pageNames) : _cancel(false), _converted(false), _pagesRead(0), _pagesConverted(0), _loaded(false) {
+	PROFILE_ZONE("Age::Age");
 	
+	_startTime = std::chrono::steady_clock::now();
+	_path = path;
 	const PlasmaVer plasmaVersion = PlasmaVer::pvMoul;
-	_rm.reset(new plResManager());
-	plAgeInfo* age = _rm->ReadAge(path, true);
+	// Only read the age description, pages are decoded separately, each in its own manager.
+	plResManager rm;
+	plAgeInfo* age = rm.ReadAge(path, false);
 	_name = age->getAgeName().to_std_string();
 	
 	Log::Info() << "Age " << _name << ": ";
 	
+	const std::string ageDirectory = path.substr(0, path.find_last_of("/\\") + 1);
+	
+	std::vector<std::string> pagePaths;
 	const size_t pageCount = age->getNumPages();
 	Log::Info() << pageCount << " pages, " << std::flush;
 	for(int i = 0 ; i < pageCount; ++i){
-		const plLocation ploc = age->getPageLoc(i, plasmaVersion);
-		loadMeshes(*_rm, ploc);
+		pagePaths.push_back(ageDirectory + age->getPageFilename(i, plasmaVersion).to_std_string());
 	}
 	
 	const size_t commmonCount = age->getNumCommonPages(plasmaVersion);
-	Log::Info() << commmonCount << " common pages, " << std::flush;
+	Log::Info() << commmonCount << " common pages." << std::endl;
 	for(int i = 0 ; i < commmonCount; ++i){
-		const plLocation ploc = age->getCommonPageLoc(i, plasmaVersion);
-		loadMeshes(*_rm, ploc);
+		pagePaths.push_back(ageDirectory + age->getCommonPageFilename(i, plasmaVersion).to_std_string());
+	}
+	
+	// Pages are designated by the end of their file name ("Age_District_Name.prp").
+	for(const auto & pagePath : pagePaths){
+		std::string pageName = ghc::filesystem::path(pagePath).stem().string();
+		const std::string::size_type districtPos = pageName.find("_District_");
+		if(districtPos != std::string::npos){
+			pageName = pageName.substr(districtPos + 10);
+		}
+		_availablePages.emplace_back(pageName, pagePath);
+	}
+	
+	loadFog(path);
+	
+	// Converted geometry is cached next to each other, one file per page.
+	if(!cacheDirectory.empty()){
+		std::error_code ec;
+		ghc::filesystem::create_directories(cacheDirectory, ec);
+		if(ec){
+			Log::Warning() << "Unable to create cache directory " << cacheDirectory << ", caching disabled." << std::endl;
+		} else {
+			_cacheDirectory = cacheDirectory;
+		}
+	}
+	
+	_threadCount = ThreadUtilities::workerCount(threadCount);
+	_background = background;
+	
+	// Load everything if no subset is requested.
+	if(pageNames.empty()){
+		for(const auto & page : _availablePages){
+			appendPage(page.second);
+		}
+	} else {
+		for(const auto & pageName : pageNames){
+			const size_t pid = findPage(pageName);
+			if(pid == _availablePages.size()){
+				Log::Warning() << "Unknown page " << pageName << " in " << _name << "." << std::endl;
+				continue;
+			}
+			if(!isPageLoaded(_availablePages[pid].first)){
+				appendPage(_availablePages[pid].second);
+			}
+		}
+		Log::Info() << "Loading " << _pages.size() << "/" << _availablePages.size() << " pages." << std::endl;
+	}
+	
+	startLoading(0);
+}
+
+size_t Age::findPage(const std::string & name) const {
+	for(size_t pid = 0; pid < _availablePages.size(); ++pid){
+		const std::string & pageName = _availablePages[pid].first;
+		if(pageName.size() == name.size() && std::equal(pageName.begin(), pageName.end(), name.begin(), [](char left, char right){
+			return std::tolower(left) == std::tolower(right);
+		})){
+			return pid;
+		}
+	}
+	return _availablePages.size();
+}
+
+bool Age::isPageLoaded(const std::string & name) const {
+	const size_t pid = findPage(name);
+	if(pid == _availablePages.size()){
+		return false;
+	}
+	for(const auto & page : _pages){
+		if(page.path == _availablePages[pid].second){
+			return true;
+		}
+	}
+	return false;
+}
+
+void Age::appendPage(const std::string & path){
+	PageData page;
+	page.path = path;
+	if(!_cacheDirectory.empty()){
+		page.cacheFile = PageCache::cachePath(_cacheDirectory, path);
+	}
+	// The streaming thread might be accessing other pages.
+	std::lock_guard<std::mutex> lock(_streamMutex);
+	_pages.push_back(std::move(page));
+}
+
+bool Age::addPages(const std::vector<std::string> & pageNames){
+	if(!_loaded){
+		Log::Warning() << "Pages of " << _name << " are still loading." << std::endl;
+		return false;
+	}
+	if(_loader.joinable()){
+		_loader.join();
+	}
+	const size_t firstPage = _pages.size();
+	for(const auto & pageName : pageNames){
+		const size_t pid = findPage(pageName);
+		if(pid != _availablePages.size() && !isPageLoaded(pageName)){
+			appendPage(_availablePages[pid].second);
+		}
+	}
+	if(_pages.size() == firstPage){
+		return false;
+	}
+	Log::Info() << "Adding " << (_pages.size() - firstPage) << " pages to " << _name << "." << std::endl;
+	_startTime = std::chrono::steady_clock::now();
+	_converted = false;
+	_loaded = false;
+	startLoading(firstPage);
+	return true;
+}
+
+void Age::startLoading(size_t firstPage){
+	_firstPage = firstPage;
+	if(_background){
+		_loader = std::thread(&Age::loadPages, this, firstPage);
+	} else {
+		loadPages(firstPage);
+	}
+}
+
+void Age::registerLinkingPoints(PageData & page){
+	for(const auto & linkingPoint : page.linkingPoints){
+		// A reloaded page can move its linking points.
+		if(_linkingPoints.count(linkingPoint.first) > 0){
+			if(page.uploadedOnce){
+				_linkingPoints[linkingPoint.first] = linkingPoint.second;
+			}
+			continue;
+		}
+		if(linkingPoint.first == "Default"){
+			_linkingNamesCache.insert(_linkingNamesCache.begin(), linkingPoint.first);
+		} else {
+			_linkingNamesCache.push_back(linkingPoint.first);
+		}
+		_linkingPoints[linkingPoint.first] = linkingPoint.second;
+	}
+	page.linkingRegistered = true;
+}
+
+/// Threads left to each page when pageCount pages are converted in parallel on threadCount threads, so that
+/// nested loops in a page don't multiply the number of threads.
+static unsigned int threadsPerPage(unsigned int threadCount, size_t pageCount){
+	const unsigned int workers = ThreadUtilities::workerCount(threadCount);
+	const size_t concurrentPages = (std::max)(size_t(1), (std::min)(size_t(workers), pageCount));
+	return (std::max)(1u, unsigned(workers / concurrentPages));
+}
+
+void Age::loadPages(size_t firstPage){
+	const size_t pageCount = _pages.size() - firstPage;
+	
+	// Decode all pages first, to know where the linking points are.
+	ThreadUtilities::parallelFor(pageCount, _threadCount, [this, firstPage](size_t pid){
+		if(!_cancel){
+			readPage(_pages[firstPage + pid]);
+		}
+		++_pagesRead;
+	});
+	std::vector<size_t> pageIds(pageCount);
+	for(size_t pid = 0; pid < pageCount; ++pid){
+		pageIds[pid] = firstPage + pid;
 	}
+	updateLights(pageIds);
 	
-	checkGLError();
-	Log::Info() << _objects.size() << " objects."  << std::endl;
-	std::sort(_objects.begin(), _objects.end(), [](const std::shared_ptr<Object> & left, const std::shared_ptr<Object> & right){
-		return left->getName() < right->getName();
+	// Register linking points, in page order. The age isn't displayed yet for the initial pages,
+	// linking points of pages added later are registered on the main thread when uploaded.
+	if(firstPage == 0){
+		for(auto & page : _pages){
+			registerLinkingPoints(page);
+		}
+	}
+	
+	// Convert the pages closest to the default linking point first.
+	// Pages without geometry (textures,...) are needed by everyone, put them first.
+	const glm::vec3 linkingPoint = getDefaultLinkingPoint();
+	std::vector<size_t> order(pageCount);
+	std::vector<float> distances(pageCount, 0.0f);
+	for(size_t oid = 0; oid < pageCount; ++oid){
+		order[oid] = firstPage + oid;
+		const PageData & page = _pages[firstPage + oid];
+		if(page.hasBounds){
+			distances[oid] = glm::length(page.bounds.center - linkingPoint);
+		}
+	}
+	std::stable_sort(order.begin(), order.end(), [&distances, firstPage](size_t left, size_t right){
+		return distances[left - firstPage] < distances[right - firstPage];
+	});
+	
+	const unsigned int pageThreads = threadsPerPage(_threadCount, order.size());
+	ThreadUtilities::parallelFor(order.size(), _threadCount, [this, &order, pageThreads](size_t oid){
+		const size_t pid = order[oid];
+		PageData & page = _pages[pid];
+		if(!_cancel && page.error.empty()){
+			convertPage(page, pageThreads);
+		}
+		++_pagesConverted;
+		// Publish the page for upload.
+		std::lock_guard<std::mutex> lock(_readyMutex);
+		_readyPages.push_back(pid);
+	});
+	_convertedTime = std::chrono::steady_clock::now();
+	_converted = true;
+}
+
+size_t Age::reloadChangedPages(){
+	if(!_loaded || _reloadingPages > 0){
+		Log::Warning() << "Pages of " << _name << " are still loading." << std::endl;
+		return 0;
+	}
+	if(_loader.joinable()){
+		_loader.join();
+	}
+	
+	std::vector<size_t> changed;
+	for(size_t pid = 0; pid < _pages.size(); ++pid){
+		PageData & page = _pages[pid];
+		// Pages being streamed in are checked next time.
+		if(page.requested){
+			continue;
+		}
+		uint64_t size = 0;
+		int64_t time = 0;
+		if(!PageCache::stamp(page.path, size, time) || (size == page.fileSize && time == page.fileTime)){
+			continue;
+		}
+		// Only hash files that have been touched, and skip them if their content is the same.
+		MappedFile file;
+		const uint64_t hash = file.open(page.path) ? HashUtilities::hash(file.data(), file.size()) : 0;
+		if(hash == page.fileHash){
+			page.fileSize = size;
+			page.fileTime = time;
+			continue;
+		}
+		changed.push_back(pid);
+	}
+	if(changed.empty()){
+		Log::Info() << "No page of " << _name << " has changed." << std::endl;
+		return 0;
+	}
+	
+	// Release the previous content, and start from a blank page.
+	for(const size_t pid : changed){
+		PageData & page = _pages[pid];
+		if(page.resident){
+			evictPage(page);
+		}
+		PageData blank;
+		blank.path = page.path;
+		blank.cacheFile = page.cacheFile;
+		blank.uploadedOnce = true;
+		blank.reloading = true;
+		page = std::move(blank);
+	}
+	Log::Info() << "Reloading " << changed.size() << " changed pages of " << _name << "." << std::endl;
+	_reloadingPages = changed.size();
+	_reloadTime = std::chrono::steady_clock::now();
+	if(_background){
+		_loader = std::thread(&Age::reloadPages, this, changed);
+	} else {
+		reloadPages(changed);
+	}
+	return changed.size();
+}
+
+void Age::reloadPages(std::vector<size_t> pageIds){
+	ThreadUtilities::parallelFor(pageIds.size(), _threadCount, [this, &pageIds](size_t rid){
+		if(!_cancel){
+			readPage(_pages[pageIds[rid]]);
+		}
 	});
+	// Lights of the reloaded pages replace their previous version before any of them is converted.
+	updateLights(pageIds);
+	
+	const unsigned int pageThreads = threadsPerPage(_threadCount, pageIds.size());
+	ThreadUtilities::parallelFor(pageIds.size(), _threadCount, [this, &pageIds, pageThreads](size_t rid){
+		const size_t pid = pageIds[rid];
+		PageData & page = _pages[pid];
+		if(!_cancel && page.error.empty()){
+			convertPage(page, pageThreads);
+		}
+		std::lock_guard<std::mutex> lock(_readyMutex);
+		_readyPages.push_back(pid);
+	});
+}
+
+bool Age::hasPendingPages(){
+	std::lock_guard<std::mutex> lock(_readyMutex);
+	return !_readyPages.empty();
+}
+
+float Age::progress() const {
+	// Only the pages of the current batch are taken into account.
+	const size_t pageCount = _pages.size() - _firstPage;
+	if(pageCount == 0){
+		return 1.0f;
+	}
+	// Reading, conversion and upload are given the same weight.
+	return float(_pagesRead + _pagesConverted + _pagesUploaded - 3 * _firstPage) / float(3 * pageCount);
+}
+
+size_t Age::uploadPages(double budget){
+	const auto startTime = std::chrono::steady_clock::now();
+	size_t uploadCount = 0;
+	
+	while(true){
+		size_t pid = 0;
+		{
+			std::lock_guard<std::mutex> lock(_readyMutex);
+			if(_readyPages.empty()){
+				break;
+			}
+			pid = _readyPages.front();
+			_readyPages.pop_front();
+		}
+		
+		PageData & page = _pages[pid];
+		if(page.requested){
+			_requestedSize -= page.gpuSize;
+			page.requested = false;
+		}
+		if(page.error.empty()){
+			uploadPage(page);
+		} else {
+			Log::Error() << "Unable to load page " << page.path << ": " << page.error << std::endl;
+		}
+		if(!page.uploadedOnce){
+			page.uploadedOnce = true;
+			++_pagesUploaded;
+			_objectBytes += page.objectBytes;
+			_skippedBytes += page.skippedBytes;
+			_cacheBefore += page.cacheBefore;
+			_cacheAfter += page.cacheAfter;
+			Log::Info() << Log::Verbose << "Page " << page.path << ": read in " << page.readDuration << "ms, " << (page.objectBytes / 1024) << "KB of objects read, " << (page.skippedBytes / 1024) << "KB of unused objects skipped." << std::endl;
+		}
+		if(!page.linkingRegistered){
+			registerLinkingPoints(page);
+		}
+		if(page.reloading){
+			page.reloading = false;
+			if(--_reloadingPages == 0){
+				const long long duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - _reloadTime).count();
+				Log::Info() << _name << ": changed pages reloaded in " << duration << "ms." << std::endl;
+			}
+		}
+		++uploadCount;
+		
+		const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+		if(elapsed > budget){
+			break;
+		}
+	}
 	
+	if(uploadCount > 0){
+		checkGLError();
+		std::sort(_objects.begin(), _objects.end(), [](const std::shared_ptr<Object> & left, const std::shared_ptr<Object> & right){
+			return left->getName() < right->getName();
+		});
+	}
+	
+	if(!_loaded && _converted && _pagesUploaded == _pages.size()){
+		_loaded = true;
+		if(_loader.joinable()){
+			_loader.join();
+		}
+		const auto endTime = std::chrono::steady_clock::now();
+		const long long convertDuration = std::chrono::duration_cast<std::chrono::milliseconds>(_convertedTime - _startTime).count();
+		const long long totalDuration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - _startTime).count();
+		Log::Info() << _name << ": " << _objects.size() << " objects, loaded in " << totalDuration << "ms (";
+		Log::Info() << _threadCount << " threads, " << convertDuration << "ms decoding, " << VertexUtilities::kernelName(VertexUtilities::bestKernel()) << " kernel, " << _pagesCached << "/" << _pages.size() << " pages from cache, ";
+		Log::Info() << (_skippedBytes / (1024 * 1024)) << "/" << ((_objectBytes + _skippedBytes) / (1024 * 1024)) << "MB of objects skipped, ";
+		Log::Info() << "ACMR " << _cacheBefore.acmr() << " to " << _cacheAfter.acmr() << ", ATVR " << _cacheBefore.atvr() << " to " << _cacheAfter.atvr() << ")." << std::endl;
+		size_t layerPasses = 0;
+		size_t compositePasses = 0;
+		for(const auto & object : _objects){
+			layerPasses += object->passCount(false);
+			compositePasses += object->passCount(true);
+		}
+		Log::Info() << _name << ": " << layerPasses << " material passes drawn in " << compositePasses << ", " << (layerPasses - compositePasses) << " saved by compositing layers." << std::endl;
+	}
+	return uploadCount;
+}
+
+void Age::loadFog(const std::string & path){
 	// Load fog infos. (see issue #1)
 	_clearColor = glm::vec3(0.2f, 0.2f, 0.2f);
 	_fogEnv = new plFogEnvironment();
@@ -101,16 +500,16 @@ Age::Age(const std::string & path){
 	_fogEnv->setType(plFogEnvironment::kNoFog);
 	
 	
-	hsStream* S;
 	const std::string fniPath = path.substr(0, path.find_last_of(".")) + ".fni";
 	
-	bool opened = false;
-	if (plEncryptedStream::IsFileEncrypted(fniPath)) {
-		S = new plEncryptedStream();
-		opened = ((plEncryptedStream*)S)->open(fniPath, fmRead, plEncryptedStream::kEncAuto);
-	} else {
-		S = new hsFileStream();
-		opened = ((hsFileStream*)S)->open(fniPath, fmRead);
+	// Read straight from a mapping of the file, decrypting on top of it if needed.
+	MappedStream mapped;
+	plEncryptedStream decrypted;
+	hsStream* S = &mapped;
+	bool opened = mapped.open(fniPath);
+	if (opened && plEncryptedStream::IsFileEncrypted(fniPath)) {
+		opened = decrypted.open(&mapped, fmRead, plEncryptedStream::kEncAuto);
+		S = &decrypted;
 	}
 	
 	if(opened){
@@ -195,20 +594,29 @@ Age::Age(const std::string & path){
 }
 
 Age::~Age(){
+	// Stop the background conversion.
+	_cancel = true;
+	if(_loader.joinable()){
+		_loader.join();
+	}
+	{
+		std::lock_guard<std::mutex> lock(_streamMutex);
+		_streamCondition.notify_all();
+	}
+	if(_streamer.joinable()){
+		_streamer.join();
+	}
 	for(const auto & obj : _objects){
 		obj->clean();
 	}
 	// Should clean the Age and everything.
 	_objects.clear();
-	if(_rm){
-		_rm->UnloadAge(_name);
-	}
-	_rm.reset();
+	_pages.clear();
 	
 	
 }
 
-void processLight(const plLightInfo * light, Light & newLight){
+void processLight(const plLightInfo * light, const std::map<std::string, float> & volumes, Light & newLight){
 	plDirectionalLightInfo * lightDir = plDirectionalLightInfo::Convert(light->getKey()->getObj(), false);
 	plSpotLightInfo * lightSpot = plSpotLightInfo::Convert(light->getKey()->getObj(), false);
 	plOmniLightInfo * lightOmni = plOmniLightInfo::Convert(light->getKey()->getObj(), false);
@@ -222,8 +630,16 @@ void processLight(const plLightInfo * light, Light & newLight){
 	
 	newLight.scale = 1.0f;
 	if(light->getSoftVolume().Exists()){
-		plSoftVolume * softVol = plSoftVolume::Convert(light->getSoftVolume()->getObj());
-		newLight.scale = softVol->getInsideStrength();
+		// The volume can live in another page, not loaded in the same manager.
+		plSoftVolume * softVol = plSoftVolume::Convert(light->getSoftVolume()->getObj(), false);
+		if(softVol){
+			newLight.scale = softVol->getInsideStrength();
+		} else {
+			const auto volume = volumes.find(light->getSoftVolume()->getName().to_std_string());
+			if(volume != volumes.end()){
+				newLight.scale = volume->second;
+			}
+		}
 	}
 	
 	
@@ -259,64 +675,276 @@ void processLight(const plLightInfo * light, Light & newLight){
 	}
 }
 
-void Age::loadMeshes(plResManager & rm, const plLocation& ploc){
-	plSceneNode* scene = rm.getSceneNode(ploc);
-	
-	std::map<std::string, Light> globalLights;
-	std::map<std::string, bool> globalLightsUsed;
-	
-	if(scene){
-		Log::Mute();
+void Age::updateLights(const std::vector<size_t> & pageIds){
+	std::shared_ptr<LightTable> table = _lights ? std::make_shared<LightTable>(*_lights) : std::make_shared<LightTable>();
+	// Volumes first, lights can be attenuated by a volume of any page.
+	for(const size_t pid : pageIds){
+		const PageData & page = _pages[pid];
+		if(!page.rm || !page.info){
+			continue;
+		}
+		const plLocation & location = page.info->getLocation();
+		for(const short type : page.rm->getTypes(location)){
+			for(const auto & key : page.rm->getKeys(location, type)){
+				const plSoftVolume * volume = plSoftVolume::Convert(key->getObj(), false);
+				if(volume){
+					table->volumes[key->getName().to_std_string()] = volume->getInsideStrength();
+				}
+			}
+		}
+	}
+	for(const size_t pid : pageIds){
+		const PageData & page = _pages[pid];
+		if(!page.rm || !page.info){
+			continue;
+		}
+		const plLocation & location = page.info->getLocation();
+		for(const short type : page.rm->getTypes(location)){
+			for(const auto & key : page.rm->getKeys(location, type)){
+				const plLightInfo * light = plLightInfo::Convert(key->getObj(), false);
+				if(light){
+					processLight(light, table->volumes, table->lights[key->getName().to_std_string()]);
+				}
+			}
+		}
+	}
+	_lights = table;
+	for(const size_t pid : pageIds){
+		_pages[pid].ageLights = _lights;
+	}
+}
+
+/// Classes of the objects used by the viewer, including the subclasses that are converted to them.
+static const std::set<short> & usedClasses(){
+	static const std::set<short> classes = [](){
+		const char * names[] = {
+			"plSceneNode", "plSceneObject", "plCoordinateInterface", "plFilterCoordInterface",
+			"plDrawInterface", "plInstanceDrawInterface", "plDrawableSpans", "plViewFaceModifier",
+			"hsGMaterial", "plLayer", "plLayerAnimation", "plLayerSDLAnimation", "plLayerLinkAnimation",
+			"plLayerAVI", "plLayerBink", "plLayerMovie", "plLayerDepth",
+			"plMipmap", "plCubicEnvironmap", "plDynamicTextMap",
+			"plDirectionalLightInfo", "plLimitedDirLightInfo", "plOmniLightInfo", "plSpotLightInfo",
+			"plSoftVolumeSimple", "plSoftVolumeComplex", "plSoftVolumeUnion", "plSoftVolumeIntersect", "plSoftVolumeInvert"
+		};
+		std::set<short> indices;
+		for(const char * name : names){
+			const short index = pdUnifiedTypeMap::ClassIndex(name);
+			if(index >= 0){
+				indices.insert(index);
+			}
+		}
+		return indices;
+	}();
+	return classes;
+}
+
+/// Classes still needed when the converted geometry comes from the cache: the scene graph for the linking points,
+/// the materials and textures, and the lights that other pages may reference. Spans and draw interfaces are only read to convert the geometry.
+static const std::set<short> & cachedClasses(){
+	static const std::set<short> classes = [](){
+		const char * names[] = {
+			"plSceneNode", "plSceneObject", "plCoordinateInterface", "plFilterCoordInterface",
+			"hsGMaterial", "plLayer", "plLayerAnimation", "plLayerSDLAnimation", "plLayerLinkAnimation",
+			"plLayerAVI", "plLayerBink", "plLayerMovie", "plLayerDepth",
+			"plMipmap", "plCubicEnvironmap", "plDynamicTextMap",
+			"plDirectionalLightInfo", "plLimitedDirLightInfo", "plOmniLightInfo", "plSpotLightInfo",
+			"plSoftVolumeSimple", "plSoftVolumeComplex", "plSoftVolumeUnion", "plSoftVolumeIntersect", "plSoftVolumeInvert"
+		};
+		std::set<short> indices;
+		for(const char * name : names){
+			const short index = pdUnifiedTypeMap::ClassIndex(name);
+			if(index >= 0){
+				indices.insert(index);
+			}
+		}
+		return indices;
+	}();
+	return classes;
+}
+
+void Age::readObjects(PageData & page, const std::vector<short> & types){
+	MappedStream stream;
+	if(!stream.open(page.path)){
+		throw std::runtime_error("unable to map page");
+	}
+	stream.setVer(page.rm->getVer());
+	const plLocation & location = page.info->getLocation();
+	for(const short type : types){
+		for(const auto & key : page.rm->getKeys(location, type)){
+			page.objectBytes += key->getObjSize();
+			// As in a full read, an object that fails to read is left as a stub.
+			try {
+				stream.seek(key->getFileOff());
+				hsKeyedObject * object = hsKeyedObject::Convert(page.rm->ReadCreatable(&stream, false, key->getObjSize()), false);
+				if(object){
+					key->setObj(object);
+				}
+			} catch(const std::exception &){
+			}
+		}
+	}
+	stream.close();
+}
+
+void Age::readDeferred(PageData & page){
+	if(page.deferredTypes.empty()){
+		return;
+	}
+	const plLocation & location = page.info->getLocation();
+	for(const short type : page.deferredTypes){
+		for(const auto & key : page.rm->getKeys(location, type)){
+			page.skippedBytes -= key->getObjSize();
+		}
+	}
+	const std::vector<short> types = std::move(page.deferredTypes);
+	page.deferredTypes.clear();
+	readObjects(page, types);
+}
+
+void Age::readPage(PageData & page){
+	const auto startTime = std::chrono::steady_clock::now();
+	try {
+		page.rm = std::make_shared<plResManager>();
+		// ReadPage only accepts a path: map the page beforehand to read the whole file ahead
+		// into the OS cache, so that the small buffered reads of libhsplasma don't wait on the disk.
+		MappedFile readahead;
+		readahead.open(page.path, MappedFile::WillNeed);
+		// Only read the keys, objects are deserialized below if their class is used.
+		page.info = page.rm->ReadPage(page.path, true);
+		// Remember the file state, to reload the page when it changes. The content is in the OS cache by now.
+		PageCache::stamp(page.path, page.fileSize, page.fileTime);
+		page.fileHash = HashUtilities::hash(readahead.data(), readahead.size());
+		readahead.close();
+		if(!page.info){
+			page.error = "no page info";
+			return;
+		}
+		const plLocation & location = page.info->getLocation();
 		
-		for(const auto & objKey : scene->getSceneObjects()){
-			plSceneObject* obj = plSceneObject::Convert(rm.getObject(objKey));
-			
-			// Skip geometry for now.
-			if(obj->getDrawInterface().Exists()){
+		// Physicals, sounds, Python and responders make up most of some pages and are never displayed,
+		// leave their keys as stubs instead of deserializing them. With an up to date cache,
+		// the spans and what is only used to convert them are deferred too.
+		const bool cached = !page.cacheFile.empty() && PageCache::isValid(page.cacheFile, page.path);
+		page.objectBytes = 0;
+		page.skippedBytes = 0;
+		page.deferredTypes.clear();
+		std::vector<short> types;
+		const std::set<short> & classes = usedClasses();
+		for(const short type : page.rm->getTypes(location)){
+			const bool used = classes.count(type) != 0;
+			const bool deferred = used && cached && cachedClasses().count(type) == 0;
+			if(used && !deferred){
+				types.push_back(type);
 				continue;
 			}
-			
-			// Find the linking points.
-			if(objKey->getName().substr(0, 11) == "LinkInPoint" && obj->getCoordInterface().Exists()){
-				plCoordinateInterface* coord = plCoordinateInterface::Convert(obj->getCoordInterface()->getObj());
-				const auto matCenter = coord->getLocalToWorld();
-				if(objKey->getName() == "LinkInPointDefault"){
-					_linkingNamesCache.insert( _linkingNamesCache.begin(), objKey->getName().substr(11).to_std_string());
-					_linkingPoints[_linkingNamesCache.front()] = glm::vec3(matCenter(0,3), matCenter(2,3)+ 5.0f, -matCenter(1,3));
-				} else {
-					_linkingNamesCache.push_back(objKey->getName().substr(11).to_std_string());
-					_linkingPoints[_linkingNamesCache.back()] = glm::vec3(matCenter(0,3), matCenter(2,3)+ 5.0f, -matCenter(1,3));
+			for(const auto & key : page.rm->getKeys(location, type)){
+				page.skippedBytes += key->getObjSize();
+			}
+			if(deferred){
+				page.deferredTypes.push_back(type);
+			}
+		}
+		readObjects(page, types);
+		page.readDuration = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+		
+		plSceneNode* scene = page.rm->getSceneNode(location);
+		if(scene){
+			for(const auto & objKey : scene->getSceneObjects()){
+				plSceneObject* obj = plSceneObject::Convert(page.rm->getObject(objKey));
+				// Find the linking points.
+				if(!obj->getDrawInterface().Exists() && objKey->getName().substr(0, 11) == "LinkInPoint" && obj->getCoordInterface().Exists()){
+					plCoordinateInterface* coord = plCoordinateInterface::Convert(obj->getCoordInterface()->getObj());
+					const auto matCenter = coord->getLocalToWorld();
+					page.linkingPoints.emplace_back(objKey->getName().substr(11).to_std_string(), glm::vec3(matCenter(0,3), matCenter(2,3)+ 5.0f, -matCenter(1,3)));
 				}
 			}
-			
-			Log::Unmute();
-			
-			
-			
-			if(!obj->getInterfaces().empty()){
-				for(const auto & interf : obj->getInterfaces()){
-					plLightInfo *light = plLightInfo::Convert(interf->getObj(), false);
-					if(light != NULL){
-						Light newLight;
-						processLight(light, newLight);
-						const std::string lightName = interf->getName().to_std_string();
-						globalLights[lightName] = newLight;
-						globalLightsUsed[lightName] = false;
-					}
-					
+		}
+		
+		// Up to date converted geometry comes with its bounds.
+		if(cached && PageCache::load(page.cacheFile, page)){
+			return;
+		}
+		// The cache can't be used after all.
+		readDeferred(page);
+		
+		// Approximate the page extent using the precomputed span bounds, no need to decode vertices.
+		for(const auto & spanKey : page.rm->getKeys(location, pdUnifiedTypeMap::ClassIndex("plDrawableSpans"))){
+			plDrawableSpans* span = plDrawableSpans::Convert(spanKey->getObj(), false);
+			if(!span){
+				continue;
+			}
+			for(size_t sid = 0; sid < span->getNumSpans(); ++sid){
+				const hsBounds3Ext & spanBounds = span->getSpan(sid)->getWorldBounds();
+				// Swap axis.
+				const hsVector3 & mins = spanBounds.getMins();
+				const hsVector3 & maxs = spanBounds.getMaxs();
+				const BoundingBox box(glm::vec3(mins.X, mins.Z, -maxs.Y), glm::vec3(maxs.X, maxs.Z, -mins.Y));
+				if(page.hasBounds){
+					page.bounds += box;
+				} else {
+					page.bounds = box;
+					page.hasBounds = true;
 				}
 			}
-			
-			Log::Mute();
 		}
+		page.bounds.updateValues();
 		
-		// Now look for geometry.
+	} catch(const std::exception & e){
+		page.error = e.what();
+	}
+}
+
+void Age::convertPage(PageData & page, unsigned int threadCount){
+	try {
+		if(!page.cache){
+			// The cache was valid when the page was read, but couldn't be loaded since.
+			readDeferred(page);
+			loadMeshes(*page.rm, page.info->getLocation(), page);
+			if(!page.cacheFile.empty()){
+				// Failing to write the cache only means a slower load next time.
+				PageCache::save(page.cacheFile, page);
+			}
+		}
+		loadTextures(*page.rm, page.info->getLocation(), page, threadCount);
+		hashBuffers(page);
+		if(!page.hasWorldBounds){
+			computeWorldBounds(page);
+		}
+	} catch(const std::exception & e){
+		page.error = e.what();
+	}
+}
+
+void Age::loadMeshes(plResManager & rm, const plLocation& ploc, PageData & page){
+	PROFILE_ZONE("Age::loadMeshes");
+	// Runs on worker threads: no logging and no GL calls here.
+	plSceneNode* scene = rm.getSceneNode(ploc);
+	
+	if(scene){
+		// Materials are copied once, and shared by all the subobjects using them.
+		std::map<hsGMaterial*, std::shared_ptr<Material>> materials;
+		static const LightTable noLights;
+		const LightTable & ageLights = page.ageLights ? *page.ageLights : noLights;
+		// Icicles of the same buffer group share a buffer, and a vertex range if they are not transformed.
+		std::map<std::pair<plDrawableSpans*, unsigned int>, size_t> bufferIds;
+		std::map<std::tuple<size_t, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int>, std::pair<size_t, size_t>> vertexRanges;
+		// Ranges are assigned first, buffers are then allocated once in the page arena and filled.
+		struct IcicleCopy {
+			VertexUtilities::Range range;
+			hsMatrix44 transfo;
+			size_t buffer;
+			size_t baseVertex;
+			size_t firstIndex;
+			bool copyVertices;
+		};
+		std::vector<IcicleCopy> copies;
+		
+		// Look for geometry.
 		for(const auto & objKey : scene->getSceneObjects()){
 			plSceneObject* obj = plSceneObject::Convert(rm.getObject(objKey));
 			if(!obj->getDrawInterface().Exists()){
 				continue;
 			}
-			//Log::Info() << objKey->getName() << ", " << std::flush;
 			
 			plDrawInterface* draw = plDrawInterface::Convert(obj->getDrawInterface()->getObj());
 			
@@ -349,9 +977,11 @@ void Age::loadMeshes(plResManager & rm, const plLocation& ploc){
 			// Swap axis.
 			model = glm::rotate(glm::mat4(1.0f), -float(M_PI_2), glm::vec3(1.0f,0.0f,0.0f)) * model;
 			
-			Log::Info() << objKey->getName() << std::endl;
-			
-			_objects.emplace_back(new Object(type, Resources::manager().getProgram("object_basic"), model, objKey->getName().to_std_string()));
+			page.objects.emplace_back();
+			PageData::ObjectData & object = page.objects.back();
+			object.type = type;
+			object.model = model;
+			object.name = objKey->getName().to_std_string();
 			
 			// Extract subobjects, they are batched.
 			for (size_t i = 0; i < draw->getNumDrawables(); ++i) {
@@ -362,184 +992,942 @@ void Age::loadMeshes(plResManager & rm, const plLocation& ploc){
 				// A span group multiple objects data/assets.
 				plDrawableSpans* span = plDrawableSpans::Convert(draw->getDrawable(i)->getObj());
 				plDISpanIndex di = span->getDIIndex(draw->getDrawableKey(i));
-				// Fog color.
-				Log::Unmute();
-//				const size_t numSpans = span->getNumSpans();
-//				for(size_t spid = 0; spid <numSpans; ++spid){
-//					if(span->getSpan(spid)->getFogEnvironment().Exists()){
-//						plFogEnvironment* fog = plFogEnvironment::Convert(span->getSpan(spid)->getFogEnvironment()->getObj());
-//						Log::Info() << "Fog: " << fog->getColor() << std::endl;
-//					}
-//				}
-//				const auto & sourceSpans = span->getSourceSpans();
-//				const size_t snumSpans = sourceSpans.size();
-//				for(size_t spid = 0; spid <snumSpans; ++spid){
-//					if(span->getSourceSpans()[spid]->getFogEnvironment().Exists()){
-//						plFogEnvironment* fog = plFogEnvironment::Convert(span->getSourceSpans()[spid]->getFogEnvironment()->getObj());
-//						Log::Info() << "SFog: " << fog->getColor() << std::endl;
-//					}
-//				}
 				
-				Log::Mute();
 				// Ignore matrix-only span element.
 				if ((di.fFlags & plDISpanIndex::kMatrixOnly) != 0){
 					continue;
 				}
 				
-				
-				
 				// Each of these will be a subobject.
 				for(size_t id = 0; id < di.fIndices.size(); ++id){
-					const std::string fileName = scene->getKey()->getName().to_std_string() + "_" + obj->getKey()->getName().to_std_string() + "_" + std::to_string(i) + "_" + std::to_string(id) ;
-
+					
 					// Get the mesh internal representation.
 					plIcicle* ice = span->getIcicle(di.fIndices[id]);
-				
-					const hsMatrix44 transfoMatrix = (bakePosition ? ice->getLocalToWorld() : hsMatrix44::Identity());
-					hsMatrix44 transfoMatrixNormal = transfoMatrix;
-					transfoMatrixNormal.setTranslate(hsVector3(0.0f,0.0f,0.0f));
-					
-					// Extract geometry data.
-					std::vector<plGBufferVertex> verts = span->getVerts(ice);
-					std::vector<unsigned short> indices = span->getIndices(ice);
-					const unsigned int uvCount = span->getBuffer(ice->getGroupIdx())->getNumUVs();
-					Log::Info() << "UV Count" << uvCount << std::endl;
-					std::vector<unsigned int> meshIndices(indices.size());
-					std::vector<glm::vec3> meshPositions(verts.size());
-					std::vector<glm::vec3> meshNormals(verts.size());
-					std::vector<std::vector<glm::vec3>> meshUVs(uvCount, std::vector<glm::vec3>(verts.size()));
-					std::vector<glm::u8vec4> meshColors(verts.size());
-					
-					for (size_t j = 0; j < indices.size(); ++j) {
-						meshIndices[j] = (unsigned int)(indices[j]);
-					}
 					
-					// Convert infos for each vertex.
-					for (size_t j = 0; j < verts.size(); j++) {
-						const hsVector3 pos = transfoMatrix.multPoint(verts[j].fPos);
-						const auto fnorm = transfoMatrixNormal.multVector(verts[j].fNormal);
-						meshPositions[j] = glm::vec3(pos.X, pos.Y, pos.Z);
-						meshNormals[j] = glm::vec3(fnorm.X, fnorm.Y, fnorm.Z);
-						const unsigned int color = verts[j].fColor;
-						unsigned char red = char((color >> 16) & 0xFF);
-						unsigned char gre = char((color >> 8) & 0xFF);
-						unsigned char blu = char((color) & 0xFF);
-						unsigned char alp = char((color >> 24) & 0xFF);
-						meshColors[j] = glm::u8vec4(red, gre, blu, alp);
-						
-						for(size_t uvid = 0; uvid < uvCount; ++uvid){
-							const hsVector3 uvCoords = verts[j].fUVWs[uvid];
-							meshUVs[uvid][j] = glm::vec3(uvCoords.X, uvCoords.Y, uvCoords.Z);
-						}
+					// Material information
+					plKey matKey = span->getMaterials()[ice->getMaterialIdx()];
+					hsGMaterial * matObj = matKey.Exists() ? hsGMaterial::Convert(matKey->getObj(), false) : NULL;
+					if(!matObj){
+						continue;
 					}
 					
-					Log::Info() << std::endl;
+					const hsMatrix44 transfoMatrix = (bakePosition ? ice->getLocalToWorld() : hsMatrix44::Identity());
 					
-					// Material information
-					plKey matKey = span->getMaterials()[ice->getMaterialIdx()];
-					std::string textureName = "";
+					const unsigned int groupIdx = ice->getGroupIdx();
+					const auto bufferKey = std::make_pair(span, groupIdx);
+					auto bufferId = bufferIds.find(bufferKey);
+					if(bufferId == bufferIds.end()){
+						bufferId = bufferIds.emplace(bufferKey, page.buffers.size()).first;
+						page.buffers.emplace_back();
+						page.buffers.back().name = scene->getKey()->getName().to_std_string() + "_" + span->getKey()->getName().to_std_string() + "_" + std::to_string(groupIdx);
+						page.buffers.back().view.texcoords.resize(span->getBuffer(groupIdx)->getNumUVs());
+					}
+					MeshView & mesh = page.buffers[bufferId->second].view;
 					
+					object.subObjects.emplace_back();
+					PageData::SubObjectData & subObject = object.subObjects.back();
+					subObject.buffer = bufferId->second;
+					auto & material = materials[matObj];
+					if(!material){
+						material = Material::fromPlasma(matObj);
+					}
+					subObject.material = material;
+					subObject.materialName = matKey->getName().to_std_string();
 					// Properties.
-					const unsigned int iceflags = span->getProps();
-					const unsigned int shadingMode = iceflags & kLiteMask;
-					
-					logSpanProps(iceflags);
+					subObject.mode = span->getProps() & kLiteMask;
 					
-					// Log material details.
-					if (matKey.Exists()) {
-						hsGMaterial* mat = hsGMaterial::Convert(matKey->getObj(), false);
-						if (mat != NULL && mat->getLayers().size() > 0) {
-							Log::Info() << "Material " << mat->getKey()->getName() << std::endl;
-							const unsigned int cflags = mat->getCompFlags();
-							logCompFlags(cflags);
-							// Extract layer infos.
-							Log::Info() << "\tLayers: " <<  mat->getLayers().size() << std::endl;
-							for(size_t lid = 0; lid < mat->getLayers().size(); ++lid){
-								plLayerInterface* lay = plLayerInterface::Convert(mat->getLayers()[lid]->getObj(), false);
-								Log::Info() << logLayer(lay) << std::endl;
-							}
-							Log::Info() << std::endl;
+					// Reserve the geometry ranges at the end of the buffer, only counts are updated for now.
+					const auto rangeKey = std::make_tuple(bufferId->second, ice->getVBufferIdx(), ice->getCellIdx(), ice->getCellOffset(), ice->getVStartIdx(), ice->getVLength());
+					const auto range = bakePosition ? vertexRanges.end() : vertexRanges.find(rangeKey);
+					const bool copyVertices = range == vertexRanges.end();
+					if(!copyVertices){
+						subObject.baseVertex = range->second.first;
+						subObject.vertexCount = range->second.second;
+					} else {
+						subObject.baseVertex = mesh.vertexCount;
+						subObject.vertexCount = ice->getVLength();
+						mesh.vertexCount += subObject.vertexCount;
+						if(!bakePosition){
+							vertexRanges[rangeKey] = std::make_pair(subObject.baseVertex, subObject.vertexCount);
 						}
-						
 					}
-					
+					// Indices are relative to the first vertex of the icicle.
+					subObject.firstIndex = mesh.indexCount;
+					subObject.indexCount = ice->getILength();
+					mesh.indexCount += subObject.indexCount;
+					// Read in place from the buffer group, as plDrawableSpans::getVerts and getIndices would.
+					VertexUtilities::Range icicleRange;
+					icicleRange.group = span->getBuffer(groupIdx);
+					icicleRange.vertexBuffer = ice->getVBufferIdx();
+					icicleRange.vertexStart = ice->getVStartIdx();
+					icicleRange.vertexCount = ice->getVLength();
+					icicleRange.indexBuffer = ice->getIBufferIdx();
+					icicleRange.indexStart = ice->getIStartIdx();
+					icicleRange.indexCount = ice->getILength();
+					copies.push_back({icicleRange, transfoMatrix, subObject.buffer, subObject.baseVertex, subObject.firstIndex, copyVertices});
 					
 					// Lights
-					Log::Unmute();
-					const auto & permalights = ice->getPermaLights();
-					std::vector<Light> lights;
-					for(const auto & lightKey : permalights){
-						plLightInfo *light = plLightInfo::Convert(lightKey->getObj());
-						Light newLight;
-						processLight(light, newLight);
-						lights.push_back(newLight);
-						const std::string lightName = lightKey->getName().to_std_string();
-						globalLightsUsed[lightName] = true;
-					}
-					
-					
-					
-					Log::Mute();
-					
-					// Add subobject to current object.
-					const MeshInfos mesh = Resources::manager().registerMesh(fileName, meshIndices, meshPositions, meshNormals, meshColors, meshUVs);
-					auto * matObj = hsGMaterial::Convert(matKey->getObj(), false);
-					if(matObj){
-						_objects.back()->addSubObject(mesh, matObj, lights, shadingMode);
+					for(const auto & lightKey : ice->getPermaLights()){
+						plLightInfo *light = plLightInfo::Convert(lightKey->getObj(), false);
+						if(light){
+							Light newLight;
+							processLight(light, ageLights.volumes, newLight);
+							subObject.lights.push_back(newLight);
+							continue;
+						}
+						// Lights from other pages are not in this manager, look them up in the whole age.
+						const auto shared = ageLights.lights.find(lightKey->getName().to_std_string());
+						if(shared != ageLights.lights.end()){
+							subObject.lights.push_back(shared->second);
+						}
 					}
 				}
 			}
-			Log::Info() << std::endl;
 		}
-		Log::Unmute();
+		
+		// Each attribute of a buffer is allocated once in the page arena, instead of growing icicle by icicle.
+		page.arena = std::make_shared<Arena>();
+		std::vector<MutableMeshView> targets(page.buffers.size());
+		for(size_t bid = 0; bid < page.buffers.size(); ++bid){
+			MeshView & view = page.buffers[bid].view;
+			MutableMeshView & target = targets[bid];
+			target.indexCount = view.indexCount;
+			target.vertexCount = view.vertexCount;
+			target.texcoords.resize(view.texcoords.size());
+			VertexUtilities::allocate(target, *page.arena);
+			view = MeshView(target);
+		}
+		
+		// Extract geometry data into the reserved ranges, straight from the buffer groups.
+		for(const auto & copy : copies){
+			VertexUtilities::stage(copy.range, copy.transfo, copy.copyVertices, targets[copy.buffer], copy.baseVertex, copy.firstIndex);
+		}
+		
+		batchObjects(page, targets, scene->getKey()->getName().to_std_string());
+		optimizeMeshes(page, targets);
+		generateLods(page, targets);
+		buildMeshlets(page, targets);
+	}
+}
+
+/// Alpha blended subobjects are drawn in their exported triangle order.
+static bool isAlphaBlended(const std::shared_ptr<Material> & material){
+	if(!material || material->layers.empty()){
+		return false;
+	}
+	const MaterialLayer * layer = &material->layers[0];
+	while(layer){
+		if(layer->blendFlags & hsGMatState::kBlendAlpha){
+			return true;
+		}
+		layer = layer->underlay.get();
+	}
+	return false;
+}
+
+static bool sameLights(const std::vector<Light> & left, const std::vector<Light> & right){
+	if(left.size() != right.size()){
+		return false;
+	}
+	for(size_t lid = 0; lid < left.size(); ++lid){
+		const Light & l = left[lid];
+		const Light & r = right[lid];
+		if(l.type != r.type || l.posdir != r.posdir || l.ambient != r.ambient || l.diffuse != r.diffuse || l.specular != r.specular
+		   || l.constAtten != r.constAtten || l.linAtten != r.linAtten || l.quadAtten != r.quadAtten || l.scale != r.scale){
+			return false;
+		}
+	}
+	return true;
+}
+
+/// Merge the ranges of start and size into disjoint sorted ranges, and give each its start once packed, in order.
+static std::vector<std::tuple<size_t, size_t, size_t>> packRanges(std::vector<std::pair<size_t, size_t>> ranges){
+	std::sort(ranges.begin(), ranges.end());
+	std::vector<std::tuple<size_t, size_t, size_t>> packed;
+	size_t packedSize = 0;
+	for(const auto & range : ranges){
+		const size_t end = range.first + range.second;
+		if(!packed.empty() && range.first <= std::get<1>(packed.back())){
+			size_t & last = std::get<1>(packed.back());
+			packedSize += (std::max)(last, end) - last;
+			last = (std::max)(last, end);
+			continue;
+		}
+		packed.emplace_back(range.first, end, packedSize);
+		packedSize += range.second;
+	}
+	return packed;
+}
+
+/// Offset of position in the packed ranges, position must be in one of them.
+static size_t packedOffset(const std::vector<std::tuple<size_t, size_t, size_t>> & packed, size_t position){
+	auto range = std::upper_bound(packed.begin(), packed.end(), position, [](size_t value, const std::tuple<size_t, size_t, size_t> & range){
+		return value < std::get<0>(range);
+	});
+	--range;
+	return std::get<2>(*range) + position - std::get<0>(*range);
+}
+
+void Age::compactBuffer(MutableMeshView & target, const std::vector<PageData::SubObjectData *> & subObjects){
+	std::vector<std::pair<size_t, size_t>> vertexRanges;
+	std::vector<std::pair<size_t, size_t>> indexRanges;
+	for(const PageData::SubObjectData * subObject : subObjects){
+		if(subObject->vertexCount > 0){
+			vertexRanges.emplace_back(subObject->baseVertex, subObject->vertexCount);
+		}
+		if(subObject->indexCount > 0){
+			indexRanges.emplace_back(subObject->firstIndex, subObject->indexCount);
+		}
 	}
+	const auto vertices = packRanges(vertexRanges);
+	const auto indices = packRanges(indexRanges);
 	
+	// Ranges only move towards the front, copying them in order never overwrites a range not copied yet.
+	for(const auto & range : vertices){
+		const size_t start = std::get<0>(range);
+		const size_t end = std::get<1>(range);
+		const size_t dst = std::get<2>(range);
+		std::copy(target.positions + start, target.positions + end, target.positions + dst);
+		std::copy(target.normals + start, target.normals + end, target.normals + dst);
+		std::copy(target.colors + start, target.colors + end, target.colors + dst);
+		for(glm::vec3 * texcoords : target.texcoords){
+			std::copy(texcoords + start, texcoords + end, texcoords + dst);
+		}
+	}
+	for(const auto & range : indices){
+		std::copy(target.indices + std::get<0>(range), target.indices + std::get<1>(range), target.indices + std::get<2>(range));
+	}
+	// Indices are relative to the base vertex, only the starts change.
+	for(PageData::SubObjectData * subObject : subObjects){
+		subObject->baseVertex = subObject->vertexCount > 0 ? packedOffset(vertices, subObject->baseVertex) : 0;
+		subObject->firstIndex = subObject->indexCount > 0 ? packedOffset(indices, subObject->firstIndex) : 0;
+	}
+	target.vertexCount = vertices.empty() ? 0 : std::get<2>(vertices.back()) + std::get<1>(vertices.back()) - std::get<0>(vertices.back());
+	target.indexCount = indices.empty() ? 0 : std::get<2>(indices.back()) + std::get<1>(indices.back()) - std::get<0>(indices.back());
+}
+
+// Size of the cells static subobjects are batched in, bigger subobjects are left alone.
+static const float kBatchCellSize = 100.0f;
+
+void Age::batchObjects(PageData & page, std::vector<MutableMeshView> & targets, const std::string & prefix){
+	PROFILE_ZONE("Age::batchObjects");
+	struct Member {
+		size_t object;
+		size_t subObject;
+	};
+	struct Batch {
+		glm::ivec3 cell;
+		const PageData::SubObjectData * reference;
+		size_t uvCount;
+		size_t vertexCount;
+		size_t indexCount;
+		std::vector<Member> members;
+		/// Merged subobject, in the new objects.
+		size_t object;
+		size_t subObject;
+	};
+	std::vector<Batch> batches;
+	// Candidate batches for a cell, material, mode and UV count, the lights are then compared.
+	std::map<std::tuple<int, int, int, const Material*, unsigned int, size_t>, std::vector<size_t>> candidates;
 	
-	//Log::Unmute();
-	Log::Mute();
-	int lightsCount = 0;
-	for(const auto & globLight : globalLightsUsed){
-		if(globLight.second){
+	for(size_t oid = 0; oid < page.objects.size(); ++oid){
+		const PageData::ObjectData & object = page.objects[oid];
+		// Billboards and the sky depend on their model matrix.
+		if(object.type != Object::Default || Object::isSkyName(object.name)){
 			continue;
 		}
-		Log::Info() << "Global light: " << globLight.first << std::endl;
-		++lightsCount;
+		for(size_t sid = 0; sid < object.subObjects.size(); ++sid){
+			const PageData::SubObjectData & subObject = object.subObjects[sid];
+			const MutableMeshView & mesh = targets[subObject.buffer];
+			if(subObject.vertexCount == 0 || isAlphaBlended(subObject.material)
+			   || !IndexUtilities::isValid({mesh.indices + subObject.firstIndex, subObject.indexCount}, subObject.vertexCount)){
+				continue;
+			}
+			glm::vec3 mins(std::numeric_limits<float>::max());
+			glm::vec3 maxs(-std::numeric_limits<float>::max());
+			for(size_t vid = 0; vid < subObject.vertexCount; ++vid){
+				const glm::vec3 position = glm::vec3(object.model * glm::vec4(mesh.positions[subObject.baseVertex + vid], 1.0f));
+				mins = glm::min(mins, position);
+				maxs = glm::max(maxs, position);
+			}
+			const glm::vec3 extent = maxs - mins;
+			if(extent.x > kBatchCellSize || extent.y > kBatchCellSize || extent.z > kBatchCellSize){
+				continue;
+			}
+			const glm::ivec3 cell = glm::ivec3(glm::floor(0.5f * (mins + maxs) / kBatchCellSize));
+			auto & cellBatches = candidates[std::make_tuple(cell.x, cell.y, cell.z, subObject.material.get(), subObject.mode, mesh.texcoords.size())];
+			size_t bid = 0;
+			while(bid < cellBatches.size() && !sameLights(batches[cellBatches[bid]].reference->lights, subObject.lights)){
+				++bid;
+			}
+			if(bid == cellBatches.size()){
+				cellBatches.push_back(batches.size());
+				batches.push_back({cell, &subObject, mesh.texcoords.size(), 0, 0, {}, 0, 0});
+			}
+			Batch & batch = batches[cellBatches[bid]];
+			batch.members.push_back({oid, sid});
+			batch.vertexCount += subObject.vertexCount;
+			batch.indexCount += subObject.indexCount;
+		}
 	}
-	if(lightsCount != 0){
-		Log::Info() << lightsCount << " / " << globalLightsUsed.size() << " lights are not used." << std::endl;
+	// A batch of one subobject wouldn't save anything.
+	batches.erase(std::remove_if(batches.begin(), batches.end(), [](const Batch & batch){
+		return batch.members.size() < 2;
+	}), batches.end());
+	if(batches.empty()){
+		return;
 	}
 	
+	// One buffer per UV count holds all the batches of the page, and one object per cell.
+	std::map<size_t, size_t> batchBuffers;
+	std::map<std::tuple<int, int, int>, size_t> cellObjects;
+	std::vector<PageData::ObjectData> newObjects;
+	std::vector<std::vector<bool>> batched(page.objects.size());
+	for(size_t oid = 0; oid < page.objects.size(); ++oid){
+		batched[oid].assign(page.objects[oid].subObjects.size(), false);
+	}
+	for(auto & batch : batches){
+		auto buffer = batchBuffers.find(batch.uvCount);
+		if(buffer == batchBuffers.end()){
+			buffer = batchBuffers.emplace(batch.uvCount, page.buffers.size()).first;
+			page.buffers.emplace_back();
+			page.buffers.back().name = prefix + "_batch_" + std::to_string(batch.uvCount);
+			targets.emplace_back();
+			targets.back().texcoords.resize(batch.uvCount);
+		}
+		MutableMeshView & target = targets[buffer->second];
+		
+		const auto cellKey = std::make_tuple(batch.cell.x, batch.cell.y, batch.cell.z);
+		auto cellObject = cellObjects.find(cellKey);
+		if(cellObject == cellObjects.end()){
+			cellObject = cellObjects.emplace(cellKey, newObjects.size()).first;
+			newObjects.emplace_back();
+			newObjects.back().type = Object::Default;
+			newObjects.back().model = glm::mat4(1.0f);
+			newObjects.back().name = prefix + "_batch_" + std::to_string(batch.cell.x) + "_" + std::to_string(batch.cell.y) + "_" + std::to_string(batch.cell.z);
+		}
+		PageData::SubObjectData subObject;
+		subObject.buffer = buffer->second;
+		subObject.material = batch.reference->material;
+		subObject.materialName = batch.reference->materialName;
+		subObject.lights = batch.reference->lights;
+		subObject.mode = batch.reference->mode;
+		subObject.firstIndex = target.indexCount;
+		subObject.indexCount = batch.indexCount;
+		subObject.baseVertex = target.vertexCount;
+		subObject.vertexCount = batch.vertexCount;
+		target.indexCount += batch.indexCount;
+		target.vertexCount += batch.vertexCount;
+		batch.object = cellObject->second;
+		batch.subObject = newObjects[batch.object].subObjects.size();
+		newObjects[batch.object].subObjects.push_back(subObject);
+		for(const auto & member : batch.members){
+			batched[member.object][member.subObject] = true;
+		}
+	}
 	
+	// Allocate the batch buffers, then bake the members in world space.
+	for(const auto & buffer : batchBuffers){
+		VertexUtilities::allocate(targets[buffer.second], *page.arena);
+	}
+	for(const auto & batch : batches){
+		const PageData::SubObjectData & subObject = newObjects[batch.object].subObjects[batch.subObject];
+		MutableMeshView & target = targets[subObject.buffer];
+		size_t vertexOffset = 0;
+		size_t indexOffset = 0;
+		for(const auto & member : batch.members){
+			const PageData::ObjectData & object = page.objects[member.object];
+			const PageData::SubObjectData & source = object.subObjects[member.subObject];
+			const MutableMeshView & mesh = targets[source.buffer];
+			const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(object.model)));
+			for(size_t vid = 0; vid < source.vertexCount; ++vid){
+				const size_t src = source.baseVertex + vid;
+				const size_t dst = subObject.baseVertex + vertexOffset + vid;
+				target.positions[dst] = glm::vec3(object.model * glm::vec4(mesh.positions[src], 1.0f));
+				target.normals[dst] = normalMatrix * mesh.normals[src];
+				target.colors[dst] = mesh.colors[src];
+				for(size_t uvid = 0; uvid < target.texcoords.size(); ++uvid){
+					target.texcoords[uvid][dst] = mesh.texcoords[uvid][src];
+				}
+			}
+			for(size_t iid = 0; iid < source.indexCount; ++iid){
+				target.indices[subObject.firstIndex + indexOffset + iid] = mesh.indices[source.firstIndex + iid] + (unsigned int)vertexOffset;
+			}
+			vertexOffset += source.vertexCount;
+			indexOffset += source.indexCount;
+		}
+	}
+	for(const auto & buffer : batchBuffers){
+		page.buffers[buffer.second].view = MeshView(targets[buffer.second]);
+	}
 	
+	// Remove the batched subobjects, and the objects left empty.
+	std::vector<PageData::ObjectData> objects;
+	for(size_t oid = 0; oid < page.objects.size(); ++oid){
+		PageData::ObjectData & object = page.objects[oid];
+		std::vector<PageData::SubObjectData> subObjects;
+		for(size_t sid = 0; sid < object.subObjects.size(); ++sid){
+			if(!batched[oid][sid]){
+				subObjects.push_back(std::move(object.subObjects[sid]));
+			}
+		}
+		if(!subObjects.empty()){
+			object.subObjects = std::move(subObjects);
+			objects.push_back(std::move(object));
+		}
+	}
+	for(auto & newObject : newObjects){
+		objects.push_back(std::move(newObject));
+	}
+	page.objects = std::move(objects);
 	
-	// Extract textures.
-	const auto textureKeys = rm.getKeys(ploc, pdUnifiedTypeMap::ClassIndex("plMipmap"));
-	Log::Info() << textureKeys.size() << " textures." << std::endl;
+	// Buffers whose subobjects have all been batched are not uploaded,
+	// the ranges left unused in partially batched buffers are removed.
+	std::vector<std::vector<PageData::SubObjectData *>> users(page.buffers.size());
+	for(auto & object : page.objects){
+		for(auto & subObject : object.subObjects){
+			users[subObject.buffer].push_back(&subObject);
+		}
+	}
+	std::vector<PageData::BufferData> buffers;
+	std::vector<MutableMeshView> views;
+	for(size_t bid = 0; bid < page.buffers.size(); ++bid){
+		if(users[bid].empty()){
+			continue;
+		}
+		compactBuffer(targets[bid], users[bid]);
+		for(PageData::SubObjectData * subObject : users[bid]){
+			subObject->buffer = buffers.size();
+		}
+		buffers.push_back(std::move(page.buffers[bid]));
+		buffers.back().view = MeshView(targets[bid]);
+		views.push_back(std::move(targets[bid]));
+	}
+	page.buffers = std::move(buffers);
+	targets = std::move(views);
+}
 
-	for(const auto & texture : textureKeys){
-		// For each texture, send it to the gpu and keep a reference and the name.
+void Age::optimizeMeshes(PageData & page, std::vector<MutableMeshView> & targets){
+	PROFILE_ZONE("Age::optimizeMeshes");
+	// Subobjects sharing a vertex range are renumbered together.
+	std::map<std::pair<size_t, size_t>, std::vector<PageData::SubObjectData*>> groups;
+	for(auto & object : page.objects){
+		for(auto & subObject : object.subObjects){
+			groups[std::make_pair(subObject.buffer, subObject.baseVertex)].push_back(&subObject);
+		}
+	}
+	
+	std::vector<unsigned int> remap;
+	std::vector<size_t> clusters;
+	std::vector<IndexUtilities::IndexRange> ranges;
+	for(auto & group : groups){
+		MutableMeshView & mesh = targets[group.first.first];
+		const size_t baseVertex = group.first.second;
+		const size_t vertexCount = group.second[0]->vertexCount;
 		
-		plMipmap* tex = plMipmap::Convert(texture->getObj());
+		ranges.clear();
+		bool valid = true;
+		for(const auto * subObject : group.second){
+			ranges.push_back({mesh.indices + subObject->firstIndex, subObject->indexCount});
+			valid = valid && IndexUtilities::isValid(ranges.back(), vertexCount);
+		}
+		// Leave broken icicles as exported.
+		if(!valid){
+			continue;
+		}
+		for(const auto & range : ranges){
+			page.cacheBefore += IndexUtilities::analyzeCache(range, vertexCount);
+		}
 		
-		const std::string textureName = texture->getName().to_std_string() ;
-		Log::Info() << textureName << std::endl;
-		Resources::manager().registerTexture(textureName, tex);
-		_textures.push_back(textureName);
+		// Exact duplicates become the same vertex, the others are then left unused.
+		if(IndexUtilities::weldVertices(MeshView(mesh), baseVertex, vertexCount, remap) < vertexCount){
+			for(const auto & range : ranges){
+				for(size_t iid = 0; iid < range.count; ++iid){
+					range.indices[iid] = remap[range.indices[iid]];
+				}
+			}
+		}
+		for(size_t sid = 0; sid < ranges.size(); ++sid){
+			if(isAlphaBlended(group.second[sid]->material)){
+				continue;
+			}
+			IndexUtilities::optimizeCache(ranges[sid], vertexCount, clusters);
+			IndexUtilities::optimizeOverdraw(ranges[sid], mesh.positions + baseVertex, clusters);
+		}
+		// Used vertices are moved to the front of the range, in the order the triangles fetch them.
+		const size_t usedCount = IndexUtilities::optimizeFetch(ranges, vertexCount, remap);
+		IndexUtilities::remapVertices(mesh, baseVertex, vertexCount, remap);
+		for(auto * subObject : group.second){
+			subObject->vertexCount = usedCount;
+		}
+		for(const auto & range : ranges){
+			page.cacheAfter += IndexUtilities::analyzeCache(range, usedCount);
+		}
+	}
+}
+
+// Smaller subobjects are not worth the simplification.
+static const size_t kLodMinTriangles = 256;
+static const size_t kLodMaxLevels = 3;
+
+void Age::generateLods(PageData & page, std::vector<MutableMeshView> & targets){
+	PROFILE_ZONE("Age::generateLods");
+	// Levels of each buffer, appended to its indices once all are generated.
+	std::vector<std::vector<unsigned int>> levels(targets.size());
+	std::vector<unsigned int> simplified;
+	std::vector<size_t> clusters;
+	for(auto & object : page.objects){
+		for(auto & subObject : object.subObjects){
+			if(subObject.indexCount / 3 < kLodMinTriangles || isAlphaBlended(subObject.material)){
+				continue;
+			}
+			const MutableMeshView & mesh = targets[subObject.buffer];
+			const IndexUtilities::IndexRange range = {mesh.indices + subObject.firstIndex, subObject.indexCount};
+			if(!IndexUtilities::isValid(range, subObject.vertexCount)){
+				continue;
+			}
+			std::vector<unsigned int> & indices = levels[subObject.buffer];
+			size_t previousCount = subObject.indexCount;
+			float previousError = 0.0f;
+			// Each level halves the triangle count of the full mesh.
+			for(size_t level = 1; level <= kLodMaxLevels; ++level){
+				const float error = (std::max)(previousError, IndexUtilities::simplify(range, mesh.positions + subObject.baseVertex, subObject.vertexCount, subObject.indexCount >> level, simplified));
+				// Borders and seams can prevent any significant reduction.
+				if(simplified.empty() || 4 * simplified.size() > 3 * previousCount){
+					break;
+				}
+				IndexUtilities::optimizeCache({simplified.data(), simplified.size()}, subObject.vertexCount, clusters);
+				subObject.lods.push_back({mesh.indexCount + indices.size(), simplified.size(), error});
+				indices.insert(indices.end(), simplified.begin(), simplified.end());
+				previousCount = simplified.size();
+				previousError = error;
+			}
+		}
+	}
+	for(size_t bid = 0; bid < targets.size(); ++bid){
+		const std::vector<unsigned int> & indices = levels[bid];
+		if(indices.empty()){
+			continue;
+		}
+		MutableMeshView & mesh = targets[bid];
+		unsigned int * allIndices = page.arena->allocate<unsigned int>(mesh.indexCount + indices.size());
+		std::copy(mesh.indices, mesh.indices + mesh.indexCount, allIndices);
+		std::copy(indices.begin(), indices.end(), allIndices + mesh.indexCount);
+		mesh.indices = allIndices;
+		mesh.indexCount += indices.size();
+		page.buffers[bid].view = MeshView(mesh);
+	}
+}
+
+// Smaller subobjects are culled as a whole.
+static const size_t kMeshletMinTriangles = 512;
+
+void Age::buildMeshlets(PageData & page, std::vector<MutableMeshView> & targets){
+	PROFILE_ZONE("Age::buildMeshlets");
+	for(auto & object : page.objects){
+		// Billboards are oriented at draw time.
+		if(object.type != Object::Default){
+			continue;
+		}
+		for(auto & subObject : object.subObjects){
+			// Meshlets reorder the triangles, blended ones are drawn in their exported order.
+			if(subObject.indexCount / 3 < kMeshletMinTriangles || isAlphaBlended(subObject.material)){
+				continue;
+			}
+			const MutableMeshView & mesh = targets[subObject.buffer];
+			const IndexUtilities::IndexRange range = {mesh.indices + subObject.firstIndex, subObject.indexCount};
+			if(!IndexUtilities::isValid(range, subObject.vertexCount)){
+				continue;
+			}
+			IndexUtilities::buildMeshlets(range, mesh.positions + subObject.baseVertex, subObject.vertexCount, subObject.meshlets);
+		}
+	}
+}
+
+/// Hash of the format and levels data, the same bytes in another format are a different texture.
+static uint64_t hashMipmap(const plMipmap * mipmap, uint64_t seed){
+	uint64_t hash = HashUtilities::hashValue(uint64_t(mipmap->getWidth()), seed);
+	hash = HashUtilities::hashValue(uint64_t(mipmap->getHeight()), hash);
+	hash = HashUtilities::hashValue(uint64_t(mipmap->getNumLevels()), hash);
+	hash = HashUtilities::hashValue(uint64_t(mipmap->getCompressionType()), hash);
+	hash = HashUtilities::hashValue(uint64_t(mipmap->getDXCompression()), hash);
+	hash = HashUtilities::hashValue(uint64_t(mipmap->getBPP()), hash);
+	hash = HashUtilities::hashValue(uint64_t(mipmap->getARGBType()), hash);
+	return HashUtilities::hash(mipmap->getImageData(), mipmap->getTotalSize(), hash);
+}
+
+void Age::loadTextures(plResManager & rm, const plLocation& ploc, PageData & page, unsigned int threadCount){
+	PROFILE_ZONE("Age::loadTextures");
+	// Extract textures.
+	std::vector<size_t> decoded;
+	for(const auto & texture : rm.getKeys(ploc, pdUnifiedTypeMap::ClassIndex("plMipmap"))){
+		plMipmap* tex = plMipmap::Convert(texture->getObj());
+		if(TextureUtilities::isDecoded(tex)){
+			decoded.push_back(page.textures.size());
+		}
+		page.textures.push_back({texture->getName().to_std_string(), tex, 0, nullptr});
+	}
+	// Texture pages can hold hundreds of JPEGs, hash them and build their pyramids in parallel
+	// instead of generating the levels one texture at a time on the render thread.
+	// Exceptions can't cross the worker threads, keep the first one and rethrow it for the page.
+	std::mutex errorMutex;
+	std::string error;
+	ThreadUtilities::parallelFor(decoded.size(), threadCount, [&page, &decoded, &errorMutex, &error](size_t did){
+		auto & texture = page.textures[decoded[did]];
+		try {
+			std::shared_ptr<MipChain> chain = std::make_shared<MipChain>();
+			TextureUtilities::buildMipChain(texture.data, *chain);
+			texture.chain = chain;
+			texture.hash = hashMipmap(texture.data, 0);
+		} catch(const std::exception & e){
+			std::lock_guard<std::mutex> lock(errorMutex);
+			if(error.empty()){
+				error = texture.name + ": " + e.what();
+			}
+		}
+	});
+	if(!error.empty()){
+		throw std::runtime_error(error);
+	}
+	for(auto & texture : page.textures){
+		if(!texture.chain){
+			texture.hash = hashMipmap(texture.data, 0);
+		}
 	}
 	// Extract cubemaps.
-	const auto envmapKeys = rm.getKeys(ploc, pdUnifiedTypeMap::ClassIndex("plCubicEnvironmap"));
-	Log::Info() << envmapKeys.size() << " cubemaps." << std::endl;
-	
-	for(const auto & envmap : envmapKeys){
-		// For each texture, send it to the gpu and keep a reference and the name.
+	for(const auto & envmap : rm.getKeys(ploc, pdUnifiedTypeMap::ClassIndex("plCubicEnvironmap"))){
 		plCubicEnvironmap* env = plCubicEnvironmap::Convert(envmap->getObj());
+		// Differentiate from a 2D texture with the same content as the first face.
+		uint64_t hash = HashUtilities::hashValue(uint64_t(plCubicEnvironmap::kNumFaces), 0);
+		for(size_t face = 0; face < plCubicEnvironmap::kNumFaces; ++face){
+			hash = hashMipmap(env->getFace(face), hash);
+		}
+		page.cubemaps.push_back({envmap->getName().to_std_string(), env, hash, nullptr});
+	}
+}
+
+void Age::hashBuffers(PageData & page){
+	for(auto & buffer : page.buffers){
+		const MeshView & mesh = buffer.view;
+		uint64_t hash = HashUtilities::hashValue(uint64_t(mesh.texcoords.size()), 0);
+		hash = HashUtilities::hash(mesh.indices, sizeof(unsigned int) * mesh.indexCount, hash);
+		hash = HashUtilities::hash(mesh.positions, sizeof(glm::vec3) * mesh.vertexCount, hash);
+		hash = HashUtilities::hash(mesh.normals, sizeof(glm::vec3) * mesh.vertexCount, hash);
+		hash = HashUtilities::hash(mesh.colors, sizeof(glm::u8vec4) * mesh.vertexCount, hash);
+		for(const auto & texcoords : mesh.texcoords){
+			hash = HashUtilities::hash(texcoords, sizeof(glm::vec3) * mesh.vertexCount, hash);
+		}
+		buffer.hash = hash;
+	}
+}
+
+/// Largest scale of the UV transformations of a layer and its underlays, on each of the UV channels they read.
+static void layerUVScales(const MaterialLayer & layer, std::vector<float> & scales){
+	const bool channel = layer.uvwSrc != plLayer::kUVWNormal && layer.uvwSrc != plLayer::kUVWPosition && layer.uvwSrc != plLayer::kUVWReflect;
+	const size_t uvid = size_t(layer.uvwSrc & plLayer::kUVWIdxMask);
+	if(channel && uvid < scales.size()){
+		// Bound of the error on each transformed coordinate, for an error on all the input coordinates.
+		for(int row = 0; row < 2; ++row){
+			const float scale = std::abs(layer.transform[0][row]) + std::abs(layer.transform[1][row]) + std::abs(layer.transform[2][row]);
+			scales[uvid] = (std::max)(scales[uvid], scale);
+		}
+	}
+	if(layer.underlay){
+		layerUVScales(*layer.underlay, scales);
+	}
+}
+
+std::vector<std::vector<float>> Age::uvScales(const PageData & page){
+	std::vector<std::vector<float>> scales(page.buffers.size());
+	for(size_t bid = 0; bid < page.buffers.size(); ++bid){
+		scales[bid].assign(page.buffers[bid].view.texcoords.size(), 1.0f);
+	}
+	for(const auto & object : page.objects){
+		for(const auto & subObject : object.subObjects){
+			if(!subObject.material){
+				continue;
+			}
+			for(const auto & layer : subObject.material->layers){
+				layerUVScales(layer, scales[subObject.buffer]);
+			}
+		}
+	}
+	return scales;
+}
+
+void Age::uploadPage(PageData & page){
+	PROFILE_ZONE("Age::uploadPage");
+	
+	if(page.cache && !page.uploadedOnce){
+		++_pagesCached;
+	}
+	
+	// Pages out of range are only converted once to know their extent.
+	const bool inRange = !streaming() || !page.hasWorldBounds || streamDistance(page) < _streamRadius;
+	if(inRange){
+		page.gpuSize = 0;
+		// Each buffer is uploaded once, subobjects reference ranges in it.
+		std::vector<MeshView> buffers;
+		std::vector<MeshInfos> buffersInfos;
+		const std::vector<std::vector<float>> scales = uvScales(page);
+		for(size_t bid = 0; bid < page.buffers.size(); ++bid){
+			const auto & buffer = page.buffers[bid];
+			buffers.push_back(buffer.view);
+			buffers.back().uvScales = scales[bid];
+			// The GPU layout depends on the UV scales, identical content is only shared with the same ones.
+			const uint64_t hash = buffer.hash == 0 ? 0 : HashUtilities::hash(scales[bid].data(), sizeof(float) * scales[bid].size(), buffer.hash);
+			buffersInfos.push_back(Resources::manager().registerMesh(buffer.name, buffers.back(), hash));
+			page.residentMeshes.emplace_back(buffer.name, hash);
+			page.gpuSize += buffersInfos.back().size;
+		}
+		for(auto & objectData : page.objects){
+			_objects.emplace_back(new Object(objectData.type, Resources::manager().getProgram("object_basic"), objectData.model, objectData.name));
+			for(auto & subObject : objectData.subObjects){
+				const MeshInfos infos = Resources::manager().meshRange(buffersInfos[subObject.buffer], buffers[subObject.buffer], subObject.firstIndex, subObject.indexCount, subObject.baseVertex, subObject.vertexCount);
+				std::vector<Object::SubObject::Lod> lods;
+				for(const auto & lod : subObject.lods){
+					lods.push_back({buffersInfos[subObject.buffer].firstIndex + lod.firstIndex, GLsizei(lod.indexCount), lod.error});
+				}
+				_objects.back()->addSubObject(infos, subObject.material, subObject.lights, subObject.mode, lods, subObject.meshlets);
+			}
+			page.residentObjects.push_back(_objects.back());
+		}
 		
-		const std::string envmapName = envmap->getName().to_std_string() ;
-		Resources::manager().registerCubemap(envmapName, env);
-		_textures.push_back(envmapName);
+		// For each texture, keep a reference and the name, it will be sent to the GPU when first used.
+		for(const auto & texture : page.textures){
+			Resources::manager().deferTexture(texture.name, texture.data, page.rm, texture.hash, texture.chain);
+			_textures.push_back(texture.name);
+			page.residentTextures.emplace_back(texture.name, texture.hash);
+		}
+		for(const auto & envmap : page.cubemaps){
+			Resources::manager().deferCubemap(envmap.name, envmap.data, page.rm, envmap.hash);
+			_textures.push_back(envmap.name);
+			page.residentTextures.emplace_back(envmap.name, envmap.hash);
+		}
+		page.resident = true;
+		_residentSize += page.gpuSize;
 	}
 	
-	Log::Unmute();
+	// The converted data is not needed anymore, objects use their own copy of the materials.
+	page.buffers.clear();
+	page.objects.clear();
+	page.cache.reset();
+	page.arena.reset();
+	page.textures.clear();
+	page.cubemaps.clear();
+	// The decoded page is only needed to convert it again when streaming.
+	// Deferred textures keep the manager alive until they are uploaded.
+	if(!streaming()){
+		page.rm.reset();
+		page.info = nullptr;
+	}
+}
+
+void Age::computeWorldBounds(PageData & page){
+	// Same as the objects global bounds, using the local bounds of their meshes.
+	page.gpuSize = 0;
+	std::vector<MeshView> buffers;
+	for(const auto & buffer : page.buffers){
+		buffers.push_back(buffer.view);
+		const MeshView & mesh = buffers.back();
+		page.gpuSize += sizeof(unsigned int) * mesh.indexCount + (sizeof(float) * 3 * (2 + mesh.texcoords.size()) + 4) * mesh.vertexCount;
+	}
+	for(const auto & objectData : page.objects){
+		BoundingBox localBounds;
+		bool first = true;
+		for(const auto & subObject : objectData.subObjects){
+			const glm::vec3 * positions = buffers[subObject.buffer].positions + subObject.baseVertex;
+			for(size_t vid = 0; vid < subObject.vertexCount; ++vid){
+				if(first){
+					localBounds = BoundingBox(positions[vid], positions[vid]);
+					first = false;
+				}
+				localBounds += positions[vid];
+			}
+		}
+		if(first){
+			continue;
+		}
+		localBounds.updateValues();
+		const BoundingBox globalBounds = localBounds.transform(objectData.model);
+		if(page.hasWorldBounds){
+			page.worldBounds += globalBounds;
+		} else {
+			page.worldBounds = globalBounds;
+			page.hasWorldBounds = true;
+		}
+	}
+	page.worldBounds.updateValues();
+}
+
+void Age::evictPage(PageData & page){
+	const std::set<const Object *> pageObjects = [&page](){
+		std::set<const Object *> objects;
+		for(const auto & object : page.residentObjects){
+			objects.insert(object.get());
+		}
+		return objects;
+	}();
+	_objects.erase(std::remove_if(_objects.begin(), _objects.end(), [&pageObjects](const std::shared_ptr<Object> & object){
+		return pageObjects.count(object.get()) > 0;
+	}), _objects.end());
+	
+	std::set<std::string> pageTextures;
+	for(const auto & texture : page.residentTextures){
+		pageTextures.insert(texture.first);
+	}
+	_textures.erase(std::remove_if(_textures.begin(), _textures.end(), [&pageTextures](const std::string & texture){
+		return pageTextures.count(texture) > 0;
+	}), _textures.end());
+	
+	for(const auto & mesh : page.residentMeshes){
+		Resources::manager().releaseMesh(mesh.first, mesh.second);
+	}
+	for(const auto & texture : page.residentTextures){
+		Resources::manager().releaseTexture(texture.first, texture.second);
+	}
+	page.residentObjects.clear();
+	page.residentMeshes.clear();
+	page.residentTextures.clear();
+	page.resident = false;
+	_residentSize -= page.gpuSize;
+}
+
+float Age::streamDistance(const PageData & page) const {
+	const glm::vec3 delta = glm::max(glm::max(page.worldBounds.mins - _streamPosition, _streamPosition - page.worldBounds.maxs), glm::vec3(0.0f));
+	return glm::length(delta);
+}
+
+void Age::setStreaming(float radius, size_t budget){
+	_streamRadius = (std::max)(0.0f, radius);
+	_streamBudget = budget;
+}
+
+size_t Age::residentPages() const {
+	size_t count = 0;
+	for(const auto & page : _pages){
+		count += page.resident ? 1 : 0;
+	}
+	return count;
+}
+
+size_t Age::deduplicatedSize() const {
+	size_t size = 0;
+	for(const auto & page : _pages){
+		size += Resources::manager().deduplicatedSize(page.residentMeshes, page.residentTextures);
+	}
+	return size;
+}
+
+size_t Age::gpuSize() const {
+	const size_t size = _residentSize + Resources::manager().textureSize(_textures);
+	return size - (std::min)(size, deduplicatedSize());
+}
+
+void Age::release(){
+	// Pages might still be appended by the loader.
+	std::lock_guard<std::mutex> lock(_streamMutex);
+	for(auto & page : _pages){
+		if(page.resident){
+			evictPage(page);
+		}
+	}
+	_objects.clear();
+	_textures.clear();
+}
+
+void Age::stream(const glm::vec3 & position){
+	_streamPosition = position;
+	// Wait for the initial conversion to be done.
+	if(!streaming() || !_converted){
+		return;
+	}
+	// Pages are evicted a bit further than where they are loaded, to avoid reloading them over and over.
+	const float evictRadius = 1.25f * _streamRadius;
+	
+	std::vector<std::pair<float, size_t>> residents;
+	std::vector<std::pair<float, size_t>> candidates;
+	for(size_t pid = 0; pid < _pages.size(); ++pid){
+		PageData & page = _pages[pid];
+		// Pages without geometry are always kept.
+		if(!page.uploadedOnce || page.requested || page.reloading || !page.hasWorldBounds || !page.error.empty()){
+			continue;
+		}
+		const float distance = streamDistance(page);
+		if(page.resident){
+			if(distance > evictRadius){
+				evictPage(page);
+			} else {
+				residents.emplace_back(distance, pid);
+			}
+		} else if(distance < _streamRadius){
+			candidates.emplace_back(distance, pid);
+		}
+	}
+	
+	// Enforce the budget by evicting the farthest pages first.
+	std::sort(residents.begin(), residents.end(), [](const std::pair<float, size_t> & left, const std::pair<float, size_t> & right){
+		return left.first > right.first;
+	});
+	size_t farthest = 0;
+	while(_residentSize + _requestedSize > _streamBudget && farthest < residents.size()){
+		evictPage(_pages[residents[farthest++].second]);
+	}
+	
+	// Bring back the closest pages, making room by evicting farther ones if needed.
+	std::sort(candidates.begin(), candidates.end());
+	std::vector<size_t> requests;
+	for(const auto & candidate : candidates){
+		PageData & page = _pages[candidate.second];
+		while(_residentSize + _requestedSize + page.gpuSize > _streamBudget && farthest < residents.size() && residents[farthest].first > candidate.first){
+			evictPage(_pages[residents[farthest++].second]);
+		}
+		if(_residentSize + _requestedSize + page.gpuSize > _streamBudget){
+			break;
+		}
+		page.requested = true;
+		_requestedSize += page.gpuSize;
+		requests.push_back(candidate.second);
+	}
+	if(requests.empty()){
+		return;
+	}
+	
+	{
+		std::lock_guard<std::mutex> lock(_streamMutex);
+		_streamRequests.insert(_streamRequests.end(), requests.begin(), requests.end());
+	}
+	if(!_streamer.joinable()){
+		_streamer = std::thread(&Age::streamPages, this);
+	}
+	_streamCondition.notify_one();
+}
+
+void Age::streamPages(){
+	while(true){
+		size_t pid = 0;
+		PageData * page = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(_streamMutex);
+			_streamCondition.wait(lock, [this](){
+				return _cancel || !_streamRequests.empty();
+			});
+			if(_cancel){
+				return;
+			}
+			pid = _streamRequests.front();
+			_streamRequests.pop_front();
+			// Pages can be appended concurrently, access the list under the lock.
+			page = &_pages[pid];
+		}
+		// The page objects are not displayed anymore, its manager is only used here.
+		if(!page->cacheFile.empty()){
+			PageCache::load(page->cacheFile, *page);
+		}
+		convertPage(*page, _threadCount);
+		std::lock_guard<std::mutex> lock(_readyMutex);
+		_readyPages.push_back(pid);
+	}
 }
 
 const glm::vec3 Age::getDefaultLinkingPoint(){
@@ -2,21 +2,38 @@
 #define Age_h
 
 #include "Object.hpp"
+#include "helpers/TextureUtilities.hpp"
+#include "helpers/Arena.hpp"
+#include "helpers/IndexUtilities.hpp"
 #include <string>
 #include <vector>
 #include <memory>
 #include <map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 
 class plResManager;
 class plLocation;
+class plPageInfo;
 class plFogEnvironment;
+class plMipmap;
+class plCubicEnvironmap;
+class MappedFile;
+class hsGMaterial;
 
 class Age {
 public:
 	
 	Age();
 	
-	Age(const std::string & path);
+	/// Load an age, decoding and converting its pages on threadCount threads (0 for one per core).
+	/// If background is true, this returns immediately and pages become available through uploadPages.
+	/// Converted geometry is cached in cacheDirectory if not empty. Only the pages listed in pageNames are loaded, all if empty.
+	Age(const std::string & path, unsigned int threadCount = 0, bool background = false, const std::string & cacheDirectory = "", const std::vector<std::string> & pageNames = {});
 	
 	~Age();
 	
@@ -24,6 +41,11 @@ public:
 		return _name;
 	}
 	
+	/// Path of the age file, empty for the default age.
+	const std::string & path() const {
+		return _path;
+	}
+	
 	const std::vector<std::shared_ptr<Object>> & objects(){
 		return _objects;
 	}
@@ -57,24 +79,322 @@ public:
 		return _fogEnv;
 	}
 	
+	/// Upload converted pages to the GPU, for at most budget seconds (at least one page is uploaded if available).
+	/// Must be called on the thread owning the GL context. Returns the number of pages uploaded.
+	size_t uploadPages(double budget);
+	
+	/// Are converted pages waiting for their upload?
+	bool hasPendingPages();
+	
+	/// Have the linking points been found and the first pages converted?
+	bool ready(){
+		return _converted || hasPendingPages();
+	}
+	
+	bool loading() const {
+		return !_loaded;
+	}
+	
+	/// Loading progress in [0,1].
+	float progress() const;
+	
+	/// Only keep pages closer than radius to the camera resident, within a GPU memory budget in bytes. A radius of 0 disables streaming.
+	void setStreaming(float radius, size_t budget);
+	
+	/// Load and evict pages around the camera position, on the thread owning the GL context.
+	void stream(const glm::vec3 & position);
+	
+	bool streaming() const {
+		return _streamRadius > 0.0f;
+	}
+	
+	/// Approximate GPU memory used by resident pages, in bytes.
+	size_t residentSize() const {
+		return _residentSize;
+	}
+	
+	size_t residentPages() const;
+	
+	/// GPU memory saved by reusing identical meshes and textures, from this age or others.
+	size_t deduplicatedSize() const;
+	
+	/// Approximate GPU memory used by the age geometry and uploaded textures, shared content counted once.
+	size_t gpuSize() const;
+	
+	/// Free the GPU data of all resident pages, on the thread owning the GL context. The age can't be displayed afterwards.
+	void release();
+	
+	size_t pageCount() const {
+		return _pages.size();
+	}
+	
+	/// Names and paths of all the pages of the age, loaded or not.
+	const std::vector<std::pair<std::string, std::string>> & availablePages() const {
+		return _availablePages;
+	}
+	
+	bool isPageLoaded(const std::string & name) const;
+	
+	/// Read and convert again the pages whose file changed on disk since they were loaded, in the background if
+	/// the age was loaded this way. Other pages are untouched. Returns the number of pages being reloaded.
+	size_t reloadChangedPages();
+	
+	bool reloading() const {
+		return _reloadingPages > 0;
+	}
+	
+	/// Load additional pages into the age, with the same settings as the initial ones.
+	/// Returns false if pages are already being loaded or if there is nothing new to load.
+	bool addPages(const std::vector<std::string> & pageNames);
+	
 private:
 	
+	friend class PageCache;
+	
+	/// Lights and soft volume strengths of all the pages read, by name. Each page is read in its own manager,
+	/// the permanent lights of icicles and the soft volumes of lights defined in other pages are found here.
+	struct LightTable {
+		std::map<std::string, Light> lights;
+		std::map<std::string, float> volumes;
+	};
+	
+	/// Geometry and assets of a page, converted on a worker thread and waiting for their upload.
+	struct PageData {
+		
+		/// Geometry of all the icicles of a buffer group, uploaded once.
+		struct BufferData {
+			std::string name;
+			/// Points to the page arena, or to the cached data when loaded from the cache.
+			MeshView view;
+			/// Content hash, identical buffers are uploaded once.
+			uint64_t hash = 0;
+		};
+		
+		template<typename T> struct TextureData {
+			std::string name;
+			T * data;
+			/// Content hash, identical textures are uploaded once.
+			uint64_t hash;
+			/// Lower levels of JPEG and PNG textures, built by the workers.
+			std::shared_ptr<const MipChain> chain;
+		};
+		
+		struct SubObjectData {
+			/// Simplified index range in the same buffer, sharing the vertex range of the icicle.
+			struct LodData {
+				size_t firstIndex;
+				size_t indexCount;
+				float error;
+			};
+			/// Range of the icicle in its buffer, indices are relative to baseVertex.
+			size_t buffer = 0;
+			size_t firstIndex = 0;
+			size_t indexCount = 0;
+			size_t baseVertex = 0;
+			size_t vertexCount = 0;
+			std::shared_ptr<Material> material;
+			std::string materialName;
+			std::vector<Light> lights;
+			unsigned int mode;
+			std::vector<LodData> lods;
+			/// Clusters of the full mesh, culled separately.
+			std::vector<IndexUtilities::Meshlet> meshlets;
+		};
+		
+		struct ObjectData {
+			Object::Type type;
+			glm::mat4 model;
+			std::string name;
+			std::vector<SubObjectData> subObjects;
+		};
+		
+		std::string path;
+		std::string cacheFile;
+		/// State of the page file when it was read, to detect changes.
+		uint64_t fileSize = 0;
+		int64_t fileTime = 0;
+		uint64_t fileHash = 0;
+		/// Bytes of the objects deserialized and of the unused ones skipped, and time spent reading the page.
+		size_t objectBytes = 0;
+		size_t skippedBytes = 0;
+		double readDuration = 0.0;
+		/// Vertex cache efficiency of the page geometry as exported, and once optimized.
+		IndexUtilities::CacheStats cacheBefore;
+		IndexUtilities::CacheStats cacheAfter;
+		std::shared_ptr<plResManager> rm;
+		/// Classes only needed to convert the geometry, left unread when the cache was up to date.
+		std::vector<short> deferredTypes;
+		/// Lights of the age when the page was read.
+		std::shared_ptr<const LightTable> ageLights;
+		/// Mapped cache file, if the geometry was up to date on disk.
+		std::shared_ptr<MappedFile> cache;
+		/// Converted geometry, released once the page is uploaded.
+		std::shared_ptr<Arena> arena;
+		plPageInfo * info = nullptr;
+		/// Approximate extent of the page geometry.
+		BoundingBox bounds;
+		bool hasBounds = false;
+		std::vector<BufferData> buffers;
+		std::vector<ObjectData> objects;
+		std::vector<std::pair<std::string, glm::vec3>> linkingPoints;
+		std::vector<TextureData<plMipmap>> textures;
+		std::vector<TextureData<plCubicEnvironmap>> cubemaps;
+		std::string error;
+		bool linkingRegistered = false;
+		
+		// Streaming state, only accessed on the main thread once the page has been uploaded.
+		/// Extent of the page objects, computed once at conversion.
+		BoundingBox worldBounds;
+		bool hasWorldBounds = false;
+		/// GPU memory used by the page, estimated from its geometry until it is uploaded.
+		size_t gpuSize = 0;
+		bool uploadedOnce = false;
+		bool resident = false;
+		bool requested = false;
+		bool reloading = false;
+		std::vector<std::shared_ptr<Object>> residentObjects;
+		/// Names of the registered buffers and textures, and their content hash.
+		std::vector<std::pair<std::string, uint64_t>> residentMeshes;
+		std::vector<std::pair<std::string, uint64_t>> residentTextures;
+	};
+	
 	std::shared_ptr<ProgramInfos> generateShaders(hsGMaterial * mat);
 	
-	void loadMeshes( plResManager & rm, const plLocation& ploc);
+	/// Index of the page with the given name (case insensitive) in the available pages.
+	size_t findPage(const std::string & name) const;
+	
+	/// Add a page to the list of loaded pages, without loading it yet.
+	void appendPage(const std::string & path);
+	
+	/// Load pages from firstPage to the end of the list, in the background if requested.
+	void startLoading(size_t firstPage);
+	
+	/// Read and convert pages from firstPage to the end of the list, closest to the default linking point first.
+	void loadPages(size_t firstPage);
+	
+	void registerLinkingPoints(PageData & page);
+	
+	/// Largest scale applied to each UV channel of each page buffer by the materials using it.
+	static std::vector<std::vector<float>> uvScales(const PageData & page);
+	
+	/// Add the lights and soft volumes of freshly read pages to the age table, and share it with these pages.
+	void updateLights(const std::vector<size_t> & pageIds);
+	
+	/// Read and convert the given pages again, once their previous content has been released.
+	void reloadPages(std::vector<size_t> pageIds);
+	
+	/// Decode a page and find its linking points, can be called from any thread.
+	static void readPage(PageData & page);
+	
+	/// Deserialize the objects of the given classes in a decoded page, objects that fail to read are left as stubs.
+	static void readObjects(PageData & page, const std::vector<short> & types);
+	
+	/// Read the classes deferred by readPage, needed when the geometry has to be converted after all.
+	static void readDeferred(PageData & page);
+	
+	/// Convert the content of a decoded page, can be called from any thread.
+	static void convertPage(PageData & page, unsigned int threadCount);
+	
+	void loadFog(const std::string & path);
+	
+	static void loadMeshes(plResManager & rm, const plLocation& ploc, PageData & page);
+	
+	/// Merge the opaque subobjects of static objects sharing a material, mode and lights in the same cell of space into
+	/// one subobject baked in world space, added to a new object per cell. Buffers left unused are removed.
+	static void batchObjects(PageData & page, std::vector<MutableMeshView> & targets, const std::string & prefix);
+	
+	/// Move the vertex and index ranges used by subObjects to the front of target, dropping the others.
+	static void compactBuffer(MutableMeshView & target, const std::vector<PageData::SubObjectData *> & subObjects);
+	
+	/// Weld duplicated vertices, reorder triangles for the vertex cache and, on opaque subobjects, for overdraw,
+	/// then renumber vertices in fetch order. targets are the writable views of the page buffers.
+	static void optimizeMeshes(PageData & page, std::vector<MutableMeshView> & targets);
+	
+	/// Simplify the dense opaque subobjects into a few levels of detail, appended to the indices of their buffer.
+	static void generateLods(PageData & page, std::vector<MutableMeshView> & targets);
+	
+	/// Split the large subobjects of static objects in meshlets.
+	static void buildMeshlets(PageData & page, std::vector<MutableMeshView> & targets);
+	
+	/// JPEG and PNG mip chains are built in parallel, on up to threadCount threads. Throws if a chain can't be built.
+	static void loadTextures(plResManager & rm, const plLocation& ploc, PageData & page, unsigned int threadCount);
+	
+	/// Hash the converted geometry of the page, so that identical buffers can be shared.
+	static void hashBuffers(PageData & page);
+	
+	/// Compute the page world bounds and geometry size from its converted objects.
+	static void computeWorldBounds(PageData & page);
+	
+	/// Register the page content with the GPU, on the thread owning the GL context.
+	void uploadPage(PageData & page);
+	
+	/// Release the page objects and GPU resources, the page can be converted again later.
+	void evictPage(PageData & page);
+	
+	/// Distance from the streaming position to the page extent.
+	float streamDistance(const PageData & page) const;
+	
+	/// Convert again pages requested by the streaming.
+	void streamPages();
 	
 	std::string _name;
-	std::shared_ptr<plResManager> _rm;
+	std::string _path;
+	/// Each page is decoded in its own manager, released once the page is uploaded unless streaming.
+	/// Stored in a deque so that pages can be appended while workers hold references to others.
+	std::deque<PageData> _pages;
+	std::vector<std::pair<std::string, std::string>> _availablePages;
+	std::string _cacheDirectory;
 	std::vector<std::shared_ptr<Object>> _objects;
 	std::vector<std::string> _textures;
 	std::map<std::string, glm::vec3> _linkingPoints;
 	std::vector<std::string> _linkingNamesCache;
+	/// Replaced, not modified, when pages are read: pages being converted keep their snapshot.
+	std::shared_ptr<const LightTable> _lights;
 	
 	glm::vec3 _clearColor;
 	
 	size_t _maxLayer = 0;
 	
 	plFogEnvironment * _fogEnv;
+	
+	// Background loading state.
+	std::thread _loader;
+	unsigned int _threadCount = 1;
+	bool _background = false;
+	/// First page of the batch being loaded.
+	size_t _firstPage = 0;
+	std::atomic<bool> _cancel;
+	std::atomic<bool> _converted;
+	std::atomic<size_t> _pagesRead;
+	std::atomic<size_t> _pagesConverted;
+	size_t _pagesUploaded = 0;
+	size_t _pagesCached = 0;
+	/// Object bytes deserialized and skipped over all the pages read.
+	size_t _objectBytes = 0;
+	size_t _skippedBytes = 0;
+	IndexUtilities::CacheStats _cacheBefore;
+	IndexUtilities::CacheStats _cacheAfter;
+	/// Pages reloaded but not uploaded yet.
+	size_t _reloadingPages = 0;
+	std::chrono::steady_clock::time_point _reloadTime;
+	bool _loaded;
+	/// Indices of converted pages waiting for their upload.
+	std::deque<size_t> _readyPages;
+	std::mutex _readyMutex;
+	std::chrono::steady_clock::time_point _startTime;
+	std::chrono::steady_clock::time_point _convertedTime;
+	
+	// Streaming state.
+	float _streamRadius = 0.0f;
+	size_t _streamBudget = 0;
+	glm::vec3 _streamPosition = glm::vec3(0.0f);
+	size_t _residentSize = 0;
+	/// Estimated size of the pages being converted again.
+	size_t _requestedSize = 0;
+	std::thread _streamer;
+	std::deque<size_t> _streamRequests;
+	std::mutex _streamMutex;
+	std::condition_variable _streamCondition;
 };
 
 #endif
@@ -11,6 +11,7 @@
 #include "helpers/Logger.hpp"
 #include <string>
 #include <sstream>
+#include <algorithm>
 
 Config::Config(int argc, char** argv){
 	
@@ -54,7 +55,34 @@ void Config::processArguments(){
 			internalVerticalResolution = std::stof(value);
 		} else if(key == "log-path"){
 			logPath = value;
-		}else if(key == "wxh"){
+		} else if(key == "load-threads"){
+			loadThreads = (unsigned int)(std::max)(0, std::stoi(value));
+		} else if(key == "sync-load"){
+			backgroundLoad = false;
+		} else if(key == "cache-dir"){
+			cachePath = value;
+		} else if(key == "no-cache"){
+			cachePath = "";
+		} else if(key == "stream-radius"){
+			streamRadius = (std::max)(0.0f, std::stof(value));
+		} else if(key == "stream-budget"){
+			streamBudget = (unsigned int)(std::max)(0, std::stoi(value));
+		} else if(key == "age-budget"){
+			ageBudget = (unsigned int)(std::max)(0, std::stoi(value));
+		} else if(key == "trace"){
+			tracePath = value;
+		} else if(key == "pages"){
+			// Comma separated list of page names.
+			pages.clear();
+			std::istringstream names(value);
+			std::string name;
+			while(std::getline(names, name, ',')){
+				name = Resources::trim(name, " ");
+				if(!name.empty()){
+					pages.push_back(name);
+				}
+			}
+		} else if(key == "wxh"){
 			const std::string::size_type split = value.find_first_of("x");
 			if(split != std::string::npos){
 				unsigned int w = std::stoi(value.substr(0,split));
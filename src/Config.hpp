@@ -12,6 +12,7 @@
 #include <stdio.h>
 #include <map>
 #include <string>
+#include <vector>
 
 class Config {
 public:
@@ -35,6 +36,31 @@ public:
 	
 	float internalVerticalResolution = 720.0f;
 	
+	/// Threads used to decode age pages, 0 for one per hardware thread.
+	unsigned int loadThreads = 0;
+	
+	/// Load ages in the background, displaying pages as they become available.
+	bool backgroundLoad = true;
+	
+	/// Directory where converted page geometry is cached, empty to disable the cache.
+	std::string cachePath = "cache";
+	
+	/// Only keep pages closer to the camera than this distance resident, 0 to keep all pages.
+	float streamRadius = 0.0f;
+	
+	/// GPU memory budget for resident pages when streaming, in megabytes.
+	unsigned int streamBudget = 1024;
+	
+	/// GPU memory budget for the ages kept resident after switching to another one, in megabytes.
+	/// The least recently displayed ages are released first, the current one is always kept.
+	unsigned int ageBudget = 2048;
+	
+	/// Record profiling zones from startup and save them as a Chrome trace at this path on exit, empty to disable.
+	std::string tracePath = "";
+	
+	/// Names of the pages to load when opening an age, all pages if empty.
+	std::vector<std::string> pages;
+	
 	/// Computed properties.
 	glm::vec2 screenResolution = glm::vec2(1200,900);
 	
@@ -0,0 +1,64 @@
+#include "Material.hpp"
+#include <PRP/Surface/hsGMaterial.h>
+#include <PRP/Surface/plLayerInterface.h>
+#include <glm/gtc/type_ptr.hpp>
+
+bool MaterialLayer::isBump() const {
+	return (miscFlags & (hsGMatState::kMiscBumpDu | hsGMatState::kMiscBumpDv | hsGMatState::kMiscBumpDw | hsGMatState::kMiscBumpLayer | hsGMatState::kMiscBumpChans)) != 0;
+}
+
+bool MaterialLayer::isNull() const {
+	return !hasTexture() && miscFlags == 0 && blendFlags == 0 && zFlags == 0 && shadeFlags == 0;
+}
+
+static glm::vec4 copyColor(const hsColorRGBA & color){
+	return glm::vec4(color.r, color.g, color.b, color.a);
+}
+
+void Material::copyLayer(plLayerInterface * lay, MaterialLayer & layer){
+	layer.name = lay->getKey()->getName().to_std_string();
+	if(lay->getTexture().Exists()){
+		layer.texture = lay->getTexture()->getName().to_std_string();
+	}
+	const hsGMatState & state = lay->getState();
+	layer.blendFlags = state.fBlendFlags;
+	layer.clampFlags = state.fClampFlags;
+	layer.shadeFlags = state.fShadeFlags;
+	layer.zFlags = state.fZFlags;
+	layer.miscFlags = state.fMiscFlags;
+	layer.preshade = copyColor(lay->getPreshade());
+	layer.runtime = copyColor(lay->getRuntime());
+	layer.ambient = copyColor(lay->getAmbient());
+	layer.specular = copyColor(lay->getSpecular());
+	layer.opacity = lay->getOpacity();
+	layer.transform = glm::make_mat4(lay->getTransform().glMatrix());
+	layer.uvwSrc = lay->getUVWSrc();
+	layer.lodBias = lay->getLODBias();
+	
+	if(lay->getUnderLay().Exists()){
+		// The underlay can live in another page, not loaded in the same manager.
+		plLayerInterface * underlay = plLayerInterface::Convert(lay->getUnderLay()->getObj(), false);
+		if(underlay){
+			layer.underlay = std::make_shared<MaterialLayer>();
+			copyLayer(underlay, *layer.underlay);
+		}
+	}
+}
+
+std::shared_ptr<Material> Material::fromPlasma(hsGMaterial * material){
+	if(!material){
+		return nullptr;
+	}
+	auto result = std::make_shared<Material>();
+	result->name = material->getKey()->getName().to_std_string();
+	result->compFlags = material->getCompFlags();
+	for(const auto & layKey : material->getLayers()){
+		plLayerInterface * lay = plLayerInterface::Convert(layKey->getObj(), false);
+		if(!lay){
+			continue;
+		}
+		result->layers.emplace_back();
+		copyLayer(lay, result->layers.back());
+	}
+	return result;
+}
@@ -0,0 +1,64 @@
+#ifndef Material_h
+#define Material_h
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+#include <memory>
+
+class hsGMaterial;
+class plLayerInterface;
+
+/// Render state of a Plasma layer, copied at load time so that the decoded page can be released.
+struct MaterialLayer {
+	std::string name;
+	/// Name of the texture, empty if the layer has none.
+	std::string texture;
+	
+	// hsGMatState flags.
+	unsigned int blendFlags = 0;
+	unsigned int clampFlags = 0;
+	unsigned int shadeFlags = 0;
+	unsigned int zFlags = 0;
+	unsigned int miscFlags = 0;
+	
+	glm::vec4 preshade = glm::vec4(0.0f);
+	glm::vec4 runtime = glm::vec4(0.0f);
+	glm::vec4 ambient = glm::vec4(0.0f);
+	glm::vec4 specular = glm::vec4(0.0f);
+	float opacity = 1.0f;
+	
+	/// UV transformation, in OpenGL layout.
+	glm::mat4 transform = glm::mat4(1.0f);
+	unsigned int uvwSrc = 0;
+	float lodBias = 0.0f;
+	
+	/// Layer below this one, if any.
+	std::shared_ptr<MaterialLayer> underlay;
+	
+	bool hasTexture() const {
+		return !texture.empty();
+	}
+	
+	/// Is the layer used for bump mapping (unsupported for now).
+	bool isBump() const;
+	
+	/// Does the layer have no texture nor any state set.
+	bool isNull() const;
+};
+
+/// Viewer-owned copy of a Plasma material.
+struct Material {
+	std::string name;
+	unsigned int compFlags = 0;
+	std::vector<MaterialLayer> layers;
+	
+	/// Copy the state of a material and all its layers and underlays.
+	static std::shared_ptr<Material> fromPlasma(hsGMaterial * material);
+	
+private:
+	
+	static void copyLayer(plLayerInterface * lay, MaterialLayer & layer);
+};
+
+#endif
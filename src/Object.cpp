@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <vector>
 #include <glm/gtc/matrix_transform.hpp>
+#include <limits>
 #include <PRP/Surface/hsGMaterial.h>
 #include <PRP/Geometry/plSpan.h>
 #include <PRP/Surface/plLayer.h>
@@ -11,6 +12,8 @@ Object::Object(const Type & type, std::shared_ptr<ProgramInfos> prog, const glm:
 	_program = prog;
 	_type = type;
 	_model = glm::mat4(model);
+	_invModel = glm::inverse(_model);
+	_modelScale = std::max(std::max(glm::length(glm::vec3(_model[0])), glm::length(glm::vec3(_model[1]))), glm::length(glm::vec3(_model[2])));
 	_name = name;
 	enabled = true;
 	_transparent = false;
@@ -21,13 +24,23 @@ Object::Object(const Type & type, std::shared_ptr<ProgramInfos> prog, const glm:
 		_billboard = true;
 	}
 	
-	_probablySky = (name.find("sky") != std::string::npos || name.find("Sky") != std::string::npos);
+	_probablySky = isSkyName(name);
 }
 
 Object::~Object() {}
 
+bool Object::isSkyName(const std::string & name){
+	return name.find("sky") != std::string::npos || name.find("Sky") != std::string::npos;
+}
+
+
+// A coarser level is picked only below this fraction of the threshold, to avoid popping back and forth.
+static const float kLodHysteresis = 0.75f;
+
+// Debug colors of the levels, from the full mesh to the coarsest one.
+static const glm::vec3 kLodColors[] = {glm::vec3(0.2f, 0.9f, 0.2f), glm::vec3(0.9f, 0.9f, 0.1f), glm::vec3(1.0f, 0.5f, 0.1f), glm::vec3(0.9f, 0.1f, 0.1f)};
 
-void Object::addSubObject(const MeshInfos & infos, hsGMaterial * material, const std::vector<Light> & lights, const unsigned int shadingMode){
+void Object::addSubObject(const MeshInfos & infos, const std::shared_ptr<Material> & material, const std::vector<Light> & lights, const unsigned int shadingMode, const std::vector<SubObject::Lod> & lods, const std::vector<IndexUtilities::Meshlet> & meshlets){
 	if(_subObjects.empty()){
 		_localBounds = infos.bbox;
 	} else {
@@ -40,21 +53,33 @@ void Object::addSubObject(const MeshInfos & infos, hsGMaterial * material, const
 	
 	// Check if subobject is transparent.
 	bool isAlphaBlend = false;
-	if(!material->getLayers().empty()){
-		const auto & layKey = material->getLayers()[0];
+	if(material && !material->layers.empty()){
 		// Obtain the layer to apply.
-		plLayerInterface * lay = plLayerInterface::Convert(layKey->getObj(), false);
-		isAlphaBlend = lay->getState().fBlendFlags & hsGMatState::kBlendAlpha;
+		const MaterialLayer * lay = &material->layers[0];
+		isAlphaBlend = lay->blendFlags & hsGMatState::kBlendAlpha;
 		_transparent = _transparent || isAlphaBlend;
 		// Also check the underlay.
-		while(lay->getUnderLay().Exists()){
-			 plLayerInterface * lay1 = plLayerInterface::Convert(lay->getUnderLay()->getObj(), false);
-			const bool isAlphaBlend1 = lay1->getState().fBlendFlags & hsGMatState::kBlendAlpha;
+		while(lay->underlay){
+			const MaterialLayer * lay1 = lay->underlay.get();
+			const bool isAlphaBlend1 = lay1->blendFlags & hsGMatState::kBlendAlpha;
 			_transparent = _transparent || isAlphaBlend1;
 			lay = lay1;
 		}
 	}
 	auto newSubObject = std::make_shared<SubObject>(infos, material, lights, shadingMode, isAlphaBlend);
+	newSubObject->lods = lods;
+	newSubObject->meshlets = meshlets;
+	if(material){
+		for(const auto & layer : material->layers){
+			const MaterialLayer * lay = &layer;
+			while(lay){
+				newSubObject->twoSided = newSubObject->twoSided || (lay->miscFlags & hsGMatState::kMiscTwoSided);
+				lay = lay->underlay.get();
+			}
+		}
+	}
+	compilePasses(*newSubObject);
+	compileComposites(*newSubObject);
 	
 	_subObjects.push_back(newSubObject);
 	
@@ -72,6 +97,98 @@ void Object::addSubObject(const MeshInfos & infos, hsGMaterial * material, const
 }
 
 
+void Object::selectLods(const glm::vec3 & eye, float pixelsPerUnit, float threshold){
+	const glm::vec3 closest = glm::clamp(eye, _globalBounds.mins, _globalBounds.maxs);
+	const float distance = glm::length(closest - eye);
+	const float scale = distance > 0.0f ? _modelScale * pixelsPerUnit / distance : std::numeric_limits<float>::max();
+	for(auto & subObject : _subObjects){
+		const auto & lods = subObject->lods;
+		size_t & level = subObject->lod;
+		while(level < lods.size() && lods[level].error * scale < kLodHysteresis * threshold){
+			++level;
+		}
+		while(level > 0 && lods[level - 1].error * scale >= threshold){
+			--level;
+		}
+	}
+}
+
+void Object::cullMeshlets(const glm::vec3 & eye, const glm::mat4 & viewproj, bool enabled){
+	// World space frustum planes, from the rows of the matrix.
+	const glm::mat4 rows = glm::transpose(viewproj);
+	glm::vec4 planes[6] = {rows[3] + rows[0], rows[3] - rows[0], rows[3] + rows[1], rows[3] - rows[1], rows[3] + rows[2], rows[3] - rows[2]};
+	for(auto & plane : planes){
+		plane /= glm::length(glm::vec3(plane));
+	}
+	// The orientation test is done in model space, where the cones are.
+	const glm::vec3 localEye = glm::vec3(_invModel * glm::vec4(eye, 1.0f));
+	
+	for(auto & subObject : _subObjects){
+		subObject->useRanges = enabled && !_billboard && subObject->lod == 0 && !subObject->meshlets.empty();
+		if(!subObject->useRanges){
+			continue;
+		}
+		const MeshInfos & mesh = subObject->mesh;
+		const size_t indexSize = mesh.indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		subObject->rangeCounts.clear();
+		subObject->rangeOffsets.clear();
+		subObject->rangeBaseVertices.clear();
+		subObject->rangeIndexCount = 0;
+		size_t rangeEnd = 0;
+		for(const auto & meshlet : subObject->meshlets){
+			if(!subObject->twoSided){
+				const glm::vec3 toCenter = meshlet.center - localEye;
+				if(glm::dot(toCenter, meshlet.coneAxis) >= meshlet.coneCutoff * glm::length(toCenter) + meshlet.radius){
+					continue;
+				}
+			}
+			const glm::vec3 center = glm::vec3(_model * glm::vec4(meshlet.center, 1.0f));
+			const float radius = meshlet.radius * _modelScale;
+			bool outside = false;
+			for(const auto & plane : planes){
+				if(glm::dot(glm::vec3(plane), center) + plane.w < -radius){
+					outside = true;
+					break;
+				}
+			}
+			if(outside){
+				continue;
+			}
+			// Contiguous meshlets are drawn as one range.
+			const size_t firstIndex = mesh.firstIndex + meshlet.firstIndex;
+			if(!subObject->rangeCounts.empty() && rangeEnd == firstIndex){
+				subObject->rangeCounts.back() += GLsizei(meshlet.indexCount);
+			} else {
+				subObject->rangeCounts.push_back(GLsizei(meshlet.indexCount));
+				subObject->rangeOffsets.push_back((const void*)(indexSize * firstIndex));
+				subObject->rangeBaseVertices.push_back(mesh.baseVertex);
+			}
+			rangeEnd = firstIndex + meshlet.indexCount;
+			subObject->rangeIndexCount += meshlet.indexCount;
+		}
+	}
+}
+
+size_t Object::visibleTriangleCount() const {
+	size_t count = 0;
+	for(const auto & subObject : _subObjects){
+		if(subObject->useRanges){
+			count += subObject->rangeIndexCount / 3;
+		} else {
+			count += size_t(subObject->lod > 0 ? subObject->lods[subObject->lod - 1].count : subObject->mesh.count) / 3;
+		}
+	}
+	return count;
+}
+
+size_t Object::triangleCount() const {
+	size_t count = 0;
+	for(const auto & subObject : _subObjects){
+		count += size_t(subObject->lod > 0 ? subObject->lods[subObject->lod - 1].count : subObject->mesh.count) / 3;
+	}
+	return count;
+}
+
 const bool Object::isVisible(const glm::vec3 & point, const glm::mat4 & viewproj) const {
 	return _globalBounds.contains(point) || _globalBounds.intersectsFrustum(viewproj);
 }
@@ -116,9 +233,10 @@ void Object::drawDebug(const glm::mat4& view, const glm::mat4& projection, const
 		if(subObjId > -1 && subObjId != sid){
 			continue;
 		}
-		glBindVertexArray(subObject->mesh.vId);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, subObject->mesh.eId);
-		glDrawElements(GL_TRIANGLES, subObject->mesh.count, GL_UNSIGNED_INT, (void*)0);
+		if(subObject->useRanges && subObject->rangeCounts.empty()){
+			continue;
+		}
+		drawMesh(*subObject);
 	}
 	
 	if(_type != Billboard && _type != BillboardY){
@@ -129,18 +247,17 @@ void Object::drawDebug(const glm::mat4& view, const glm::mat4& projection, const
 		glUniformMatrix4fv(debugProgram->uniform("mvp"), 1, GL_FALSE, &iden[0][0]);
 		glUniform3f(debugProgram->uniform("color"), 1.0f,0.0f,0.0f);
 		const auto boxMesh = Resources::manager().getMesh("box");
-		glBindVertexArray(boxMesh.vId);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, boxMesh.eId);
-		glDrawElements(GL_TRIANGLES, boxMesh.count, GL_UNSIGNED_INT, (void*)0);
+		GLUtilities::bindVertexArray(boxMesh.vId);
+		glDrawElements(GL_TRIANGLES, boxMesh.count, boxMesh.indexType, (void*)0);
 		
 	}
 	glPolygonMode ( GL_FRONT_AND_BACK, GL_FILL );
-	glBindVertexArray(0);
+	GLUtilities::bindVertexArray(0);
 	glUseProgram(0);
 	glEnable(GL_CULL_FACE);
 }
 
-void Object::draw(const glm::mat4& view, const glm::mat4& projection, const int subObjId, const int layerId) const {
+void Object::draw(const glm::mat4& view, const glm::mat4& projection, const int subObjId, const int layerId, const bool composite) const {
 
 	// Compute final view and model matrices.
 	glm::mat4 MV = view * _model;
@@ -164,130 +281,73 @@ void Object::draw(const glm::mat4& view, const glm::mat4& projection, const int
 	glUniformMatrix4fv(_program->uniform("mvp"), 1, GL_FALSE, &MVP[0][0]);
 	glUniformMatrix4fv(_program->uniform("invV"), 1, GL_FALSE, &invV[0][0]);
 	glUniformMatrix3fv(_program->uniform("normalMatrix"), 1, GL_FALSE, &normalMatrix[0][0]);
+	bool setupSecondProgram = false;
+	bool setupCompositeProgram = false;
+	const bool useComposites = composite && layerId < 0;
 	
 	int sid = -1;
 	
 	for(const auto & subObject : _subObjects){
 		
-		glPolygonOffset(0.0f, 0.0f);
-		glDisable(GL_POLYGON_OFFSET_FILL);
-		
 		++sid;
 		if(subObjId > -1 && sid != subObjId){
 			continue;
 		}
-		// Render each layer, one after the other.
-		if(!subObject->material){
+		// All meshlets culled.
+		if(subObject->useRanges && subObject->rangeCounts.empty()){
 			continue;
 		}
-	
-		const auto * layObj = plLayerInterface::Convert(subObject->material->getLayers()[0]->getObj(), false);
-		const bool hasTexture = layObj->getTexture().Exists();
-		const bool hasUnderlay = layObj->getUnderLay().Exists();
-		if(subObject->material->getLayers().size() == 1 && !hasTexture && !hasUnderlay){
+		if(subObject->passes.empty()){
 			continue;
 		}
-		// The light state is shared by all layers.
-		setupLights(_program, subObject->lights, view);
-		
-		bool setupSecondProgram = false;
-		// Transparent object: layer  has non unit opacity + blend.
-		for(size_t tid = 0; tid < subObject->material->getLayers().size(); tid++){
-			
-			
-			if(layerId > -1 && tid > layerId){
-				continue;
+		// The light state is shared by all passes.
+		if(subObject->specialProgram){
+			const auto & program = subObject->specialProgram;
+			glUseProgram(program->id());
+			if(!setupSecondProgram){
+				glUniformMatrix4fv(program->uniform("mv"), 1, GL_FALSE, &MV[0][0]);
+				glUniformMatrix4fv(program->uniform("mvp"), 1, GL_FALSE, &MVP[0][0]);
+				glUniformMatrix4fv(program->uniform("invV"), 1, GL_FALSE, &invV[0][0]);
+				glUniformMatrix3fv(program->uniform("normalMatrix"), 1, GL_FALSE, &normalMatrix[0][0]);
+				setupSecondProgram = true;
 			}
-			const auto & layKey = subObject->material->getLayers()[tid];
-			// Obtain the layer to aply.
-			plLayerInterface * lay = plLayerInterface::Convert(layKey->getObj(), false);
-			
-			// If this layer is a bump layer, skip for now. TODO: add support for bump maps.
-			if((lay->getState().fMiscFlags & (hsGMatState::kMiscBumpDu | hsGMatState::kMiscBumpDv | hsGMatState::kMiscBumpDw | hsGMatState::kMiscBumpLayer | hsGMatState::kMiscBumpChans)) != 0){
-				continue;
+			setupLights(program, subObject->lights, view);
+		}
+		if(useComposites && subObject->compositeProgram){
+			const auto & program = subObject->compositeProgram;
+			glUseProgram(program->id());
+			if(!setupCompositeProgram){
+				glUniformMatrix4fv(program->uniform("mv"), 1, GL_FALSE, &MV[0][0]);
+				glUniformMatrix4fv(program->uniform("mvp"), 1, GL_FALSE, &MVP[0][0]);
+				glUniformMatrix4fv(program->uniform("invV"), 1, GL_FALSE, &invV[0][0]);
+				glUniformMatrix3fv(program->uniform("normalMatrix"), 1, GL_FALSE, &normalMatrix[0][0]);
+				setupCompositeProgram = true;
 			}
-			// Fix for non texture null state layers.
-			bool shouldStop = false;
-			while(!lay->getTexture().Exists() && lay->getState().fMiscFlags == 0 && lay->getState().fBlendFlags == 0 && lay->getState().fZFlags == 0 && lay->getState().fShadeFlags == 0 && !shouldStop){
-				
-				if(lay->getUnderLay().Exists()){
-					// So we have a texture, but no infos on how to render it, and then an underlay?
-					// Smells like the vertex color hack.
-					// Where the underlay is used as an alpha map.
-					plLayerInterface * underlay = plLayerInterface::Convert(lay->getUnderLay()->getObj(), false);
-					lay = underlay;
-					// Just to be safe, let's replicate the same check here.
-					if((lay->getState().fMiscFlags & (hsGMatState::kMiscBumpDu | hsGMatState::kMiscBumpDv | hsGMatState::kMiscBumpDw | hsGMatState::kMiscBumpLayer | hsGMatState::kMiscBumpChans)) != 0){
-						shouldStop = true;
-					}
-				} else {
-					shouldStop = true;
+			setupLights(program, subObject->lights, view);
+		}
+		setupLights(_program, subObject->lights, view);
+		
+		const glm::vec3 & lodColor = kLodColors[std::min(subObject->lod, size_t(3))];
+		if(!useComposites){
+			for(const auto & pass : subObject->passes){
+				if(layerId > -1 && pass.layer > size_t(layerId)){
+					continue;
 				}
-				
+				drawPass(*subObject, pass, lodColor);
 			}
-			if(shouldStop){
+			continue;
+		}
+		for(const auto & run : subObject->composites){
+			if(run.count == 1){
+				drawPass(*subObject, subObject->passes[run.first], lodColor);
 				continue;
 			}
-			
-			// TODO: cache this at load time?
-			if(tid < subObject->material->getLayers().size()-1){
-				
-				const bool restartBindNext = (lay->getState().fMiscFlags & hsGMatState::kMiscBindNext) && (lay->getState().fMiscFlags & hsGMatState::kMiscRestartPassHere);
-				if(restartBindNext){
-					plLayerInterface * layNext = plLayerInterface::Convert(subObject->material->getLayers()[tid+1]->getObj(), false);
-					const bool nextIsAlphaBlend = (layNext->getState().fBlendFlags & hsGMatState::kBlendAlphaMult) && (layNext->getState().fBlendFlags & hsGMatState::kBlendNoTexColor);
-					if(nextIsAlphaBlend){
-						// Render both at the same time, using our special shader.
-						// Skip next layer.
-						const auto & program = Resources::manager().getProgram("object_special");
-						glUseProgram(program->id());
-						glUniformMatrix4fv(program->uniform("mv"), 1, GL_FALSE, &MV[0][0]);
-						glUniformMatrix4fv(program->uniform("mvp"), 1, GL_FALSE, &MVP[0][0]);
-						glUniformMatrix4fv(program->uniform("invV"), 1, GL_FALSE, &invV[0][0]);
-						glUniformMatrix3fv(program->uniform("normalMatrix"), 1, GL_FALSE, &normalMatrix[0][0]);
-						
-						if(!setupSecondProgram){
-							setupLights(Resources::manager().getProgram("object_special"), subObject->lights, view);
-							setupSecondProgram = true;
-						}
-						renderLayerMult(subObject, lay, layNext, tid);
-						++tid;
-						continue;
-					} else {
-						//Log::Warning() << "Can this case arise?" << std::endl;
-					}
-				} else if(lay->getState().fMiscFlags & hsGMatState::kMiscBindNext){
-					plLayerInterface * layNext = plLayerInterface::Convert(subObject->material->getLayers()[tid+1]->getObj(), false);
-					
-					// If the next one is a kMiscNoShadowAlpha, don't use it as an alpha.
-					// Just render the current layer as usual, and skip the next one even.
-					if(layNext->getState().fMiscFlags & hsGMatState::kMiscNoShadowAlpha){
-						renderLayer(subObject, lay, tid);
-						++tid;
-						continue;
-					}
-					// If we are alpha.
-					if((lay->getState().fBlendFlags & hsGMatState::kBlendMask) == hsGMatState::kBlendAlpha){
-						
-						// If the following conditions are met, it means that layer 1 is a better choice to
-						// get the transparency from. The specific case we're looking for is vertex alpha
-						// simulated by an invisible second layer alpha LUT (known as the alpha hack).
-				
-						if(!(layNext->getState().fBlendFlags & hsGMatState::kBlendNoTexAlpha) &&
-						   layNext->getTexture().Exists() && !(layNext->getState().fMiscFlags & hsGMatState::kMiscNoShadowAlpha)){
-							
-							// TODO: make sure that we should'nt instead perform the blend in another way.
-							renderLayer(subObject, lay, tid);
-							++tid;
-							continue;
-						}
-						
-					}
-				}
-			}
-			
-			renderLayer(subObject, lay, tid);
-			
+			const auto & program = subObject->compositeProgram;
+			glUseProgram(program->id());
+			applyComposite(*subObject, run);
+			glUniform3fv(program->uniform("lodColor"), 1, &lodColor[0]);
+			drawMesh(*subObject);
+			glUseProgram(_program->id());
 		}
 	}
 	
@@ -333,139 +393,105 @@ void Object::setupLights(const std::shared_ptr<ProgramInfos> & program, const st
 	checkGLError();
 }
 
-void Object::resetState() const {
-	glDepthMask(GL_TRUE);
-	glDepthFunc(GL_LEQUAL);
-	glEnable(GL_CULL_FACE);
-	glEnable(GL_DEPTH_TEST);
-	
-	if(_type == Billboard || _type == BillboardY){
-		glDisable(GL_CULL_FACE);
-	}
-}
-
-void Object::depthState(plLayerInterface* lay, const bool forceDecal, const int tid) const {
-	const unsigned int zflag = lay->getState().fZFlags;
+/// Depth and culling state of a layer.
+static void depthPass(const MaterialLayer & lay, const bool forceDecal, const size_t tid, MaterialPass & pass){
+	const unsigned int zflag = lay.zFlags;
 	if((zflag & hsGMatState::kZNoZWrite) || forceDecal){
-		glDepthMask(GL_FALSE);
+		pass.depthWrite = false;
 	}
 	if(zflag & hsGMatState::kZNoZRead){
-		glDepthFunc(GL_ALWAYS);
+		pass.depthFunc = GL_ALWAYS;
 	}
 	if(zflag & hsGMatState::kZClearZ){
-		glDepthFunc(GL_ALWAYS);
+		pass.depthFunc = GL_ALWAYS;
 	}
 	if((zflag & hsGMatState::kZIncLayer) || forceDecal){
-		glEnable(GL_POLYGON_OFFSET_FILL);
-		glPolygonOffset(-10.0f,-(tid+1)*10.0f);
+		pass.polygonOffset = true;
+		pass.offset = glm::vec2(-10.0f, -float(tid+1)*10.0f);
 	}
-	if(lay->getState().fMiscFlags & hsGMatState::kMiscTwoSided){
-		glDisable(GL_CULL_FACE);
+	if(lay.miscFlags & hsGMatState::kMiscTwoSided){
+		pass.cullFace = false;
 	}
-	checkGLError();
 }
 
-void Object::shadeState(const std::shared_ptr<ProgramInfos> & program, plLayerInterface*lay, const unsigned int mode) const {
-	const unsigned int fshade = lay->getState().fShadeFlags;
+/// Lighting uniforms of a layer for the given span lighting mode.
+static void shadePass(const MaterialLayer & lay, const unsigned int mode, MaterialPass & pass){
+	const unsigned int fshade = lay.shadeFlags;
 	
 	switch(mode){
 		case plSpan::kLiteMaterial:
 		{
 			// Ambient.
 			if(fshade & hsGMatState::kShadeWhite){
-				glUniform4f(program->uniform("globalAmbient"), 1.0f, 1.0f, 1.0f, 1.0f);
-				glUniform4f(program->uniform("ambient"), 1.0f, 1.0f, 1.0f, 1.0f);
+				pass.globalAmbient = glm::vec4(1.0f);
+				pass.ambient = glm::vec4(1.0f);
 			} else {
-				const hsColorRGBA amb = lay->getPreshade();
-				glUniform4f(program->uniform("globalAmbient"), amb.r, amb.g, amb.b, 1.0f);
-				glUniform4f(program->uniform("ambient"), amb.r, amb.g, amb.b, 1.0f);
+				const glm::vec4 & amb = lay.preshade;
+				pass.globalAmbient = glm::vec4(amb.r, amb.g, amb.b, 1.0f);
+				pass.ambient = glm::vec4(amb.r, amb.g, amb.b, 1.0f);
 			}
-			const hsColorRGBA dif = lay->getRuntime();
-			const hsColorRGBA emi = lay->getAmbient();
-			glUniform4f(program->uniform("diffuse"), dif.r, dif.g, dif.b, lay->getOpacity());
-			glUniform4f(program->uniform("emissive"), emi.r, emi.g, emi.b, 1.0f);
+			const glm::vec4 & dif = lay.runtime;
+			const glm::vec4 & emi = lay.ambient;
+			pass.diffuse = glm::vec4(dif.r, dif.g, dif.b, lay.opacity);
+			pass.emissive = glm::vec4(emi.r, emi.g, emi.b, 1.0f);
 			
 			// Specular.
 			if (fshade & hsGMatState::kShadeSpecular) {
-				const hsColorRGBA spec = lay->getSpecular();
-				glUniform4f(program->uniform("specular"), spec.r, spec.g, spec.b, 1.0f);
-			} else {
-				glUniform4f(program->uniform("specular"), 0.0f, 0.0f, 0.0f, 0.0f);
-			}
-			
-			glUniform1f(program->uniform("diffuseSrc"), 1.0f);
-			glUniform1f(program->uniform("specularSrc"), 1.0f);
-			glUniform1f(program->uniform("emissiveSrc"), 1.0f);
-			
-			if (fshade & hsGMatState::kShadeNoShade) {
-				glUniform1f(program->uniform("ambientSrc"), 1.0f);
-			} else {
-				glUniform1f(program->uniform("ambientSrc"), 0.0f);
+				const glm::vec4 & spec = lay.specular;
+				pass.specular = glm::vec4(spec.r, spec.g, spec.b, 1.0f);
 			}
+			// Diffuse, ambient, specular and emissive sources.
+			pass.sources = glm::vec4(1.0f, (fshade & hsGMatState::kShadeNoShade) ? 1.0f : 0.0f, 1.0f, 1.0f);
+			pass.shading = true;
 			break;
 		}
 		case plSpan::kLiteVtxNonPreshaded:
 		{
-			const hsColorRGBA amb = lay->getPreshade();
-			const hsColorRGBA emi = lay->getAmbient();
-			
-			glUniform4f(program->uniform("globalAmbient"), amb.r, amb.g, amb.b, amb.a);
-			glUniform4f(program->uniform("ambient"), 0.0f, 0.0f, 0.0f, 0.0f);
-			glUniform4f(program->uniform("diffuse"), 0.0f, 0.0f, 0.0f, 0.0f);
-			glUniform4f(program->uniform("emissive"), emi.r, emi.g, emi.b, 1.0f);
+			const glm::vec4 & emi = lay.ambient;
+			pass.globalAmbient = lay.preshade;
+			pass.emissive = glm::vec4(emi.r, emi.g, emi.b, 1.0f);
 			
 			if (fshade & hsGMatState::kShadeSpecular) {
-				const hsColorRGBA spec = lay->getSpecular();
-				glUniform4f(program->uniform("specular"), spec.r, spec.g, spec.b, 1.0f);
-			} else {
-				glUniform4f(program->uniform("specular"), 0.0f, 0.0f, 0.0f, 0.0f);
+				const glm::vec4 & spec = lay.specular;
+				pass.specular = glm::vec4(spec.r, spec.g, spec.b, 1.0f);
 			}
-			
-			glUniform1f(program->uniform("diffuseSrc"), 0.0f);
-			glUniform1f(program->uniform("ambientSrc"), 0.0f);
-			glUniform1f(program->uniform("specularSrc"), 1.0f);
-			glUniform1f(program->uniform("emissiveSrc"), 1.0f);
+			pass.sources = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+			pass.shading = true;
 			break;
 		}
 		case plSpan::kLiteVtxPreshaded:
 		{
-			glUniform4f(program->uniform("globalAmbient"), 0.0f, 0.0f, 0.0f, 0.0f);
-			glUniform4f(program->uniform("ambient"), 0.0f, 0.0f, 0.0f, 0.0f);
-			glUniform4f(program->uniform("diffuse"), 0.0f, 0.0f, 0.0f, 0.0f);
-			glUniform4f(program->uniform("emissive"), 0.0f, 0.0f, 0.0f, 0.0f);
-			glUniform4f(program->uniform("specular"), 0.0f, 0.0f, 0.0f, 0.0f);
-			glUniform1f(program->uniform("diffuseSrc"), 0.0f);
-			glUniform1f(program->uniform("ambientSrc"), 1.0f);
-			glUniform1f(program->uniform("specularSrc"), 1.0f);
-			glUniform1f(program->uniform("emissiveSrc"), (fshade & hsGMatState::kShadeEmissive) ? 0.0f : 1.0f);
+			pass.sources = glm::vec4(0.0f, 1.0f, 1.0f, (fshade & hsGMatState::kShadeEmissive) ? 0.0f : 1.0f);
+			pass.shading = true;
 			break;
 		}
 		default:
 			break;
 	}
-	if((fshade & hsGMatState::kShadeReallyNoFog) || (fshade & hsGMatState::kShadeNoFog) || (fshade & hsGMatState::kShadeEmissive)){
-		glUniform1i(program->uniform("fogEnabled"),0);
-	} else {
-		glUniform1i(program->uniform("fogEnabled"),1);
-	}
-	checkGLError();
+	pass.fog = !((fshade & hsGMatState::kShadeReallyNoFog) || (fshade & hsGMatState::kShadeNoFog) || (fshade & hsGMatState::kShadeEmissive));
 }
 
-void Object::blendState(const std::shared_ptr<ProgramInfos> & program, plLayerInterface * lay) const {
-	glEnable(GL_BLEND);
-	const unsigned int bflags = lay->getState().fBlendFlags;
-	glUniform1i(program->uniform("invertVertexAlpha"), bflags & hsGMatState::kBlendInvertVtxAlpha ? 1 : 0);
-	
-	glUniform1i(program->uniform("blendInvertColor"), bflags & hsGMatState::kBlendInvertColor ? 1 : 0);
-	glUniform1i(program->uniform("blendInvertAlpha"), bflags & hsGMatState::kBlendInvertAlpha ? 1 : 0);
-	
-	glUniform1i(program->uniform("blendNoTexColor"), bflags & hsGMatState::kBlendNoTexColor ? 1 : 0);
-	glUniform1i(program->uniform("blendNoVtxAlpha"), bflags & hsGMatState::kBlendNoVtxAlpha ? 1 : 0);
-	glUniform1i(program->uniform("blendNoTexAlpha"), bflags & hsGMatState::kBlendNoTexAlpha ? 1 : 0);
+/// Blend equation and alpha test of a layer.
+static void blendPass(const MaterialLayer & lay, MaterialPass & pass){
+	const unsigned int bflags = lay.blendFlags;
+	pass.invertVertexAlpha = bflags & hsGMatState::kBlendInvertVtxAlpha;
+	pass.invertColor = bflags & hsGMatState::kBlendInvertColor;
+	pass.invertAlpha = bflags & hsGMatState::kBlendInvertAlpha;
+	pass.noTexColor = bflags & hsGMatState::kBlendNoTexColor;
+	pass.noVtxAlpha = bflags & hsGMatState::kBlendNoVtxAlpha;
+	pass.noTexAlpha = bflags & hsGMatState::kBlendNoTexAlpha;
+	
+	GLenum * func = pass.blendFunc;
+	const auto setFunc = [func](GLenum srcColor, GLenum dstColor, GLenum srcAlpha, GLenum dstAlpha){
+		func[0] = srcColor;
+		func[1] = dstColor;
+		func[2] = srcAlpha;
+		func[3] = dstAlpha;
+	};
 	
 	if (bflags & hsGMatState::kBlendNoColor) {
 		// dst = dst
-		glBlendFuncSeparate(GL_ZERO, GL_ONE, GL_ZERO, GL_ONE);
+		setFunc(GL_ZERO, GL_ONE, GL_ZERO, GL_ONE);
 	} else {
 		switch (bflags & hsGMatState::kBlendMask) {
 			case hsGMatState::kBlendDetail:
@@ -483,9 +509,9 @@ void Object::blendState(const std::shared_ptr<ProgramInfos> & program, plLayerIn
 				// dst = a * src + (1-a) * dst
 				// support a = 1 - a'
 				if (bflags & hsGMatState::kBlendInvertFinalAlpha) {
-					glBlendFuncSeparate(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA, srcAlpha, dstAlpha);
+					setFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA, srcAlpha, dstAlpha);
 				} else {
-					glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, srcAlpha, dstAlpha);
+					setFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, srcAlpha, dstAlpha);
 				}
 				break;
 			}
@@ -493,26 +519,26 @@ void Object::blendState(const std::shared_ptr<ProgramInfos> & program, plLayerIn
 				// dst = src * dst
 				// support src = 1 - src'
 				if (bflags & hsGMatState::kBlendInvertFinalColor) {
-					glBlendFuncSeparate(GL_ZERO, GL_ONE_MINUS_SRC_COLOR, GL_ZERO, GL_ONE);
+					setFunc(GL_ZERO, GL_ONE_MINUS_SRC_COLOR, GL_ZERO, GL_ONE);
 				} else {
-					glBlendFuncSeparate(GL_ZERO, GL_SRC_COLOR, GL_ZERO, GL_ONE);
+					setFunc(GL_ZERO, GL_SRC_COLOR, GL_ZERO, GL_ONE);
 				}
 				break;
 				
 			case hsGMatState::kBlendAdd:
 				// dst = dst + src
-				glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE);
+				setFunc(GL_ONE, GL_ONE, GL_ZERO, GL_ONE);
 				break;
 			case hsGMatState::kBlendMADD:
 				// dst = src * dest + dest
-				glBlendFuncSeparate(GL_DST_COLOR, GL_ONE, GL_ZERO, GL_ONE);
+				setFunc(GL_DST_COLOR, GL_ONE, GL_ZERO, GL_ONE);
 				break;
 			case hsGMatState::kBlendAddColorTimesAlpha:
 				// dst = src * a + dst
 				if (bflags & hsGMatState::kBlendInvertFinalAlpha) {
-					glBlendFuncSeparate(GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ZERO, GL_ONE);
+					setFunc(GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ZERO, GL_ONE);
 				} else {
-					glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE, GL_ZERO, GL_ONE);
+					setFunc(GL_SRC_ALPHA, GL_ONE, GL_ZERO, GL_ONE);
 				}
 				break;
 				
@@ -530,7 +556,7 @@ void Object::blendState(const std::shared_ptr<ProgramInfos> & program, plLayerIn
 				break;
 			case 0:
 				// dst = src
-				glBlendFuncSeparate(GL_ONE, GL_ZERO, GL_ZERO, GL_ONE);
+				setFunc(GL_ONE, GL_ZERO, GL_ZERO, GL_ONE);
 				break;
 				
 			default:
@@ -542,144 +568,450 @@ void Object::blendState(const std::shared_ptr<ProgramInfos> & program, plLayerIn
 	// Alpha threshold state (DONE).
 	if (bflags & (hsGMatState::kBlendTest | hsGMatState::kBlendAlpha | hsGMatState::kBlendAddColorTimesAlpha)
 		&& !(bflags & hsGMatState::kBlendAlphaAlways)) {
-		if (bflags & hsGMatState::kBlendAlphaTestHigh) {
-			glUniform1f(program->uniform("alphaThreshold"), 40.0f/255.0f);
-		} else {
-			glUniform1f(program->uniform("alphaThreshold"), 2.0f/255.0f);
-		}
+		pass.alphaThreshold = (bflags & hsGMatState::kBlendAlphaTestHigh) ? 40.0f/255.0f : 2.0f/255.0f;
 	} else {
-		glUniform1f(program->uniform("alphaThreshold"), 0.f);
+		pass.alphaThreshold = 0.0f;
 	}
-	checkGLError();
 }
 
-void Object::textureState(const std::shared_ptr<ProgramInfos> & program, plLayerInterface* lay) const {
-	TextureInfos infos;
-	if(lay->getTexture().Exists()){
-		infos = Resources::manager().getTexture(lay->getTexture()->getName().to_std_string());
-		glUniformMatrix4fv(program->uniform("uvMatrix"), 1, GL_FALSE, lay->getTransform().glMatrix());
-		if(infos.cubemap){
-			glActiveTexture(GL_TEXTURE0+1);
-			glBindTexture(GL_TEXTURE_CUBE_MAP, infos.id);
-			glUniform1i(program->uniform("useTexture"), 2);
-		} else {
-			glActiveTexture(GL_TEXTURE0+0);
-			glBindTexture(GL_TEXTURE_2D, infos.id);
-			glUniform1i(program->uniform("useTexture"), 1);
-		}
-		if(lay->getUVWSrc() == plLayer::kUVWNormal){
-			glUniform1i(program->uniform("uvSource"), -1);
-		} else if(lay->getUVWSrc() == plLayer::kUVWPosition){
-			glUniform1i(program->uniform("uvSource"),-2);
-		} else if(lay->getUVWSrc() == plLayer::kUVWReflect){
-			glUniform1i(program->uniform("uvSource"), -3);
-		} else {
-			glUniform1i(program->uniform("uvSource"), lay->getUVWSrc() & plLayer::kUVWIdxMask);
+/// Texture and UV source of a layer.
+static void texturePass(const MaterialLayer & lay, MaterialPass::Texture & texture){
+	texture.name = lay.texture;
+	texture.transform = lay.transform;
+	if(lay.uvwSrc == plLayer::kUVWNormal){
+		texture.uvSource = -1;
+	} else if(lay.uvwSrc == plLayer::kUVWPosition){
+		texture.uvSource = -2;
+	} else if(lay.uvwSrc == plLayer::kUVWReflect){
+		texture.uvSource = -3;
+	} else {
+		texture.uvSource = int(lay.uvwSrc & plLayer::kUVWIdxMask);
+	}
+	texture.lodBias = (lay.zFlags & hsGMatState::kZLODBias) ? lay.lodBias : 0.0f;
+	texture.clamped = glm::ivec2(lay.clampFlags & hsGMatState::kClampTextureU ? 1 : 0, lay.clampFlags & hsGMatState::kClampTextureV ? 1 : 0);
+	texture.reflection = lay.miscFlags & hsGMatState::kMiscUseReflectionXform;
+	texture.refraction = lay.miscFlags & hsGMatState::kMiscUseRefractionXform;
+}
+
+void Object::compilePasses(SubObject & subObject) const {
+	subObject.passes.clear();
+	subObject.specialProgram = nullptr;
+	if(!subObject.material || subObject.material->layers.empty()){
+		return;
+	}
+	const auto & layers = subObject.material->layers;
+	const bool hasTexture = layers[0].hasTexture();
+	const bool hasUnderlay = layers[0].underlay != nullptr;
+	if(layers.size() == 1 && !hasTexture && !hasUnderlay){
+		return;
+	}
+	const bool forceDecal = subObject.material->compFlags & hsGMaterial::kCompDecal;
+	const auto & specialProgram = Resources::manager().getProgram("object_special");
+	// Once enabled by a layer, the polygon offset applies to the following ones.
+	bool offset = false;
+	glm::vec2 offsetValues(0.0f);
+	
+	// Transparent object: layer  has non unit opacity + blend.
+	for(size_t tid = 0; tid < layers.size(); tid++){
+		// Obtain the layer to apply.
+		const MaterialLayer * lay = &layers[tid];
+		
+		// If this layer is a bump layer, skip for now. TODO: add support for bump maps.
+		if(lay->isBump()){
+			continue;
+		}
+		// Fix for non texture null state layers.
+		bool shouldStop = false;
+		while(lay->isNull() && !shouldStop){
+			
+			if(lay->underlay){
+				// So we have a texture, but no infos on how to render it, and then an underlay?
+				// Smells like the vertex color hack.
+				// Where the underlay is used as an alpha map.
+				lay = lay->underlay.get();
+				// Just to be safe, let's replicate the same check here.
+				if(lay->isBump()){
+					shouldStop = true;
+				}
+			} else {
+				shouldStop = true;
+			}
+			
+		}
+		if(shouldStop){
+			continue;
 		}
 		
-		if(lay->getState().fZFlags & hsGMatState::kZLODBias){
-			glTexParameterf(infos.cubemap ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D, GL_TEXTURE_LOD_BIAS, lay->getLODBias());
-		} else {
-			glTexParameterf(infos.cubemap ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D, GL_TEXTURE_LOD_BIAS, 0.0f);
+		// Layer sampled for its alpha along with lay, if any.
+		const MaterialLayer * layAlpha = nullptr;
+		// Is the next layer consumed by this pass.
+		bool skipNext = false;
+		
+		if(tid < layers.size()-1){
+			
+			const MaterialLayer & layNext = layers[tid+1];
+			const bool restartBindNext = (lay->miscFlags & hsGMatState::kMiscBindNext) && (lay->miscFlags & hsGMatState::kMiscRestartPassHere);
+			if(restartBindNext){
+				const bool nextIsAlphaBlend = (layNext.blendFlags & hsGMatState::kBlendAlphaMult) && (layNext.blendFlags & hsGMatState::kBlendNoTexColor);
+				if(nextIsAlphaBlend){
+					// Render both at the same time, using our special shader.
+					layAlpha = &layNext;
+					skipNext = true;
+				}
+			} else if(lay->miscFlags & hsGMatState::kMiscBindNext){
+				// If the next one is a kMiscNoShadowAlpha, don't use it as an alpha.
+				// Just render the current layer as usual, and skip the next one even.
+				if(layNext.miscFlags & hsGMatState::kMiscNoShadowAlpha){
+					skipNext = true;
+				} else if((lay->blendFlags & hsGMatState::kBlendMask) == hsGMatState::kBlendAlpha){
+					// If we are alpha and the following conditions are met, it means that layer 1 is a better choice to
+					// get the transparency from. The specific case we're looking for is vertex alpha
+					// simulated by an invisible second layer alpha LUT (known as the alpha hack).
+					// TODO: make sure that we should'nt instead perform the blend in another way.
+					skipNext = !(layNext.blendFlags & hsGMatState::kBlendNoTexAlpha) &&
+						layNext.hasTexture() && !(layNext.miscFlags & hsGMatState::kMiscNoShadowAlpha);
+				}
+			}
 		}
 		
-	} else {
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, 0);
-		glUniform1i(program->uniform("useTexture"), 0);
+		MaterialPass pass;
+		pass.layer = tid;
+		pass.program = layAlpha ? specialProgram : _program;
+		pass.cullFace = _type != Billboard && _type != BillboardY;
+		depthPass(*lay, forceDecal, tid, pass);
+		if(pass.polygonOffset){
+			offset = true;
+			offsetValues = pass.offset;
+		} else if(offset){
+			pass.polygonOffset = true;
+			pass.offset = offsetValues;
+		}
+		shadePass(*lay, subObject.mode, pass);
+		blendPass(*lay, pass);
+		texturePass(*lay, pass.texture);
+		if(layAlpha){
+			pass.special = true;
+			pass.invertVertexAlpha1 = layAlpha->blendFlags & hsGMatState::kBlendInvertVtxAlpha;
+			texturePass(*layAlpha, pass.texture1);
+			subObject.specialProgram = specialProgram;
+		}
+		subObject.passes.push_back(pass);
+		
+		if(skipNext){
+			++tid;
+		}
 	}
-	
-	
-	glUniform2i(program->uniform("clampedTexture"), lay->getState().fClampFlags & hsGMatState::kClampTextureU ? 1 : 0, lay->getState().fClampFlags & hsGMatState::kClampTextureV ? 1 : 0);
-	glUniform1i(program->uniform("useReflectionXform"), lay->getState().fMiscFlags &  hsGMatState::kMiscUseReflectionXform ? 1 : 0);
-	glUniform1i(program->uniform("useRefractionXform"), lay->getState().fMiscFlags &  hsGMatState::kMiscUseRefractionXform ? 1 : 0);
-	checkGLError();
 }
 
-void Object::textureStateCustom(const std::shared_ptr<ProgramInfos> & program, plLayerInterface* lay) const {
-	TextureInfos infos;
-	if(lay->getTexture().Exists()){
-		infos = Resources::manager().getTexture(lay->getTexture()->getName().to_std_string());
-		glUniformMatrix4fv(program->uniform("uvMatrix1"), 1, GL_FALSE, lay->getTransform().glMatrix());
-		if(infos.cubemap){
-			Log::Error() << "Cubemap Alpha pseudo vertex not supported." << std::endl;
-		} else {
-			glActiveTexture(GL_TEXTURE0+2);
-			glBindTexture(GL_TEXTURE_2D, infos.id);
-			glUniform1i(program->uniform("useTexture1"), 1);
-		}
-		if(lay->getUVWSrc() == plLayer::kUVWNormal){
-			glUniform1i(program->uniform("uvSource1"), -1);
-		} else if(lay->getUVWSrc() == plLayer::kUVWPosition){
-			glUniform1i(program->uniform("uvSource1"),-2);
-		} else if(lay->getUVWSrc() == plLayer::kUVWReflect){
-			glUniform1i(program->uniform("uvSource1"), -3);
-		} else {
-			glUniform1i(program->uniform("uvSource1"), lay->getUVWSrc() & plLayer::kUVWIdxMask);
+/// Code of a blend factor in the compositor program, -1 if it can't be evaluated there.
+static int compositeFactor(const GLenum factor){
+	switch(factor){
+		case GL_ZERO:
+			return 0;
+		case GL_ONE:
+			return 1;
+		case GL_SRC_ALPHA:
+			return 2;
+		case GL_ONE_MINUS_SRC_ALPHA:
+			return 3;
+		case GL_SRC_COLOR:
+			return 4;
+		case GL_ONE_MINUS_SRC_COLOR:
+			return 5;
+		default:
+			return -1;
+	}
+}
+
+/// Can pass be evaluated in the same fragment as the first pass of its run, base.
+static bool canComposite(const MaterialPass & base, const MaterialPass & pass){
+	// The framebuffer alpha has to be left untouched, the second output is only used for the color.
+	if(pass.special || !pass.shading || pass.blendFunc[2] != GL_ZERO || pass.blendFunc[3] != GL_ONE){
+		return false;
+	}
+	if(compositeFactor(pass.blendFunc[0]) < 0 || compositeFactor(pass.blendFunc[1]) < 0){
+		return false;
+	}
+	// Each layer has to cover exactly the same fragments, and leave the same depth behind.
+	return pass.depthWrite == base.depthWrite && pass.depthFunc == base.depthFunc && pass.cullFace == base.cullFace
+		&& pass.polygonOffset == base.polygonOffset && pass.offset == base.offset;
+}
+
+/// Does blending pass always give a color in [0,1], for source and destination colors in [0,1].
+static bool isBoundedBlend(const MaterialPass & pass){
+	const GLenum src = pass.blendFunc[0];
+	const GLenum dst = pass.blendFunc[1];
+	if(src == GL_ZERO || dst == GL_ZERO){
+		return true;
+	}
+	// Complementary factors give a weighted average, other combinations are assumed to overflow.
+	return (src == GL_SRC_ALPHA && dst == GL_ONE_MINUS_SRC_ALPHA) || (src == GL_ONE_MINUS_SRC_ALPHA && dst == GL_SRC_ALPHA)
+		|| (src == GL_SRC_COLOR && dst == GL_ONE_MINUS_SRC_COLOR) || (src == GL_ONE_MINUS_SRC_COLOR && dst == GL_SRC_COLOR);
+}
+
+void Object::compileComposites(SubObject & subObject) const {
+	subObject.composites.clear();
+	subObject.compositeProgram = nullptr;
+	const auto & passes = subObject.passes;
+	size_t first = 0;
+	while(first < passes.size()){
+		CompositePass run = {first, 1};
+		const MaterialPass & base = passes[first];
+		// Passes blend with the framebuffer per fragment, the compositor per triangle: they only agree when
+		// each pixel keeps a single triangle, ie the first pass replaces the color and writes the depth.
+		// Self-overlapping transparent geometry is left to the multipass path.
+		const bool opaqueBase = base.depthWrite && base.blendFunc[1] == GL_ZERO;
+		if(opaqueBase && canComposite(base, base)){
+			// The framebuffer clamps the result of each pass to [0,1], the compositor only clamps the final one.
+			// Once a result can exceed 1, only passes adding to it give the same color: both saturate.
+			bool overflow = !isBoundedBlend(base);
+			while(run.count < kCompositeLayers && first + run.count < passes.size()){
+				const MaterialPass & pass = passes[first + run.count];
+				if(!canComposite(base, pass) || (overflow && pass.blendFunc[1] != GL_ONE)){
+					break;
+				}
+				overflow = overflow || !isBoundedBlend(pass);
+				++run.count;
+			}
 		}
-		if(lay->getState().fZFlags & hsGMatState::kZLODBias){
-			glTexParameterf(infos.cubemap ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D, GL_TEXTURE_LOD_BIAS, lay->getLODBias());
-		} else {
-			glTexParameterf(infos.cubemap ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D, GL_TEXTURE_LOD_BIAS, 0.0f);
+		if(run.count > 1){
+			subObject.compositeProgram = Resources::manager().getProgram("object_layers");
 		}
-	} else {
-		//infos = Resources::manager().getTexture("");
+		subObject.composites.push_back(run);
+		first += run.count;
+	}
+}
+
+size_t Object::passCount(bool composite) const {
+	size_t count = 0;
+	for(const auto & subObject : _subObjects){
+		count += composite ? subObject->composites.size() : subObject->passes.size();
+	}
+	return count;
+}
+
+/// Bind the texture of a pass, to units 0 (2D) or 1 (cube), or to unit 2 for the alpha texture of the special program.
+static void applyTexture(const std::shared_ptr<ProgramInfos> & program, const MaterialPass::Texture & texture, const bool second){
+	if(texture.name.empty()){
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, 0);
-		glUniform1i(program->uniform("useTexture1"), 0);
+		glUniform1i(program->uniform(second ? "useTexture1" : "useTexture"), 0);
+	} else {
+		// Resolved on each draw, textures are uploaded on first use and can be released with their age.
+		const TextureInfos infos = Resources::manager().getTexture(texture.name);
+		glUniformMatrix4fv(program->uniform(second ? "uvMatrix1" : "uvMatrix"), 1, GL_FALSE, &texture.transform[0][0]);
+		const GLenum target = infos.cubemap ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+		if(second){
+			// Cube maps can't be used as the alpha pseudo vertex.
+			glActiveTexture(GL_TEXTURE0+2);
+			glBindTexture(GL_TEXTURE_2D, infos.cubemap ? 0 : infos.id);
+			glUniform1i(program->uniform("useTexture1"), infos.cubemap ? 0 : 1);
+		} else {
+			glActiveTexture(GL_TEXTURE0 + (infos.cubemap ? 1 : 0));
+			glBindTexture(target, infos.id);
+			glUniform1i(program->uniform("useTexture"), infos.cubemap ? 2 : 1);
+		}
+		glUniform1i(program->uniform(second ? "uvSource1" : "uvSource"), texture.uvSource);
+		glTexParameterf(target, GL_TEXTURE_LOD_BIAS, texture.lodBias);
 	}
-	glUniform2i(program->uniform("clampedTexture1"), lay->getState().fClampFlags & hsGMatState::kClampTextureU ? 1 : 0, lay->getState().fClampFlags & hsGMatState::kClampTextureV ? 1 : 0);
-	glUniform1i(program->uniform("useReflectionXform1"), lay->getState().fMiscFlags &  hsGMatState::kMiscUseReflectionXform ? 1 : 0);
-	glUniform1i(program->uniform("useRefractionXform1"), lay->getState().fMiscFlags &  hsGMatState::kMiscUseRefractionXform ? 1 : 0);
-	checkGLError();
+	glUniform2i(program->uniform(second ? "clampedTexture1" : "clampedTexture"), texture.clamped[0], texture.clamped[1]);
+	glUniform1i(program->uniform(second ? "useReflectionXform1" : "useReflectionXform"), texture.reflection ? 1 : 0);
+	glUniform1i(program->uniform(second ? "useRefractionXform1" : "useRefractionXform"), texture.refraction ? 1 : 0);
 }
 
-void Object::renderLayer(const std::shared_ptr<SubObject> & subObject, plLayerInterface * lay, const int tid) const {
+void Object::applyPass(const MaterialPass & pass) const {
+	const auto & program = pass.program;
 	
-	const bool forceDecal = subObject->material->getCompFlags() & hsGMaterial::kCompDecal;
-	
-	resetState();
-	depthState(lay, forceDecal, tid);
-	shadeState(_program, lay, subObject->mode);
-	blendState(_program, lay);
-	textureState(_program, lay);
+	// Depth and culling.
+	glDepthMask(pass.depthWrite ? GL_TRUE : GL_FALSE);
+	glDepthFunc(pass.depthFunc);
+	glEnable(GL_DEPTH_TEST);
+	if(pass.cullFace){
+		glEnable(GL_CULL_FACE);
+	} else {
+		glDisable(GL_CULL_FACE);
+	}
+	if(pass.polygonOffset){
+		glEnable(GL_POLYGON_OFFSET_FILL);
+		glPolygonOffset(pass.offset[0], pass.offset[1]);
+	} else {
+		glPolygonOffset(0.0f, 0.0f);
+		glDisable(GL_POLYGON_OFFSET_FILL);
+	}
 	
-	// Render.
-	glBindVertexArray(subObject->mesh.vId);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, subObject->mesh.eId);
-	glDrawElements(GL_TRIANGLES, subObject->mesh.count, GL_UNSIGNED_INT, (void*)0);
+	// Lighting.
+	if(pass.shading){
+		glUniform4fv(program->uniform("globalAmbient"), 1, &pass.globalAmbient[0]);
+		glUniform4fv(program->uniform("ambient"), 1, &pass.ambient[0]);
+		glUniform4fv(program->uniform("diffuse"), 1, &pass.diffuse[0]);
+		glUniform4fv(program->uniform("emissive"), 1, &pass.emissive[0]);
+		glUniform4fv(program->uniform("specular"), 1, &pass.specular[0]);
+		glUniform1f(program->uniform("diffuseSrc"), pass.sources[0]);
+		glUniform1f(program->uniform("ambientSrc"), pass.sources[1]);
+		glUniform1f(program->uniform("specularSrc"), pass.sources[2]);
+		glUniform1f(program->uniform("emissiveSrc"), pass.sources[3]);
+	}
+	glUniform1i(program->uniform("fogEnabled"), pass.fog ? 1 : 0);
 	
-	// Reset states.
-	glBindVertexArray(0);
-	glDisable(GL_BLEND);
+	// Blending.
+	glEnable(GL_BLEND);
+	glBlendFuncSeparate(pass.blendFunc[0], pass.blendFunc[1], pass.blendFunc[2], pass.blendFunc[3]);
+	glUniform1i(program->uniform("invertVertexAlpha"), pass.invertVertexAlpha ? 1 : 0);
+	glUniform1i(program->uniform("blendInvertColor"), pass.invertColor ? 1 : 0);
+	glUniform1i(program->uniform("blendInvertAlpha"), pass.invertAlpha ? 1 : 0);
+	glUniform1i(program->uniform("blendNoTexColor"), pass.noTexColor ? 1 : 0);
+	glUniform1i(program->uniform("blendNoVtxAlpha"), pass.noVtxAlpha ? 1 : 0);
+	glUniform1i(program->uniform("blendNoTexAlpha"), pass.noTexAlpha ? 1 : 0);
+	glUniform1f(program->uniform("alphaThreshold"), pass.alphaThreshold);
+	
+	// Textures.
+	applyTexture(program, pass.texture, false);
+	if(pass.special){
+		glUniform1i(program->uniform("invertVertexAlpha1"), pass.invertVertexAlpha1 ? 1 : 0);
+		applyTexture(program, pass.texture1, true);
+	}
 	checkGLError();
 }
 
-void Object::renderLayerMult(const std::shared_ptr<SubObject> & subObject, plLayerInterface * lay0, plLayerInterface * lay1, const int tid) const {
-	
-	const bool forceDecal = subObject->material->getCompFlags() & hsGMaterial::kCompDecal;
-	// Set everything as usual first.
-	const auto & program = Resources::manager().getProgram("object_special");
-	resetState();
-	depthState(lay0, forceDecal, tid);
-	shadeState(program,lay0, subObject->mode);
-	blendState(program,lay0);
-	glUniform1i(program->uniform("invertVertexAlpha1"), lay1->getState().fBlendFlags & hsGMatState::kBlendInvertVtxAlpha ? 1 : 0);
-	textureState(program,lay0);
-	textureStateCustom(program, lay1);
-	
-	// Render.
-	glBindVertexArray(subObject->mesh.vId);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, subObject->mesh.eId);
-	glDrawElements(GL_TRIANGLES, subObject->mesh.count, GL_UNSIGNED_INT, (void*)0);
-	
-	// Reset states.
-	glBindVertexArray(0);
-	glDisable(GL_BLEND);
-	glUseProgram(_program->id());
+void Object::applyComposite(const SubObject & subObject, const CompositePass & run) const {
+	const auto & program = subObject.compositeProgram;
+	const MaterialPass & base = subObject.passes[run.first];
+	
+	// Depth and culling, shared by the passes.
+	glDepthMask(base.depthWrite ? GL_TRUE : GL_FALSE);
+	glDepthFunc(base.depthFunc);
+	glEnable(GL_DEPTH_TEST);
+	if(base.cullFace){
+		glEnable(GL_CULL_FACE);
+	} else {
+		glDisable(GL_CULL_FACE);
+	}
+	if(base.polygonOffset){
+		glEnable(GL_POLYGON_OFFSET_FILL);
+		glPolygonOffset(base.offset[0], base.offset[1]);
+	} else {
+		glPolygonOffset(0.0f, 0.0f);
+		glDisable(GL_POLYGON_OFFSET_FILL);
+	}
+	// The program outputs the composited color and the factor to apply to the framebuffer.
+	glEnable(GL_BLEND);
+	glBlendFuncSeparate(GL_ONE, GL_SRC1_COLOR, GL_ZERO, GL_ONE);
+	
+	glm::vec4 globalAmbients[kCompositeLayers];
+	glm::vec4 ambients[kCompositeLayers];
+	glm::vec4 diffuses[kCompositeLayers];
+	glm::vec4 emissives[kCompositeLayers];
+	glm::vec4 sources[kCompositeLayers];
+	glm::mat4 uvMatrices[kCompositeLayers];
+	glm::ivec2 clampedTextures[kCompositeLayers];
+	glm::ivec2 blendFactors[kCompositeLayers];
+	GLint invertVertexAlphas[kCompositeLayers];
+	GLint reflections[kCompositeLayers];
+	GLint refractions[kCompositeLayers];
+	GLint uvSources[kCompositeLayers];
+	GLint useTextures[kCompositeLayers];
+	GLint invertColors[kCompositeLayers];
+	GLint invertAlphas[kCompositeLayers];
+	GLint noTexColors[kCompositeLayers];
+	GLint noVtxAlphas[kCompositeLayers];
+	GLint noTexAlphas[kCompositeLayers];
+	GLint fogs[kCompositeLayers];
+	GLfloat alphaThresholds[kCompositeLayers];
+	
+	for(size_t lid = 0; lid < run.count; ++lid){
+		const MaterialPass & pass = subObject.passes[run.first + lid];
+		globalAmbients[lid] = pass.globalAmbient;
+		ambients[lid] = pass.ambient;
+		diffuses[lid] = pass.diffuse;
+		emissives[lid] = pass.emissive;
+		sources[lid] = pass.sources;
+		invertVertexAlphas[lid] = pass.invertVertexAlpha ? 1 : 0;
+		fogs[lid] = pass.fog ? 1 : 0;
+		
+		blendFactors[lid] = glm::ivec2(compositeFactor(pass.blendFunc[0]), compositeFactor(pass.blendFunc[1]));
+		invertColors[lid] = pass.invertColor ? 1 : 0;
+		invertAlphas[lid] = pass.invertAlpha ? 1 : 0;
+		noTexColors[lid] = pass.noTexColor ? 1 : 0;
+		noVtxAlphas[lid] = pass.noVtxAlpha ? 1 : 0;
+		noTexAlphas[lid] = pass.noTexAlpha ? 1 : 0;
+		alphaThresholds[lid] = pass.alphaThreshold;
+		
+		const MaterialPass::Texture & texture = pass.texture;
+		uvMatrices[lid] = texture.transform;
+		uvSources[lid] = texture.uvSource;
+		clampedTextures[lid] = texture.clamped;
+		reflections[lid] = texture.reflection ? 1 : 0;
+		refractions[lid] = texture.refraction ? 1 : 0;
+		useTextures[lid] = 0;
+		// Layer i samples from unit i, or from unit kCompositeLayers + i for cube maps.
+		if(!texture.name.empty()){
+			const TextureInfos infos = Resources::manager().getTexture(texture.name);
+			const GLenum target = infos.cubemap ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+			glActiveTexture(GLenum(GL_TEXTURE0 + (infos.cubemap ? kCompositeLayers : 0) + lid));
+			glBindTexture(target, infos.id);
+			glTexParameterf(target, GL_TEXTURE_LOD_BIAS, texture.lodBias);
+			useTextures[lid] = infos.cubemap ? 2 : 1;
+		}
+	}
+	
+	const GLsizei count = GLsizei(run.count);
+	glUniform1i(program->uniform("layerCount"), count);
+	glUniform4fv(program->uniform("globalAmbients[0]"), count, &globalAmbients[0][0]);
+	glUniform4fv(program->uniform("ambients[0]"), count, &ambients[0][0]);
+	glUniform4fv(program->uniform("diffuses[0]"), count, &diffuses[0][0]);
+	glUniform4fv(program->uniform("emissives[0]"), count, &emissives[0][0]);
+	glUniform4fv(program->uniform("sources[0]"), count, &sources[0][0]);
+	glUniform1iv(program->uniform("invertVertexAlphas[0]"), count, invertVertexAlphas);
+	glUniform1iv(program->uniform("fogEnableds[0]"), count, fogs);
+	
+	glUniform2iv(program->uniform("blendFactors[0]"), count, &blendFactors[0][0]);
+	glUniform1iv(program->uniform("blendInvertColors[0]"), count, invertColors);
+	glUniform1iv(program->uniform("blendInvertAlphas[0]"), count, invertAlphas);
+	glUniform1iv(program->uniform("blendNoTexColors[0]"), count, noTexColors);
+	glUniform1iv(program->uniform("blendNoVtxAlphas[0]"), count, noVtxAlphas);
+	glUniform1iv(program->uniform("blendNoTexAlphas[0]"), count, noTexAlphas);
+	glUniform1fv(program->uniform("alphaThresholds[0]"), count, alphaThresholds);
+	
+	glUniformMatrix4fv(program->uniform("uvMatrices[0]"), count, GL_FALSE, &uvMatrices[0][0][0]);
+	glUniform1iv(program->uniform("uvSources[0]"), count, uvSources);
+	glUniform2iv(program->uniform("clampedTextures[0]"), count, &clampedTextures[0][0]);
+	glUniform1iv(program->uniform("useReflectionXforms[0]"), count, reflections);
+	glUniform1iv(program->uniform("useRefractionXforms[0]"), count, refractions);
+	glUniform1iv(program->uniform("useTextures[0]"), count, useTextures);
 	checkGLError();
 }
 
+void Object::drawPass(const SubObject & subObject, const MaterialPass & pass, const glm::vec3 & lodColor) const {
+	if(pass.program != _program){
+		glUseProgram(pass.program->id());
+	}
+	applyPass(pass);
+	glUniform3fv(pass.program->uniform("lodColor"), 1, &lodColor[0]);
+	drawMesh(subObject);
+	if(pass.program != _program){
+		glUseProgram(_program->id());
+	}
+}
+
+void Object::drawMesh(const SubObject & subObject) const {
+	const MeshInfos & mesh = subObject.mesh;
+	if(subObject.useRanges){
+		GLUtilities::bindVertexArray(mesh.vId);
+		glMultiDrawElementsBaseVertex(GL_TRIANGLES, subObject.rangeCounts.data(), mesh.indexType, subObject.rangeOffsets.data(), GLsizei(subObject.rangeCounts.size()), subObject.rangeBaseVertices.data());
+		return;
+	}
+	GLsizei count = mesh.count;
+	const void * offset = mesh.indexOffset();
+	if(subObject.lod > 0){
+		const SubObject::Lod & lod = subObject.lods[subObject.lod - 1];
+		count = lod.count;
+		offset = (const void*)((mesh.indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint)) * lod.firstIndex);
+	}
+	// The elements buffer is part of the vertex array state.
+	GLUtilities::bindVertexArray(mesh.vId);
+	glDrawElementsBaseVertex(GL_TRIANGLES, count, mesh.indexType, offset, mesh.baseVertex);
+}
+
 
 
 void Object::clean() const {
@@ -1,8 +1,9 @@
 #ifndef Object_h
 #define Object_h
 #include "resources/ResourcesManager.hpp"
+#include "Material.hpp"
+#include "helpers/IndexUtilities.hpp"
 #include <PRP/Region/hsBounds.h>
-#include <PRP/Surface/plLayerInterface.h>
 #include <gl3w/gl3w.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
@@ -23,7 +24,66 @@ struct Light {
 	float scale;
 };
 
-class hsGMaterial;
+/// Render state of a material layer, or of a layer and the layer bound to it for its alpha, resolved at load time.
+struct MaterialPass {
+	
+	/// Texture sampled by a pass, looked up by name when drawn as textures are streamed.
+	struct Texture {
+		/// Empty if the layer has no texture.
+		std::string name;
+		glm::mat4 transform = glm::mat4(1.0f);
+		/// UV channel, or -1, -2, -3 for the normal, position and reflection vectors.
+		int uvSource = 0;
+		glm::ivec2 clamped = glm::ivec2(0);
+		bool reflection = false;
+		bool refraction = false;
+		float lodBias = 0.0f;
+	};
+	
+	/// Index of the first layer of the pass in the material.
+	size_t layer = 0;
+	std::shared_ptr<ProgramInfos> program;
+	/// Drawn with object_special, texture1 providing the alpha.
+	bool special = false;
+	
+	// Depth and culling.
+	bool depthWrite = true;
+	GLenum depthFunc = GL_LEQUAL;
+	bool cullFace = true;
+	bool polygonOffset = false;
+	glm::vec2 offset = glm::vec2(0.0f);
+	
+	// Lighting, only sent for the known span lighting modes.
+	bool shading = false;
+	glm::vec4 globalAmbient = glm::vec4(0.0f);
+	glm::vec4 ambient = glm::vec4(0.0f);
+	glm::vec4 diffuse = glm::vec4(0.0f);
+	glm::vec4 emissive = glm::vec4(0.0f);
+	glm::vec4 specular = glm::vec4(0.0f);
+	/// Diffuse, ambient, specular and emissive sources.
+	glm::vec4 sources = glm::vec4(0.0f);
+	bool fog = true;
+	
+	// Blending.
+	GLenum blendFunc[4] = {GL_ONE, GL_ZERO, GL_ZERO, GL_ONE};
+	bool invertVertexAlpha = false;
+	bool invertColor = false;
+	bool invertAlpha = false;
+	bool noTexColor = false;
+	bool noVtxAlpha = false;
+	bool noTexAlpha = false;
+	float alphaThreshold = 0.0f;
+	
+	Texture texture;
+	Texture texture1;
+	bool invertVertexAlpha1 = false;
+};
+
+/// Consecutive passes of a subobject evaluated in a single draw by the layer compositor.
+struct CompositePass {
+	size_t first;
+	size_t count;
+};
 
 class Object {
 
@@ -36,14 +96,46 @@ public:
 		BillboardY = 2
 	};
 	
+	/// Passes evaluated at most by the layer compositor program.
+	static const size_t kCompositeLayers = 4;
+	
 	struct SubObject {
 		MeshInfos mesh;
-		hsGMaterial * material;
+		std::shared_ptr<Material> material;
 		unsigned int mode;
 		bool transparent;
 		std::vector<Light> lights;
 		
-		SubObject(MeshInfos amesh, hsGMaterial * amaterial, const std::vector<Light> & alights, unsigned int amode, bool atransparent){
+		/// Simplified index range sharing the vertices of the mesh, with its geometric error.
+		struct Lod {
+			size_t firstIndex;
+			GLsizei count;
+			float error;
+		};
+		/// Coarser and coarser levels, empty for small or transparent meshes.
+		std::vector<Lod> lods;
+		/// Level drawn, 0 is the full mesh and i > 0 is lods[i-1].
+		size_t lod = 0;
+		
+		/// Clusters of the full mesh, and the merged index ranges of the ones visible this frame.
+		std::vector<IndexUtilities::Meshlet> meshlets;
+		std::vector<GLsizei> rangeCounts;
+		std::vector<const void*> rangeOffsets;
+		std::vector<GLint> rangeBaseVertices;
+		size_t rangeIndexCount = 0;
+		/// Draw the visible ranges instead of the full mesh.
+		bool useRanges = false;
+		/// A layer disables back-face culling, meshlets can't be rejected on their orientation.
+		bool twoSided = false;
+		
+		/// Passes drawn in order, and the second program used by some of them, if any.
+		std::vector<MaterialPass> passes;
+		std::shared_ptr<ProgramInfos> specialProgram;
+		/// The same passes grouped in runs drawn at once, and the compositor program if a run has more than one pass.
+		std::vector<CompositePass> composites;
+		std::shared_ptr<ProgramInfos> compositeProgram;
+		
+		SubObject(MeshInfos amesh, const std::shared_ptr<Material> & amaterial, const std::vector<Light> & alights, unsigned int amode, bool atransparent){
 			mesh = amesh;
 			material = amaterial;
 			mode = amode;
@@ -56,12 +148,31 @@ public:
 
 	~Object();
 	
-	void addSubObject(const MeshInfos & infos, hsGMaterial * material, const std::vector<Light> & lights, const unsigned int shadingMode);
+	void addSubObject(const MeshInfos & infos, const std::shared_ptr<Material> & material, const std::vector<Light> & lights, const unsigned int shadingMode, const std::vector<SubObject::Lod> & lods = {}, const std::vector<IndexUtilities::Meshlet> & meshlets = {});
+	
+	/// Pick the level of each subobject from its error projected at the closest point of the bounds, in pixels.
+	/// pixelsPerUnit is the size in pixels of a unit at distance 1. A level is left for a coarser one once its successor
+	/// is well below threshold, and for a finer one when it reaches threshold. A threshold of 0 selects the full meshes.
+	void selectLods(const glm::vec3 & eye, float pixelsPerUnit, float threshold);
+	
+	/// Reject the meshlets of the subobjects drawn at full detail that are outside of the frustum or facing away from eye,
+	/// the visible ones are drawn in a single call. When disabled, subobjects are drawn as a whole.
+	void cullMeshlets(const glm::vec3 & eye, const glm::mat4 & viewproj, bool enabled);
+	
+	/// Triangles submitted at the current levels.
+	size_t triangleCount() const;
+	
+	/// Triangles drawn at the current levels, once the meshlets are culled.
+	size_t visibleTriangleCount() const;
 	
 	/// Draw function
 	void drawDebug(const glm::mat4& view, const glm::mat4& projection, const int subObject = -1) const;
 	
-	void draw(const glm::mat4& view, const glm::mat4& projection, const int subObject = -1, const int layer = -1) const;
+	/// Layers are composited in a single draw when possible, unless composite is false or a single layer is selected.
+	void draw(const glm::mat4& view, const glm::mat4& projection, const int subObject = -1, const int layer = -1, const bool composite = true) const;
+	
+	/// Number of draws needed to render the material layers of all subobjects, with or without compositing.
+	size_t passCount(bool composite) const;
 	
 	/// Clean function
 	void clean() const;
@@ -70,6 +181,8 @@ public:
 
 	const glm::vec3 & getCenter() const { return _globalBounds.center; }
 	
+	const BoundingBox & getBounds() const { return _globalBounds; }
+	
 	const bool isVisible(const glm::vec3 & point, const glm::vec3 & dir) const;
 	
 	const bool isVisible(const glm::vec3 & point, const glm::mat4 & viewproj) const;
@@ -86,18 +199,34 @@ public:
 	
 	const bool probablySky(){ return _probablySky; }
 	
+	/// Objects named after the sky are drawn first and follow the camera.
+	static bool isSkyName(const std::string & name);
+	
+	/// Vertex array of the first subobject, 0 if there is none.
+	GLuint vertexArray() const { return _subObjects.empty() ? 0 : _subObjects[0]->mesh.vId; }
+	
 private:
 	
-	void renderLayer(const std::shared_ptr<SubObject> & subObject, plLayerInterface * lay, const int tid) const;
-	void renderLayerMult(const std::shared_ptr<SubObject> & subObject, plLayerInterface * lay0, plLayerInterface * lay1, const int tid) const;
+	void drawMesh(const SubObject & subObject) const;
+	/// Resolve the layers of the material of subObject into passes: bump layers, null layers and layers bound to
+	/// the previous one are folded away, the remaining state is stored as the values to send.
+	void compilePasses(SubObject & subObject) const;
+	
+	/// Group the passes of subObject that can be evaluated in the same fragment: no special pass, no blending of
+	/// the framebuffer alpha, the same depth and culling state, and only additive passes after one that can saturate.
+	void compileComposites(SubObject & subObject) const;
+	
+	/// Set the state of pass, its program is expected to be in use.
+	void applyPass(const MaterialPass & pass) const;
+	
+	/// Set the state of the passes of run for the compositor program, expected to be in use.
+	void applyComposite(const SubObject & subObject, const CompositePass & run) const;
+	
+	/// Draw a subobject with a pass and restore the object program.
+	void drawPass(const SubObject & subObject, const MaterialPass & pass, const glm::vec3 & lodColor) const;
+	
 	
 	void setupLights(const std::shared_ptr<ProgramInfos> & program, const std::vector<Light> & lights, const glm::mat4 & view) const;
-	void resetState() const;
-	void depthState(plLayerInterface* lay, const bool forceDecal, const int tid) const;
-	void shadeState(const std::shared_ptr<ProgramInfos> & program, plLayerInterface* lay, unsigned int mode) const;
-	void blendState(const std::shared_ptr<ProgramInfos> & program, plLayerInterface * lay) const;
-	void textureState(const std::shared_ptr<ProgramInfos> & program, plLayerInterface* lay) const;
-	void textureStateCustom(const std::shared_ptr<ProgramInfos> & program, plLayerInterface* lay) const;
 	std::shared_ptr<ProgramInfos> _program;
 	
 	std::vector<std::shared_ptr<SubObject>> _subObjects;
@@ -105,6 +234,9 @@ private:
 	
 	Type _type;
 	glm::mat4 _model;
+	glm::mat4 _invModel;
+	/// Largest scale of the model matrix, to bring the errors of the meshes to world space.
+	float _modelScale;
 	std::string _name;
 	BoundingBox _localBounds;
 	BoundingBox _globalBounds;
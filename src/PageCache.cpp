@@ -0,0 +1,416 @@
+#include "PageCache.hpp"
+#include "helpers/MappedFile.hpp"
+#include <ResManager/plResManager.h>
+#include <PRP/Surface/hsGMaterial.h>
+#include <ghc/filesystem.hpp>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <map>
+
+namespace fs = ghc::filesystem;
+
+// Bump when the layout or the conversion changes.
+static const uint32_t kCacheMagic = 0x43505250; // "PRPC"
+static const uint32_t kCacheVersion = 6;
+
+// Layout: header, vertex cache statistics, then for each buffer its name then the index and vertex arrays.
+// Then for each object its type, transform, name and subobjects.
+// Each subobject stores its material name, mode, lights, its range in a buffer then its levels of detail and meshlets.
+// Everything is padded to 4 bytes so that the arrays can be used in place from the mapping.
+
+/// FNV-1a, stable across runs and platforms, unlike std::hash.
+static uint64_t hashString(const std::string & str){
+	uint64_t hash = 14695981039346656037ull;
+	for(const char c : str){
+		hash ^= (unsigned char)c;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+bool PageCache::stamp(const std::string & path, uint64_t & size, int64_t & time){
+	std::error_code ec;
+	size = uint64_t(fs::file_size(path, ec));
+	if(ec){
+		return false;
+	}
+	time = int64_t(fs::last_write_time(path, ec).time_since_epoch().count());
+	return !ec;
+}
+
+class CacheWriter {
+public:
+
+	CacheWriter(std::ofstream & out) : _out(out) {}
+
+	template<typename T> void write(const T & value){
+		_out.write((const char*)&value, sizeof(T));
+	}
+
+	void write(const void * data, size_t size){
+		static const char padding[4] = {0, 0, 0, 0};
+		if(size > 0){
+			_out.write((const char*)data, size);
+		}
+		if(size % 4 != 0){
+			_out.write(padding, 4 - (size % 4));
+		}
+	}
+
+	void write(const std::string & str){
+		write(uint32_t(str.size()));
+		write(str.data(), str.size());
+	}
+
+private:
+	std::ofstream & _out;
+};
+
+class CacheReader {
+public:
+
+	CacheReader(const unsigned char * data, size_t size) : _current(data), _end(data + size) {}
+
+	template<typename T> bool read(T & value){
+		if(size_t(_end - _current) < sizeof(T)){
+			return false;
+		}
+		std::memcpy(&value, _current, sizeof(T));
+		_current += sizeof(T);
+		return true;
+	}
+
+	/// Pointer to count elements in the mapping, nullptr if out of bounds.
+	template<typename T> const T * array(size_t count){
+		const size_t size = count * sizeof(T);
+		const size_t paddedSize = (size + 3) & ~size_t(3);
+		if(size_t(_end - _current) < paddedSize){
+			return nullptr;
+		}
+		const T * data = (const T*)_current;
+		_current += paddedSize;
+		return data;
+	}
+
+	bool read(std::string & str){
+		uint32_t length = 0;
+		if(!read(length)){
+			return false;
+		}
+		const char * data = array<char>(length);
+		if(!data){
+			return false;
+		}
+		str.assign(data, length);
+		return true;
+	}
+
+private:
+	const unsigned char * _current;
+	const unsigned char * _end;
+};
+
+static bool readStats(CacheReader & reader, IndexUtilities::CacheStats & stats){
+	uint64_t triangles = 0, vertices = 0, transformed = 0;
+	if(!reader.read(triangles) || !reader.read(vertices) || !reader.read(transformed)){
+		return false;
+	}
+	stats.triangles = size_t(triangles);
+	stats.vertices = size_t(vertices);
+	stats.transformed = size_t(transformed);
+	return true;
+}
+
+static void writeStats(CacheWriter & writer, const IndexUtilities::CacheStats & stats){
+	writer.write(uint64_t(stats.triangles));
+	writer.write(uint64_t(stats.vertices));
+	writer.write(uint64_t(stats.transformed));
+}
+
+/// Read the header of a cache file and check that it matches the current state of the page file.
+static bool readHeader(CacheReader & reader, const std::string & pagePath){
+	uint64_t pageSize = 0;
+	int64_t pageTime = 0;
+	if(!PageCache::stamp(pagePath, pageSize, pageTime)){
+		return false;
+	}
+	uint32_t magic = 0, version = 0, lightSize = 0;
+	std::string path;
+	uint64_t size = 0;
+	int64_t time = 0;
+	if(!reader.read(magic) || !reader.read(version) || !reader.read(lightSize) || !reader.read(path) || !reader.read(size) || !reader.read(time)){
+		return false;
+	}
+	return magic == kCacheMagic && version == kCacheVersion && lightSize == sizeof(Light) && path == pagePath && size == pageSize && time == pageTime;
+}
+
+std::string PageCache::cachePath(const std::string & cacheDirectory, const std::string & pagePath){
+	// Keep the page name for readability, the hash disambiguates pages with the same name.
+	const std::string pageName = fs::path(pagePath).stem().string();
+	char hash[17];
+	snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)hashString(pagePath));
+	return (fs::path(cacheDirectory) / (pageName + "_" + hash + ".cache")).string();
+}
+
+bool PageCache::isValid(const std::string & cacheFile, const std::string & pagePath){
+	MappedFile file;
+	if(!file.open(cacheFile)){
+		return false;
+	}
+	CacheReader reader(file.data(), file.size());
+	return readHeader(reader, pagePath);
+}
+
+bool PageCache::load(const std::string & cacheFile, Age::PageData & page){
+	std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+	if(!file->open(cacheFile)){
+		return false;
+	}
+	CacheReader reader(file->data(), file->size());
+
+	// Check that the cache is up to date.
+	if(!readHeader(reader, page.path)){
+		return false;
+	}
+
+	// Materials are referenced by name, and copied once when first used.
+	std::map<std::string, hsGMaterial*> materials;
+	std::map<std::string, std::shared_ptr<Material>> copies;
+	for(const auto & matKey : page.rm->getKeys(page.info->getLocation(), pdUnifiedTypeMap::ClassIndex("hsGMaterial"))){
+		hsGMaterial * material = hsGMaterial::Convert(matKey->getObj(), false);
+		if(material){
+			materials[matKey->getName().to_std_string()] = material;
+		}
+	}
+
+	// The geometry is stored optimized, keep the statistics of the exported one.
+	IndexUtilities::CacheStats cacheBefore, cacheAfter;
+	if(!readStats(reader, cacheBefore) || !readStats(reader, cacheAfter)){
+		return false;
+	}
+	
+	uint32_t hasBounds = 0;
+	glm::vec3 mins, maxs;
+	uint32_t bufferCount = 0;
+	if(!reader.read(hasBounds) || !reader.read(mins) || !reader.read(maxs) || !reader.read(bufferCount)){
+		return false;
+	}
+
+	std::vector<Age::PageData::BufferData> buffers(bufferCount);
+	for(auto & buffer : buffers){
+		uint32_t indexCount = 0, vertexCount = 0, uvCount = 0;
+		if(!reader.read(buffer.name) || !reader.read(indexCount) || !reader.read(vertexCount) || !reader.read(uvCount)){
+			return false;
+		}
+		MeshView & view = buffer.view;
+		view.indexCount = indexCount;
+		view.vertexCount = vertexCount;
+		view.indices = reader.array<unsigned int>(indexCount);
+		view.positions = reader.array<glm::vec3>(vertexCount);
+		view.normals = reader.array<glm::vec3>(vertexCount);
+		view.colors = reader.array<glm::u8vec4>(vertexCount);
+		if(!view.indices || !view.positions || !view.normals || !view.colors){
+			return false;
+		}
+		view.texcoords.resize(uvCount);
+		for(auto & texcoords : view.texcoords){
+			texcoords = reader.array<glm::vec3>(vertexCount);
+			if(!texcoords){
+				return false;
+			}
+		}
+	}
+
+	uint32_t objectCount = 0;
+	if(!reader.read(objectCount)){
+		return false;
+	}
+
+	std::vector<Age::PageData::ObjectData> objects(objectCount);
+	for(auto & object : objects){
+		uint32_t type = 0, subObjectCount = 0;
+		if(!reader.read(type) || !reader.read(object.model) || !reader.read(object.name) || !reader.read(subObjectCount)){
+			return false;
+		}
+		object.type = Object::Type(type);
+		object.subObjects.resize(subObjectCount);
+
+		for(auto & subObject : object.subObjects){
+			uint32_t mode = 0, lightCount = 0;
+			if(!reader.read(subObject.materialName) || !reader.read(mode) || !reader.read(lightCount)){
+				return false;
+			}
+			const auto material = materials.find(subObject.materialName);
+			if(material == materials.end()){
+				return false;
+			}
+			auto & copy = copies[subObject.materialName];
+			if(!copy){
+				copy = Material::fromPlasma(material->second);
+			}
+			subObject.material = copy;
+			subObject.mode = mode;
+
+			const Light * lights = reader.array<Light>(lightCount);
+			if(!lights){
+				return false;
+			}
+			subObject.lights.assign(lights, lights + lightCount);
+
+			uint32_t buffer = 0, firstIndex = 0, indexCount = 0, baseVertex = 0, vertexCount = 0;
+			if(!reader.read(buffer) || !reader.read(firstIndex) || !reader.read(indexCount) || !reader.read(baseVertex) || !reader.read(vertexCount)){
+				return false;
+			}
+			// Reject ranges outside of their buffer.
+			if(buffer >= buffers.size() || size_t(firstIndex) + indexCount > buffers[buffer].view.indexCount || size_t(baseVertex) + vertexCount > buffers[buffer].view.vertexCount){
+				return false;
+			}
+			subObject.buffer = buffer;
+			subObject.firstIndex = firstIndex;
+			subObject.indexCount = indexCount;
+			subObject.baseVertex = baseVertex;
+			subObject.vertexCount = vertexCount;
+			
+			uint32_t lodCount = 0;
+			if(!reader.read(lodCount)){
+				return false;
+			}
+			subObject.lods.resize(lodCount);
+			for(auto & lod : subObject.lods){
+				uint32_t lodFirstIndex = 0, lodIndexCount = 0;
+				if(!reader.read(lodFirstIndex) || !reader.read(lodIndexCount) || !reader.read(lod.error)){
+					return false;
+				}
+				if(size_t(lodFirstIndex) + lodIndexCount > buffers[buffer].view.indexCount){
+					return false;
+				}
+				lod.firstIndex = lodFirstIndex;
+				lod.indexCount = lodIndexCount;
+			}
+			
+			uint32_t meshletCount = 0;
+			if(!reader.read(meshletCount)){
+				return false;
+			}
+			subObject.meshlets.resize(meshletCount);
+			for(auto & meshlet : subObject.meshlets){
+				uint32_t meshletFirstIndex = 0, meshletIndexCount = 0;
+				if(!reader.read(meshletFirstIndex) || !reader.read(meshletIndexCount) || !reader.read(meshlet.center) || !reader.read(meshlet.radius)
+				   || !reader.read(meshlet.coneAxis) || !reader.read(meshlet.coneCutoff)){
+					return false;
+				}
+				if(size_t(meshletFirstIndex) + meshletIndexCount > indexCount){
+					return false;
+				}
+				meshlet.firstIndex = meshletFirstIndex;
+				meshlet.indexCount = meshletIndexCount;
+			}
+		}
+	}
+
+	page.buffers = std::move(buffers);
+	page.objects = std::move(objects);
+	page.hasBounds = hasBounds != 0;
+	page.bounds = BoundingBox(mins, maxs);
+	page.cacheBefore = cacheBefore;
+	page.cacheAfter = cacheAfter;
+	page.cache = file;
+	return true;
+}
+
+bool PageCache::save(const std::string & cacheFile, const Age::PageData & page){
+	uint64_t pageSize = 0;
+	int64_t pageTime = 0;
+	if(!stamp(page.path, pageSize, pageTime)){
+		return false;
+	}
+
+	// Write to a temporary file first, so that an interrupted write is never picked up.
+	const std::string tempFile = cacheFile + ".tmp";
+	{
+		std::ofstream out(tempFile, std::ios::binary | std::ios::trunc);
+		if(!out.is_open()){
+			return false;
+		}
+		CacheWriter writer(out);
+		writer.write(kCacheMagic);
+		writer.write(kCacheVersion);
+		writer.write(uint32_t(sizeof(Light)));
+		writer.write(page.path);
+		writer.write(pageSize);
+		writer.write(pageTime);
+		writeStats(writer, page.cacheBefore);
+		writeStats(writer, page.cacheAfter);
+
+		writer.write(uint32_t(page.hasBounds ? 1 : 0));
+		writer.write(page.bounds.mins);
+		writer.write(page.bounds.maxs);
+
+		writer.write(uint32_t(page.buffers.size()));
+		for(const auto & buffer : page.buffers){
+			const MeshView & mesh = buffer.view;
+			writer.write(buffer.name);
+			writer.write(uint32_t(mesh.indexCount));
+			writer.write(uint32_t(mesh.vertexCount));
+			writer.write(uint32_t(mesh.texcoords.size()));
+			writer.write(mesh.indices, sizeof(unsigned int) * mesh.indexCount);
+			writer.write(mesh.positions, sizeof(glm::vec3) * mesh.vertexCount);
+			writer.write(mesh.normals, sizeof(glm::vec3) * mesh.vertexCount);
+			writer.write(mesh.colors, sizeof(glm::u8vec4) * mesh.vertexCount);
+			for(const auto & texcoords : mesh.texcoords){
+				writer.write(texcoords, sizeof(glm::vec3) * mesh.vertexCount);
+			}
+		}
+
+		writer.write(uint32_t(page.objects.size()));
+
+		for(const auto & object : page.objects){
+			writer.write(uint32_t(object.type));
+			writer.write(object.model);
+			writer.write(object.name);
+			writer.write(uint32_t(object.subObjects.size()));
+
+			for(const auto & subObject : object.subObjects){
+				writer.write(subObject.materialName);
+				writer.write(uint32_t(subObject.mode));
+				writer.write(uint32_t(subObject.lights.size()));
+				writer.write(subObject.lights.data(), sizeof(Light) * subObject.lights.size());
+				writer.write(uint32_t(subObject.buffer));
+				writer.write(uint32_t(subObject.firstIndex));
+				writer.write(uint32_t(subObject.indexCount));
+				writer.write(uint32_t(subObject.baseVertex));
+				writer.write(uint32_t(subObject.vertexCount));
+				writer.write(uint32_t(subObject.lods.size()));
+				for(const auto & lod : subObject.lods){
+					writer.write(uint32_t(lod.firstIndex));
+					writer.write(uint32_t(lod.indexCount));
+					writer.write(lod.error);
+				}
+				writer.write(uint32_t(subObject.meshlets.size()));
+				for(const auto & meshlet : subObject.meshlets){
+					writer.write(uint32_t(meshlet.firstIndex));
+					writer.write(uint32_t(meshlet.indexCount));
+					writer.write(meshlet.center);
+					writer.write(meshlet.radius);
+					writer.write(meshlet.coneAxis);
+					writer.write(meshlet.coneCutoff);
+				}
+			}
+		}
+		if(!out.good()){
+			out.close();
+			std::remove(tempFile.c_str());
+			return false;
+		}
+	}
+
+	std::error_code ec;
+	fs::rename(tempFile, cacheFile, ec);
+	if(ec){
+		std::remove(tempFile.c_str());
+		return false;
+	}
+	return true;
+}
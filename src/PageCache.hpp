@@ -0,0 +1,31 @@
+#ifndef PageCache_h
+#define PageCache_h
+
+#include "Age.hpp"
+#include <string>
+#include <cstdint>
+
+/// On-disk cache of the converted geometry of a page, stored in a flat layout that can be memory-mapped.
+/// A cache file is only used if the page path, size and modification time and the cache version all match.
+class PageCache {
+public:
+
+	/// Size and modification time of a page file, returns false if it can't be accessed.
+	static bool stamp(const std::string & path, uint64_t & size, int64_t & time);
+
+	/// Path of the cache file for a page in a cache directory.
+	static std::string cachePath(const std::string & cacheDirectory, const std::string & pagePath);
+
+	/// Is there an up to date cache file for the page, only the header is read.
+	static bool isValid(const std::string & cacheFile, const std::string & pagePath);
+
+	/// Map the cached geometry of a decoded page, materials are resolved by name in the page manager.
+	/// On success, page objects reference the mapped data and page.cache keeps it alive.
+	static bool load(const std::string & cacheFile, Age::PageData & page);
+
+	/// Write the converted geometry of a page, returns false if the file couldn't be written.
+	static bool save(const std::string & cacheFile, const Age::PageData & page);
+
+};
+
+#endif
@@ -3,13 +3,22 @@
 #include "input/Input.hpp"
 #include "helpers/InterfaceUtilities.hpp"
 #include "helpers/Logger.hpp"
-#include <PRP/Surface/hsGMaterial.h>
+#include "helpers/Profiler.hpp"
 #include <PRP/Misc/plFogEnvironment.h>
 #include <glm/gtx/norm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <stdio.h>
 #include <vector>
 #include <cctype>
+#include <cmath>
+#include <limits>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/// Programs used to draw objects, sharing the global toggles and the fog.
+static const std::vector<std::string> kObjectPrograms = {"object_basic", "object_special", "object_layers"};
 
 bool findSubstringInsensitive(const std::string & strHaystack, const std::string & strNeedle)
 {
@@ -45,6 +54,12 @@ Renderer::Renderer(Config & config) : _config(config) {
 	Resources::manager().getProgram("object_special")->registerTexture("textures", 0);
 	Resources::manager().getProgram("object_special")->registerTexture("cubemaps", 1);
 	Resources::manager().getProgram("object_special")->registerTexture("textures1", 2);
+	// The compositor samples layer i from unit i, or from unit kCompositeLayers + i for cube maps.
+	const auto layersProgram = Resources::manager().getProgram("object_layers");
+	for(size_t lid = 0; lid < Object::kCompositeLayers; ++lid){
+		layersProgram->registerTexture("textures" + std::to_string(lid), int(lid));
+		layersProgram->registerTexture("cubemaps" + std::to_string(lid), int(Object::kCompositeLayers + lid));
+	}
 	
 	std::vector<std::string> files = ImGui::listFiles("./", false, false, {"age"});
 	
@@ -61,6 +76,10 @@ Renderer::Renderer(Config & config) : _config(config) {
 
 
 void Renderer::draw(){
+	PROFILE_ZONE("Renderer::draw");
+	// Vertex array binds of the previous frame.
+	_vertexArrayBinds = GLUtilities::resetVertexArrayBinds();
+	Profiler::Zone interfaceZone("Renderer::interface");
 	
 	// Infos window.
 	ImGui::SetNextWindowPos(ImVec2(0,290), ImGuiCond_FirstUseEver);
@@ -68,13 +87,18 @@ void Renderer::draw(){
 	if (ImGui::Begin("Infos")) {
 		ImGui::Text("%2.1f FPS (%2.1f ms)", ImGui::GetIO().Framerate, ImGui::GetIO().DeltaTime*1000.0f);
 		ImGui::Text("Age: %s", (_age->getName().c_str()));
+		const auto & ageInLoading = _loadingAge ? _loadingAge : _age;
+		if(ageInLoading->loading()){
+			const std::string progressText = "Loading " + ageInLoading->getName() + "...";
+			ImGui::ProgressBar(ageInLoading->progress(), ImVec2(-1.0f, 0.0f), progressText.c_str());
+		}
 		
 		if(_displayMode == OneObject && _objectId < _age->objects().size()) {
 			
 			const auto & selectedObj = _age->objects()[_objectId];
 			ImGui::Text("Object: %s, %lu parts", selectedObj->getName().c_str(), selectedObj->subObjects().size());
 			if(_subObjectId>-1){
-				ImGui::Text("Part: %d, %lu layers", _subObjectId, selectedObj->subObjects()[_subObjectId]->material->getLayers().size());
+				ImGui::Text("Part: %d, %lu layers", _subObjectId, selectedObj->subObjects()[_subObjectId]->material->layers.size());
 			}
 			
 			const ImGuiTreeNodeFlags parentFlags = 0 ;
@@ -83,10 +107,9 @@ void Renderer::draw(){
 				const auto & subobj = selectedObj->subObjects()[soid];
 				const std::string subObjName = "Subobject " + std::to_string(soid);
 				if(ImGui::TreeNodeEx(subObjName.c_str(), parentFlags, "%s", subObjName.c_str())){
-					for(const auto & layer : subobj->material->getLayers()){
-						if(ImGui::TreeNodeEx(layer->getName().c_str(), parentFlags, "%s", layer->getName().c_str())){
-							plLayerInterface * lay = plLayerInterface::Convert(layer->getObj());
-							const std::string logString = logLayer(lay);
+					for(const auto & layer : subobj->material->layers){
+						if(ImGui::TreeNodeEx(layer.name.c_str(), parentFlags, "%s", layer.name.c_str())){
+							const std::string logString = logLayer(layer);
 							ImGui::TextWrapped("%s", logString.c_str());
 							ImGui::TreePop();
 						}
@@ -100,7 +123,21 @@ void Renderer::draw(){
 			const auto & texInfos = Resources::manager().getTexture(textureName);
 			ImGui::Text("(%d x %d), %s %d mips", texInfos.width, texInfos.height, (texInfos.cubemap ? "Cube" : "2D"), texInfos.mipmap);
 		} else {
-			ImGui::Text("Draws: %i/%lu objects", _drawCount, _age->objects().size());
+			ImGui::Text("Draws: %i/%lu objects, %lu parts, %lu passes", _drawCount, _age->objects().size(), _partCount, _passCount);
+			ImGui::Text("Triangles: %.1fk drawn of %.1fk", double(_visibleTriangleCount) / 1000.0, double(_triangleCount) / 1000.0);
+			ImGui::Text("Textures: %lu uploaded, %lu never used", Resources::manager().uploadedTextureCount(), Resources::manager().untouchedTextureCount());
+			ImGui::Text("Deduplicated: %.1fMB", double(_age->deduplicatedSize()) / (1024.0 * 1024.0));
+			const MeshPool::Stats pool = Resources::manager().meshPoolStats();
+			const size_t poolFree = pool.capacity - pool.used;
+			const double fragmentation = poolFree > 0 ? 1.0 - double(pool.largestFree) / double(poolFree) : 0.0;
+			ImGui::Text("Mesh pool: %lu blocks, %lu formats, %lu binds", pool.blocks, pool.formats, _vertexArrayBinds);
+			ImGui::Text("%.1f/%.1fMB, %lu free ranges, %.0f%% frag.", double(pool.used) / (1024.0 * 1024.0), double(pool.capacity) / (1024.0 * 1024.0), pool.freeRanges, fragmentation * 100.0);
+			if(_residentAges.size() > 1){
+				ImGui::Text("Ages: %lu resident", _residentAges.size());
+			}
+			if(_age->streaming()){
+				ImGui::Text("Pages: %lu/%lu resident, %.1fMB", _age->residentPages(), _age->pageCount(), double(_age->residentSize()) / (1024.0 * 1024.0));
+			}
 		}
 
 	}
@@ -123,6 +160,16 @@ void Renderer::draw(){
 			current_item_id = 0;
 			
 		}
+		// Convert again the pages modified on disk, keeping the camera and the selection.
+		if(!_age->path().empty() && !_age->loading() && !_age->reloading()){
+			ImGui::SameLine();
+			if(ImGui::Button("Reload changed")){
+				const std::string selectedObject = selectedObjectName();
+				const std::string selectedTexture = selectedTextureName();
+				_age->reloadChangedPages();
+				restoreSelection(selectedObject, selectedTexture);
+			}
+		}
 		
 		auto linkingNameProvider = [](void* data, int idx, const char** out_text) {
 			const std::vector<std::string>* arr = (std::vector<std::string>*)data;
@@ -140,35 +187,29 @@ void Renderer::draw(){
 		ImGui::Checkbox("Wireframe", &_wireframe);
 		ImGui::SameLine();
 		if(ImGui::Checkbox("Vertex colors", &_vertexOnly)){
-			const auto prog = Resources::manager().getProgram("object_basic");
-			glUseProgram(prog->id());
-			glUniform1i(prog->uniform("forceVertexColor"), _vertexOnly);
-			glUseProgram(0);
-			const auto prog1 = Resources::manager().getProgram("object_special");
-			glUseProgram(prog1->id());
-			glUniform1i(prog1->uniform("forceVertexColor"), _vertexOnly);
+			for(const auto & name : kObjectPrograms){
+				const auto prog = Resources::manager().getProgram(name);
+				glUseProgram(prog->id());
+				glUniform1i(prog->uniform("forceVertexColor"), _vertexOnly);
+			}
 			glUseProgram(0);
 		}
 		
 		if(ImGui::Checkbox("Default light", &_forceLighting)){
-			const auto prog = Resources::manager().getProgram("object_basic");
-			glUseProgram(prog->id());
-			glUniform1i(prog->uniform("forceLighting"), _forceLighting);
-			glUseProgram(0);
-			const auto prog1 = Resources::manager().getProgram("object_special");
-			glUseProgram(prog1->id());
-			glUniform1i(prog1->uniform("forceLighting"), _forceLighting);
+			for(const auto & name : kObjectPrograms){
+				const auto prog = Resources::manager().getProgram(name);
+				glUseProgram(prog->id());
+				glUniform1i(prog->uniform("forceLighting"), _forceLighting);
+			}
 			glUseProgram(0);
 		}
 		ImGui::SameLine();
 		if(ImGui::Checkbox("No lights", &_forceNoLighting)){
-			const auto prog = Resources::manager().getProgram("object_basic");
-			glUseProgram(prog->id());
-			glUniform1i(prog->uniform("forceNoLighting"), _forceNoLighting);
-			glUseProgram(0);
-			const auto prog1 = Resources::manager().getProgram("object_special");
-			glUseProgram(prog1->id());
-			glUniform1i(prog1->uniform("forceNoLighting"), _forceNoLighting);
+			for(const auto & name : kObjectPrograms){
+				const auto prog = Resources::manager().getProgram(name);
+				glUseProgram(prog->id());
+				glUniform1i(prog->uniform("forceNoLighting"), _forceNoLighting);
+			}
 			glUseProgram(0);
 		}
 		
@@ -177,6 +218,27 @@ void Renderer::draw(){
 		ImGui::PushItemWidth(90.0f);
 		ImGui::SliderFloat("Dist.", &_cullingDistance, 10.0f, 3000.0f);
 		ImGui::PopItemWidth();
+		ImGui::Checkbox("LODs", &_useLods); ImGui::SameLine();
+		if(ImGui::Checkbox("Show", &_showLods)){
+			for(const auto & name : kObjectPrograms){
+				const auto prog = Resources::manager().getProgram(name);
+				glUseProgram(prog->id());
+				glUniform1i(prog->uniform("showLods"), _showLods);
+			}
+			glUseProgram(0);
+		}
+		ImGui::SameLine();
+		ImGui::PushItemWidth(90.0f);
+		ImGui::SliderFloat("Err. (px)", &_lodThreshold, 0.25f, 8.0f);
+		ImGui::PopItemWidth();
+		ImGui::Checkbox("Composite layers", &_compositeLayers);
+		ImGui::Checkbox("Meshlets", &_cullMeshlets); ImGui::SameLine();
+		if(!_flyThrough && !_age->linkingNames().empty() && ImGui::Button("Fly-through")){
+			_flyThrough = true;
+			_flyFrame = 0;
+			_flySubmitted = 0;
+			_flyDrawn = 0;
+		}
 		// Camera.
 		ImGui::PushItemWidth(DEFAULT_WIDTH);
 		ImGui::SliderFloat("Camera speed", &_camera.speed(), 0.0f, 500.0f);
@@ -193,6 +255,42 @@ void Renderer::draw(){
 		ImGui::PopItemWidth();
 		ImGui::ColorEdit3("Background", &_clearColor[0]);
 		ImGui::Checkbox("Show cam. center", &_showDot);
+		// Profiling zones, viewable in chrome://tracing or ui.perfetto.dev.
+		bool profiling = Profiler::enabled();
+		if(ImGui::Checkbox("Profile", &profiling)){
+			Profiler::setEnabled(profiling);
+		}
+		ImGui::SameLine();
+		if(ImGui::Button("Save trace")){
+			const std::string tracePath = _config.tracePath.empty() ? "trace.json" : _config.tracePath;
+			if(Profiler::exportTrace(tracePath)){
+				Log::Info() << "Trace saved to " << tracePath << "." << std::endl;
+			} else {
+				Log::Error() << "Unable to save trace to " << tracePath << "." << std::endl;
+			}
+		}
+		
+		// Load more pages of the current age.
+		if(!_age->availablePages().empty() && ImGui::CollapsingHeader("Pages")){
+			for(const auto & page : _age->availablePages()){
+				if(_age->isPageLoaded(page.first)){
+					ImGui::TextDisabled("%s", page.first.c_str());
+					continue;
+				}
+				bool selected = _selectedPages.count(page.first) > 0;
+				if(ImGui::Checkbox(page.first.c_str(), &selected)){
+					if(selected){
+						_selectedPages.insert(page.first);
+					} else {
+						_selectedPages.erase(page.first);
+					}
+				}
+			}
+			if(!_selectedPages.empty() && !_age->loading() && ImGui::Button("Load selected pages")){
+				_age->addPages(std::vector<std::string>(_selectedPages.begin(), _selectedPages.end()));
+				_selectedPages.clear();
+			}
+		}
 	}
 	ImGui::End();
 	
@@ -327,7 +425,7 @@ void Renderer::draw(){
 				if(_subObjectId < 0){
 					_subObjectId = 0;
 				}
-				_subLayerId = std::min(std::max(_subLayerId,-1), (int)_age->objects()[_objectId]->subObjects()[_subObjectId]->material->getLayers().size()-1);
+				_subLayerId = std::min(std::max(_subLayerId,-1), (int)_age->objects()[_objectId]->subObjects()[_subObjectId]->material->layers.size()-1);
 			}
 		} else if(_displayMode == OneTexture){
 			if(ImGui::InputInt("Texture ID", &_textureId)){
@@ -337,6 +435,7 @@ void Renderer::draw(){
 		
 	}
 	ImGui::End();
+	interfaceZone.end();
 
 	glClearColor(_clearColor[0], _clearColor[1], _clearColor[2], 1.0f);
 	
@@ -367,22 +466,33 @@ void Renderer::draw(){
 	glEnable(GL_DEPTH_TEST);
 	glDisable(GL_BLEND);
 	checkGLError();
+	// Size in pixels of a unit at distance 1, to project the errors of the simplified meshes.
+	const float pixelsPerUnit = float(_renderResolution[1]) / (2.0f * std::tan(0.5f * _camera.fov()));
+	const float lodThreshold = _useLods ? _lodThreshold : 0.0f;
+	
 	if(_displayMode == OneObject){
 		if(_objectId < _age->objects().size()){
 			const auto objectToShow = _age->objects()[_objectId];
+			objectToShow->selectLods(_camera.getPosition(), pixelsPerUnit, lodThreshold);
+			objectToShow->cullMeshlets(_camera.getPosition(), _camera.projection() * _camera.view(), _cullMeshlets);
 			if(_wireframe){
 				objectToShow->drawDebug(_camera.view() , _camera.projection(), _subObjectId);
 			} else {
-				objectToShow->draw(_camera.view() , _camera.projection(), _subObjectId, _subLayerId);
+				objectToShow->draw(_camera.view() , _camera.projection(), _subObjectId, _subLayerId, _compositeLayers);
 			}
 		}
 	} else {
 	
 		const glm::mat4 viewproj = _camera.projection() * _camera.view();
 		_drawCount = 0;
+		_partCount = 0;
+		_triangleCount = 0;
+		_visibleTriangleCount = 0;
+		_passCount = 0;
 		auto objects = _age->objectsClone();
 		auto& camera = _camera;
 		
+		Profiler::Zone sortZone("Renderer::sort");
 		std::sort(objects.begin(), objects.end(), [&camera](const std::shared_ptr<Object> & leftObj, const std::shared_ptr<Object> & rightObj){
 			// We cheat for one object only, the sky, drawn first in all cases.
 			
@@ -413,8 +523,11 @@ void Renderer::draw(){
 			
 			// Either they are both billboard, both transparent, or both opaque.
 			if(!leftObj->transparent()){
-				// Both are non transparent, render the closest first.
-				// We don't really care.
+				// Both are non transparent, group them by pool block to avoid vertex array switches,
+				// then render the closest first. We don't really care.
+				if(leftObj->vertexArray() != rightObj->vertexArray()){
+					return leftObj->vertexArray() < rightObj->vertexArray();
+				}
 				return leftDist < rightDist;
 			}
 			// Else if one is contained in the other, render it first.
@@ -427,6 +540,7 @@ void Renderer::draw(){
 			return leftDist > rightDist;
 
 		});
+		sortZone.end();
 		
 		// Rendering order:
 		// skybox first.
@@ -434,25 +548,39 @@ void Renderer::draw(){
 		// transparent objects (subojects?) from furthest to closest (maybe at least use the bounding box of the transparent subojects.
 		// billboards are after the transparent objects.
 		
-		for(const auto & object : objects){
+		Profiler::Zone cullZone("Renderer::cull");
+		objects.erase(std::remove_if(objects.begin(), objects.end(), [this, &viewproj](const std::shared_ptr<Object> & object){
 			if(!object->enabled){
-				continue;
+				return true;
 			}
 			// Cull based on distance and bounding box vs camera frustum.
-			if(_doCulling && !object->probablySky() &&
+			return _doCulling && !object->probablySky() &&
 			   (glm::length2(object->getCenter() - _camera.getPosition()) > _cullingDistance*_cullingDistance ||
 				 !object->isVisible(_camera.getPosition(), viewproj)
-				)){
-				continue;
-			}
+				);
+		}), objects.end());
+		cullZone.end();
+		
+		PROFILE_ZONE("Renderer::drawObjects");
+		for(const auto & object : objects){
+			object->selectLods(_camera.getPosition(), pixelsPerUnit, lodThreshold);
+			object->cullMeshlets(_camera.getPosition(), viewproj, _cullMeshlets);
+			_partCount += object->subObjects().size();
+			_triangleCount += object->triangleCount();
+			_visibleTriangleCount += object->visibleTriangleCount();
+			_passCount += object->passCount(_compositeLayers);
 			if(_wireframe){
 				object->drawDebug(_camera.view() , _camera.projection());
 			} else {
-				object->draw(_camera.view() , _camera.projection());
+				object->draw(_camera.view() , _camera.projection(), -1, -1, _compositeLayers);
 			}
 			++_drawCount;
 		}
-	
+		
+		if(_flyThrough){
+			_flySubmitted += _triangleCount;
+			_flyDrawn += _visibleTriangleCount;
+		}
 	}
 
 	
@@ -467,14 +595,13 @@ void Renderer::draw(){
 		const auto debugObject = Resources::manager().getMesh("sphere");
 		
 		glUseProgram(debugProgram->id());
-		glBindVertexArray(debugObject.vId);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, debugObject.eId);
+		GLUtilities::bindVertexArray(debugObject.vId);
 		glUniformMatrix4fv(debugProgram->uniform("mvp"), 1, GL_FALSE, &MVP[0][0]);
 		glUniform2f(debugProgram->uniform("screenSize"), _config.screenResolution[0], _config.screenResolution[1]);
-		glDrawElements(GL_TRIANGLES, debugObject.count, GL_UNSIGNED_INT, (void*)0);
+		glDrawElements(GL_TRIANGLES, debugObject.count, debugObject.indexType, (void*)0);
 	}
 	// Reset state.
-	glBindVertexArray(0);
+	GLUtilities::bindVertexArray(0);
 	glUseProgram(0);
 	glEnable(GL_CULL_FACE);
 	glDisable(GL_DEPTH_TEST);
@@ -489,14 +616,33 @@ void Renderer::draw(){
 }
 
 void Renderer::loadAge(const std::string & path){
+	// An age still resident is displayed immediately.
+	for(const auto & age : _residentAges){
+		if(age->path() == path){
+			Log::Info() << "Switching to " << path << "." << std::endl;
+			_loadingAge.reset();
+			setupAge(age);
+			return;
+		}
+	}
 	Log::Info() << "Loading " << path << "..." << std::endl;
-	Resources::manager().reset();
+	// The current age stays displayed until the new one has its first pages ready.
+	_loadingAge.reset(new Age(path, _config.loadThreads, _config.backgroundLoad, _config.cachePath, _config.pages));
+	_loadingAge->setStreaming(_config.streamRadius, size_t(_config.streamBudget) * 1024 * 1024);
+}
+
+void Renderer::setupAge(const std::shared_ptr<Age> & age){
 	_displayMode = Scene;
 	_objectId = 0;
 	_textureId = 0;
 	_subObjectId = -1;
 	_subLayerId = -1;
-	_age.reset(new Age(path));
+	_selectedPages.clear();
+	_age = age;
+	// The previous ages stay resident, shared content is reference counted by the resources manager.
+	_residentAges.remove(_age);
+	_residentAges.push_front(_age);
+	evictAges();
 	// A Uru human is around 4/5 units in height apparently.
 	_camera.setCenter(_age->getDefaultLinkingPoint());
 	// Pass clear color.
@@ -506,26 +652,84 @@ void Renderer::loadAge(const std::string & path){
 	
 	// Set fog parameters in shaders.
 	const auto * fog = _age->getFog();
-	const auto prog = Resources::manager().getProgram("object_basic");
-	glUseProgram(prog->id());
-	glUniform1i(prog->uniform("fogEnabled"), 1);
-	glUniform1i(prog->uniform("fogMode"), int(fog->getType()));
-	glUniform3f(prog->uniform("fogColor"), fog->getColor().r, fog->getColor().g, fog->getColor().b);
-	glUniform3f(prog->uniform("fogInfos"), fog->getStart(), fog->getEnd(), fog->getDensity());
-	glUseProgram(0);
-	const auto prog1 = Resources::manager().getProgram("object_special");
-	glUseProgram(prog1->id());
-	glUniform1i(prog1->uniform("fogEnabled"), 1);
-	glUniform1i(prog1->uniform("fogMode"), int(fog->getType()));
-	glUniform3f(prog1->uniform("fogColor"), fog->getColor().r, fog->getColor().g, fog->getColor().b);
-	glUniform3f(prog1->uniform("fogInfos"), fog->getStart(), fog->getEnd(), fog->getDensity());
+	for(const auto & name : kObjectPrograms){
+		const auto prog = Resources::manager().getProgram(name);
+		glUseProgram(prog->id());
+		glUniform1i(prog->uniform("fogEnabled"), 1);
+		glUniform1i(prog->uniform("fogMode"), int(fog->getType()));
+		glUniform3f(prog->uniform("fogColor"), fog->getColor().r, fog->getColor().g, fog->getColor().b);
+		glUniform3f(prog->uniform("fogInfos"), fog->getStart(), fog->getEnd(), fog->getDensity());
+	}
 	glUseProgram(0);
 }
+
+std::string Renderer::selectedObjectName(){
+	return _objectId >= 0 && size_t(_objectId) < _age->objects().size() ? _age->objects()[_objectId]->getName() : "";
+}
+
+std::string Renderer::selectedTextureName(){
+	return _textureId >= 0 && size_t(_textureId) < _age->textures().size() ? _age->textures()[_textureId] : "";
+}
+
+void Renderer::restoreSelection(const std::string & objectName, const std::string & textureName){
+	const auto & objects = _age->objects();
+	for(size_t oid = 0; oid < objects.size() && !objectName.empty(); ++oid){
+		if(objects[oid]->getName() == objectName){
+			_objectId = int(oid);
+			break;
+		}
+	}
+	const auto & textures = _age->textures();
+	const auto texture = std::find(textures.begin(), textures.end(), textureName);
+	if(!textureName.empty() && texture != textures.end()){
+		_textureId = int(texture - textures.begin());
+	}
+}
+
+void Renderer::evictAges(){
+	const size_t budget = size_t(_config.ageBudget) * 1024 * 1024;
+	size_t total = 0;
+	for(const auto & age : _residentAges){
+		total += age->gpuSize();
+	}
+	while(total > budget && _residentAges.size() > 1){
+		const std::shared_ptr<Age> age = _residentAges.back();
+		Log::Info() << "Releasing " << age->getName() << " to stay within the age budget." << std::endl;
+		total -= (std::min)(total, age->gpuSize());
+		age->release();
+		_residentAges.pop_back();
+	}
+}
+
 void Renderer::update(){
 	if(Input::manager().resized()){
 		resize((int)Input::manager().size()[0], (int)Input::manager().size()[1]);
 	}
 	
+	// Swap to the new age once its linking points are known and pages start coming in.
+	if(_loadingAge && _loadingAge->ready()){
+		const std::shared_ptr<Age> age = _loadingAge;
+		_loadingAge.reset();
+		setupAge(age);
+	}
+	// Pages evicted and uploaded change the lists of objects and textures, keep the same selection.
+	const std::string selectedObject = selectedObjectName();
+	const std::string selectedTexture = selectedTextureName();
+	const size_t residentPages = _age->residentPages();
+	// Load and evict pages around the camera.
+	_age->stream(_camera.getPosition());
+	// Upload converted pages, spreading the work over frames when loading in the background.
+	const size_t uploadedPages = _age->uploadPages(_config.backgroundLoad ? 0.005 : std::numeric_limits<double>::max());
+	if(uploadedPages > 0 || residentPages != _age->residentPages()){
+		restoreSelection(selectedObject, selectedTexture);
+	}
+	// Upload the textures requested while drawing the previous frame, placeholders are used in the meantime.
+	const size_t uploadedTextures = Resources::manager().uploadRequestedTextures(0.005);
+	// The current age grows as it is uploaded, older ages might not fit anymore.
+	if(uploadedPages + uploadedTextures > 0 && _residentAges.size() > 1){
+		evictAges();
+	}
+	
 	if(_displayMode != OneTexture){
 		_camera.update();
 	}
@@ -535,6 +739,26 @@ void Renderer::physics(double fullTime, double frameTime){
 	if(_displayMode != OneTexture){
 		_camera.physics(frameTime);
 	}
+	if(!_flyThrough){
+		return;
+	}
+	// Turn around each linking point in turn, independently of the frame time so that runs are comparable.
+	const size_t kFlyFramesPerPoint = 120;
+	const auto & names = _age->linkingNames();
+	const size_t pointId = _flyFrame / kFlyFramesPerPoint;
+	if(pointId >= names.size()){
+		const double frames = double((std::max)(_flyFrame, size_t(1)));
+		const double ratio = _flySubmitted > 0 ? 100.0 * double(_flyDrawn) / double(_flySubmitted) : 100.0;
+		Log::Info() << "Fly-through: " << _flyFrame << " frames, " << (double(_flySubmitted) / frames / 1000.0) << "k triangles submitted and "
+			<< (double(_flyDrawn) / frames / 1000.0) << "k drawn per frame (" << ratio << "%)." << std::endl;
+		_flyThrough = false;
+		return;
+	}
+	const glm::vec3 & point = _age->linkingPoints().at(names[pointId]);
+	const float angle = 2.0f * float(M_PI) * float(_flyFrame % kFlyFramesPerPoint) / float(kFlyFramesPerPoint);
+	const glm::vec3 eye = point + glm::vec3(0.0f, 6.0f, 0.0f);
+	_camera.lookAt(eye, eye + glm::vec3(std::cos(angle), 0.0f, std::sin(angle)));
+	++_flyFrame;
 }
 
 /// Clean function
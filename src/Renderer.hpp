@@ -9,6 +9,8 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <memory>
+#include <set>
+#include <list>
 
 
 
@@ -45,6 +47,10 @@ protected:
 private:
 	
 	std::shared_ptr<Age> _age;
+	/// Age being loaded, the current one is displayed until it is ready.
+	std::shared_ptr<Age> _loadingAge;
+	/// Ages kept on the GPU for instant switching, the most recently displayed first.
+	std::list<std::shared_ptr<Age>> _residentAges;
 	ScreenQuad _quad;
 	ScreenQuad _fxaaquad;
 	Camera _camera;
@@ -55,6 +61,24 @@ private:
 	bool _doCulling = true;
 	float _cullingDistance = 1500.0f;
 	int _drawCount = 0;
+	size_t _partCount = 0;
+	size_t _triangleCount = 0;
+	/// Material layers are evaluated together in a single draw where possible.
+	bool _compositeLayers = true;
+	size_t _passCount = 0;
+	/// Simplified meshes are drawn while their error stays below _lodThreshold pixels.
+	bool _useLods = true;
+	bool _showLods = false;
+	float _lodThreshold = 1.0f;
+	/// Large subobjects are drawn meshlet by meshlet, skipping the ones off-screen or facing away.
+	bool _cullMeshlets = true;
+	size_t _visibleTriangleCount = 0;
+	/// Scripted camera path, turning around each linking point, to compare culling settings.
+	bool _flyThrough = false;
+	size_t _flyFrame = 0;
+	size_t _flySubmitted = 0;
+	size_t _flyDrawn = 0;
+	size_t _vertexArrayBinds = 0;
 	bool _forceLighting;
 	bool _forceNoLighting;
 	float _cameraFarPlane;
@@ -72,9 +96,18 @@ private:
 	int _textureId = 0;
 	int _subObjectId = -1;
 	int _subLayerId = -1;
+	/// Pages of the current age to load next.
+	std::set<std::string> _selectedPages;
 	
 	void defaultGLSetup();
 	void loadAge(const std::string & path);
+	void setupAge(const std::shared_ptr<Age> & age);
+	/// Release the least recently displayed ages until the resident ones fit in the budget.
+	void evictAges();
+	std::string selectedObjectName();
+	std::string selectedTextureName();
+	/// Select again the object and texture with the given names, if still present.
+	void restoreSelection(const std::string & objectName, const std::string & textureName);
 };
 
 #endif
@@ -1,5 +1,6 @@
 #include "ScreenQuad.hpp"
 #include "resources/ResourcesManager.hpp"
+#include "helpers/Profiler.hpp"
 
 #include <stdio.h>
 #include <vector>
@@ -69,13 +70,14 @@ void ScreenQuad::loadGeometry(){
 	// Generate an empty VAO (imposed by the OpenGL spec).
 	_vao = 0;
 	glGenVertexArrays (1, &_vao);
-	glBindVertexArray(_vao);
+	GLUtilities::bindVertexArray(_vao);
 
-	glBindVertexArray(0);
+	GLUtilities::bindVertexArray(0);
 	
 }
 
 void ScreenQuad::draw() const {
+	PROFILE_ZONE("ScreenQuad::draw");
 	
 	// Select the program (and shaders).
 	glUseProgram(_program->id());
@@ -87,10 +89,10 @@ void ScreenQuad::draw() const {
 	}
 	
 	// Draw with an empty VAO (mandatory)
-	glBindVertexArray(_vao);
+	GLUtilities::bindVertexArray(_vao);
 	glDrawArrays(GL_TRIANGLES, 0, 3);
 	
-	glBindVertexArray(0);
+	GLUtilities::bindVertexArray(0);
 	glUseProgram(0);
 }
 
@@ -116,10 +118,10 @@ void ScreenQuad::draw(const GLuint textureId) const {
 	glBindTexture(GL_TEXTURE_2D, textureId);
 	
 	// Draw with an empty VAO (mandatory)
-	glBindVertexArray(_vao);
+	GLUtilities::bindVertexArray(_vao);
 	glDrawArrays(GL_TRIANGLES, 0, 3);
 	
-	glBindVertexArray(0);
+	GLUtilities::bindVertexArray(0);
 	glUseProgram(0);
 }
 
@@ -138,7 +140,7 @@ void ScreenQuad::draw(const GLuint textureId, const glm::vec2& invScreenSize) co
 
 
 void ScreenQuad::clean() const {
-	glDeleteVertexArrays(1, &_vao);
+	GLUtilities::deleteVertexArray(_vao);
 }
 
 
@@ -0,0 +1,53 @@
+#include "Arena.hpp"
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+
+static std::atomic<Arena::AllocationHook> allocationHook(nullptr);
+
+/// Offset of the first address after data + offset aligned on alignment.
+static size_t alignedOffset(const unsigned char * data, size_t offset, size_t alignment){
+	const uintptr_t address = uintptr_t(data) + offset;
+	const uintptr_t aligned = (address + alignment - 1) & ~uintptr_t(alignment - 1);
+	return offset + size_t(aligned - address);
+}
+
+Arena::Arena(size_t blockSize) : _blockSize(blockSize) {
+}
+
+void * Arena::allocate(size_t size, size_t alignment){
+	if(size == 0){
+		return nullptr;
+	}
+	if(!_blocks.empty()){
+		Block & block = _blocks.back();
+		const size_t start = alignedOffset(block.data.get(), _offset, alignment);
+		if(start + size <= block.size){
+			_offset = start + size;
+			_used += size;
+			return block.data.get() + start;
+		}
+	}
+	// The rest of the current block is lost, requests are mostly large arrays.
+	const size_t blockSize = (std::max)(_blockSize, size + alignment);
+	_blocks.push_back({std::unique_ptr<unsigned char[]>(new unsigned char[blockSize]), blockSize});
+	const AllocationHook hook = allocationHook.load();
+	if(hook){
+		hook(blockSize);
+	}
+	Block & block = _blocks.back();
+	const size_t start = alignedOffset(block.data.get(), 0, alignment);
+	_offset = start + size;
+	_used += size;
+	return block.data.get() + start;
+}
+
+void Arena::clear(){
+	_blocks.clear();
+	_offset = 0;
+	_used = 0;
+}
+
+void Arena::setAllocationHook(AllocationHook hook){
+	allocationHook.store(hook);
+}
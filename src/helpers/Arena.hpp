@@ -0,0 +1,62 @@
+#ifndef Arena_h
+#define Arena_h
+
+#include <vector>
+#include <memory>
+#include <type_traits>
+#include <cstddef>
+
+/// Bump allocator: allocations are carved from large blocks, and all released at once.
+/// Not thread-safe, each page is converted in its own arena.
+class Arena {
+public:
+
+	/// Called with the size of each block allocated on the heap, by any arena.
+	typedef void (*AllocationHook)(size_t size);
+
+	/// Requests larger than blockSize get their own block.
+	explicit Arena(size_t blockSize = size_t(1) << 20);
+
+	/// Uninitialized storage for count elements, nullptr if count is 0. Destructors are never called.
+	template<typename T> T * allocate(size_t count){
+		static_assert(std::is_trivially_destructible<T>::value, "Arena elements are never destroyed.");
+		return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+	}
+
+	/// Uninitialized storage of size bytes, alignment must be a power of two.
+	void * allocate(size_t size, size_t alignment);
+
+	/// Release all the blocks, the pointers returned until now are invalid.
+	void clear();
+
+	/// Bytes handed out since the last clear.
+	size_t used() const {
+		return _used;
+	}
+
+	/// Number of heap blocks currently held.
+	size_t blockCount() const {
+		return _blocks.size();
+	}
+
+	/// Observe the heap allocations of all arenas, nullptr to stop.
+	static void setAllocationHook(AllocationHook hook);
+
+	Arena(const Arena &) = delete;
+	Arena & operator=(const Arena &) = delete;
+
+private:
+
+	struct Block {
+		std::unique_ptr<unsigned char[]> data;
+		size_t size;
+	};
+
+	std::vector<Block> _blocks;
+	size_t _blockSize;
+	/// Offset of the free space in the last block.
+	size_t _offset = 0;
+	size_t _used = 0;
+};
+
+#endif
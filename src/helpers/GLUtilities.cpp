@@ -1,6 +1,7 @@
 #include "GLUtilities.hpp"
 #include "../resources/ImageUtilities.hpp"
 #include "Logger.hpp"
+#include "VertexUtilities.hpp"
 #include <PRP/Surface/plBitmap.h>
 #include <vector>
 #include <algorithm>
@@ -132,7 +133,7 @@ GLuint GLUtilities::createProgram(const std::string & vertexContent, const std::
 	return id;
 }
 
-TextureInfos GLUtilities::loadTexture(const plMipmap * textureData){
+TextureInfos GLUtilities::loadTexture(const plMipmap * textureData, const MipChain * chain){
 	TextureInfos infos;
 	infos.cubemap = false;
 	infos.hdr = false;
@@ -144,7 +145,9 @@ TextureInfos GLUtilities::loadTexture(const plMipmap * textureData){
 	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
 	
 	// Set proper max mipmap level.
-	unsigned int mipmapCount = textureData->getNumLevels();
+	// Only the top level of decoded textures is valid, the others come from the chain.
+	const bool decoded = TextureUtilities::isDecoded(textureData);
+	unsigned int mipmapCount = decoded ? (1 + (chain ? (unsigned int)chain->levels.size() : 0)) : textureData->getNumLevels();
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, mipmapCount == 1 ? 1000 : (mipmapCount-1));
 	
 	// Texture settings.
@@ -173,23 +176,36 @@ TextureInfos GLUtilities::loadTexture(const plMipmap * textureData){
 			// Magic formula for DXT miplevel size.
 			unsigned int mipmapSize = ((textureData->getLevelHeight(mipid)+3)/4)*((textureData->getLevelWidth(mipid)+3)/4)*int(textureData->getDXBlockSize());
 			glCompressedTexImage2D(GL_TEXTURE_2D, mipid, format,  textureData->getLevelWidth(mipid), textureData->getLevelHeight(mipid), 0,  mipmapSize, textureData->getLevelData(mipid));
+			infos.size += mipmapSize;
+		}
+	} else if(decoded){
+		// JPEG and PNG are always decoded to 32 bits BGRA.
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, textureData->getLevelWidth(0), textureData->getLevelHeight(0), 0, GL_BGRA, GL_UNSIGNED_BYTE, textureData->getLevelData(0));
+		infos.size += 4 * textureData->getLevelWidth(0) * textureData->getLevelHeight(0);
+		for(unsigned int mipid = 1; mipid < mipmapCount; ++mipid){
+			const MipChain::Level & level = chain->levels[mipid - 1];
+			glTexImage2D(GL_TEXTURE_2D, mipid, GL_RGBA, level.width, level.height, 0, GL_BGRA, GL_UNSIGNED_BYTE, level.pixels.data());
+			infos.size += level.pixels.size();
 		}
 	} else {
 		// Regular format.
-		// TODO: check PNG and other are handled correctly.
 		const unsigned short bflags = textureData->getARGBType();
 		const GLenum format = (bflags == plBitmap::kInten8) ? GL_RED : (bflags == plBitmap::kAInten88 ? GL_RG : GL_BGRA);
 		const GLenum type = GL_UNSIGNED_BYTE;
 		const GLenum preciseFormat = (bflags == plBitmap::kInten8) ? GL_RED : (bflags == plBitmap::kAInten88 ? GL_RG : GL_RGBA);
+		const size_t channels = (bflags == plBitmap::kInten8) ? 1 : (bflags == plBitmap::kAInten88 ? 2 : 4);
 		
 		for(unsigned int mipid = 0; mipid < mipmapCount; ++mipid){
 			glTexImage2D(GL_TEXTURE_2D, mipid, preciseFormat, textureData->getLevelWidth(mipid), textureData->getLevelHeight(mipid), 0, format, type, textureData->getLevelData(mipid));
+			infos.size += channels * textureData->getLevelWidth(mipid) * textureData->getLevelHeight(mipid);
 		}
 		
 	}
 	// If only level 0 was given, generate mipmaps pyramid automatically.
 	if(mipmapCount == 1){
 		glGenerateMipmap(GL_TEXTURE_2D);
+		// The pyramid adds a third.
+		infos.size += infos.size / 3;
 	}
 	checkGLError();
 	
@@ -213,7 +229,8 @@ TextureInfos GLUtilities::loadCubemap(plCubicEnvironmap* textureData){
 	glBindTexture(GL_TEXTURE_CUBE_MAP, textureId);
 	
 	// Set proper max mipmap level.
-	unsigned int mipmapCount = textureData->getFace(0)->getNumLevels();
+	// Only the top level of decoded faces is valid, the pyramid is generated.
+	unsigned int mipmapCount = TextureUtilities::isDecoded(textureData->getFace(0)) ? 1 : textureData->getFace(0)->getNumLevels();
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, mipmapCount == 1 ? 1000 : (mipmapCount-1));
 	
 	// Texture settings.
@@ -249,6 +266,7 @@ TextureInfos GLUtilities::loadCubemap(plCubicEnvironmap* textureData){
 				// Magic formula for DXT miplevel size.
 				unsigned int mipmapSize = ((textureFace->getLevelHeight(mipid)+3)/4)*((textureFace->getLevelWidth(mipid)+3)/4)*int(textureFace->getDXBlockSize());
 				glCompressedTexImage2D(GLenum(GL_TEXTURE_CUBE_MAP_POSITIVE_X + cubemapTable[side]), mipid, format,  textureFace->getLevelWidth(mipid), textureFace->getLevelHeight(mipid), 0,  mipmapSize, textureFace->getLevelData(mipid));
+				infos.size += mipmapSize;
 			}
 		}
 	} else {
@@ -258,10 +276,12 @@ TextureInfos GLUtilities::loadCubemap(plCubicEnvironmap* textureData){
 		const GLenum format = (bflags == plBitmap::kInten8) ? GL_RED : (bflags == plBitmap::kAInten88 ? GL_RG : GL_RGBA);
 		const GLenum type = GL_UNSIGNED_BYTE;
 		const GLenum preciseFormat = format;
+		const size_t channels = (bflags == plBitmap::kInten8) ? 1 : (bflags == plBitmap::kAInten88 ? 2 : 4);
 		for(size_t side = 0; side < plCubicEnvironmap::kNumFaces; ++side){
 			const plMipmap * textureFace = textureData->getFace(side);
 			for(unsigned int mipid = 0; mipid < mipmapCount; ++mipid){
 				glTexImage2D(GLenum(GL_TEXTURE_CUBE_MAP_POSITIVE_X + cubemapTable[side]), mipid, preciseFormat, textureFace->getLevelWidth(mipid), textureFace->getLevelHeight(mipid), 0, format, type, textureFace->getLevelData(mipid));
+				infos.size += channels * textureFace->getLevelWidth(mipid) * textureFace->getLevelHeight(mipid);
 			}
 		}
 		
@@ -269,6 +289,7 @@ TextureInfos GLUtilities::loadCubemap(plCubicEnvironmap* textureData){
 	// If only level 0 was given, generate mipmaps pyramid automatically.
 	if(mipmapCount == 1){
 		glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+		infos.size += infos.size / 3;
 	}
 	checkGLError();
 	
@@ -418,106 +439,111 @@ TextureInfos GLUtilities::loadTextureCubemap(const std::vector<std::vector<std::
 
 
 MeshInfos GLUtilities::setupBuffers(const Mesh & mesh){
+	return setupBuffers(MeshView(mesh));
+}
+
+MeshInfos GLUtilities::setupBuffers(const MeshView & mesh){
 	MeshInfos infos;
-	GLuint vbo = 0;
-	GLuint vbo_nor = 0;
-	GLuint vbo_color = 0;
-	std::vector<GLuint> vbo_uvs;
 	
-	// Create an array buffer to host the geometry data.
-	if(mesh.positions.size() > 0){
+	// All attributes are interleaved in a single array buffer.
+	const VertexUtilities::Layout layout = VertexUtilities::layout(mesh);
+	GLuint vbo = 0;
+	if(layout.stride > 0 && mesh.vertexCount > 0){
+		std::vector<unsigned char> vertices(layout.stride * mesh.vertexCount);
+		VertexUtilities::interleave(mesh, layout, vertices.data());
 		glGenBuffers(1, &vbo);
 		glBindBuffer(GL_ARRAY_BUFFER, vbo);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * mesh.positions.size() * 3, &(mesh.positions[0]), GL_STATIC_DRAW);
-	}
-	
-	if(mesh.normals.size() > 0){
-		glGenBuffers(1, &vbo_nor);
-		glBindBuffer(GL_ARRAY_BUFFER, vbo_nor);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * mesh.normals.size() * 3, &(mesh.normals[0]), GL_STATIC_DRAW);
-	}
-	
-	if(mesh.colors.size() > 0){
-		glGenBuffers(1, &vbo_color);
-		glBindBuffer(GL_ARRAY_BUFFER, vbo_color);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(unsigned char) * mesh.colors.size() * 4, &(mesh.colors[0]), GL_STATIC_DRAW);
-	}
-	
-	for(const auto & texcoords : mesh.texcoords){
-		GLuint vbo_uv = 0;
-		if(texcoords.size() > 0){
-			glGenBuffers(1, &vbo_uv);
-			glBindBuffer(GL_ARRAY_BUFFER, vbo_uv);
-			glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * texcoords.size() * 3, &(texcoords[0]), GL_STATIC_DRAW);
-			vbo_uvs.push_back(vbo_uv);
-		}
+		glBufferData(GL_ARRAY_BUFFER, vertices.size(), vertices.data(), GL_STATIC_DRAW);
 	}
 	
-	
-//
-//	if(mesh.binormals.size() > 0){
-//		glGenBuffers(1, &vbo_binor);
-//		glBindBuffer(GL_ARRAY_BUFFER, vbo_binor);
-//		glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * mesh.binormals.size() * 3, &(mesh.binormals[0]), GL_STATIC_DRAW);
-//	}
-	
 	// Generate a vertex array.
 	GLuint vao = 0;
 	glGenVertexArrays (1, &vao);
-	glBindVertexArray(vao);
+	bindVertexArray(vao);
 	
-	// Setup attributes.
-	int currentAttribute = 0;
 	if(vbo > 0){
-		glEnableVertexAttribArray(currentAttribute);
-		glBindBuffer(GL_ARRAY_BUFFER, vbo);
-		glVertexAttribPointer(currentAttribute, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-		++currentAttribute;
-	}
-	if(vbo_nor > 0){
-		glEnableVertexAttribArray(currentAttribute);
-		glBindBuffer(GL_ARRAY_BUFFER, vbo_nor);
-		glVertexAttribPointer(currentAttribute, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-		++currentAttribute;
-	}
-	
-	if(vbo_color > 0){
-		glEnableVertexAttribArray(currentAttribute);
-		glBindBuffer(GL_ARRAY_BUFFER, vbo_color);
-		glVertexAttribPointer(currentAttribute, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, NULL);
-		++currentAttribute;
+		setupAttributes(layout);
 	}
 	
-	for(const auto vbo_uv : vbo_uvs){
-		if(vbo_uv > 0){
-			glEnableVertexAttribArray(currentAttribute);
-			glBindBuffer(GL_ARRAY_BUFFER, vbo_uv);
-			glVertexAttribPointer(currentAttribute, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-			++currentAttribute;
-		}
-	}
-//	if(vbo_binor > 0){
-//		glEnableVertexAttribArray(currentAttribute);
-//		glBindBuffer(GL_ARRAY_BUFFER, vbo_binor);
-//		glVertexAttribPointer(currentAttribute, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-//		++currentAttribute;
-//	}
-	
-	// We load the indices data
+	// We load the indices data, on 16 bits when possible.
+	const bool shortIndices = VertexUtilities::fitsShortIndices(mesh.indices, mesh.indexCount);
 	GLuint ebo = 0;
 	glGenBuffers(1, &ebo);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * mesh.indices.size(), &(mesh.indices[0]), GL_STATIC_DRAW);
+	if(shortIndices){
+		const std::vector<GLushort> indices(mesh.indices, mesh.indices + mesh.indexCount);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * mesh.indexCount, indices.data(), GL_STATIC_DRAW);
+	} else {
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * mesh.indexCount, mesh.indices, GL_STATIC_DRAW);
+	}
 	
-	glBindVertexArray(0);
+	bindVertexArray(0);
+	
+	// Keep track of the buffers to be able to release them.
+	if(vbo > 0){
+		infos.buffers.push_back(vbo);
+	}
+	infos.buffers.push_back(ebo);
+	infos.indexType = shortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	infos.size = (shortIndices ? sizeof(GLushort) : sizeof(GLuint)) * mesh.indexCount + layout.stride * mesh.vertexCount;
 	
 	infos.vId = vao;
 	infos.eId = ebo;
-	infos.count = (GLsizei)mesh.indices.size();
+	infos.count = (GLsizei)mesh.indexCount;
 	infos.uvCount = mesh.texcoords.size();
 	return infos;
 }
 
+void GLUtilities::setupAttributes(const VertexUtilities::Layout & layout){
+	// Locations expected by the object shaders.
+	const GLsizei stride = GLsizei(layout.stride);
+	if(layout.positions){
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)layout.positionOffset);
+	}
+	if(layout.normals){
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, stride, (void*)layout.normalOffset);
+	}
+	if(layout.colors){
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void*)layout.colorOffset);
+	}
+	GLuint currentAttribute = 3;
+	for(const auto & uv : layout.uvs){
+		glEnableVertexAttribArray(currentAttribute);
+		glVertexAttribPointer(currentAttribute, GLint(uv.components), uv.half ? GL_HALF_FLOAT : GL_FLOAT, GL_FALSE, stride, (void*)uv.offset);
+		++currentAttribute;
+	}
+}
+
+GLuint GLUtilities::_boundVertexArray = 0;
+
+size_t GLUtilities::_vertexArrayBinds = 0;
+
+void GLUtilities::bindVertexArray(GLuint vao){
+	if(vao == _boundVertexArray){
+		return;
+	}
+	glBindVertexArray(vao);
+	_boundVertexArray = vao;
+	++_vertexArrayBinds;
+}
+
+void GLUtilities::deleteVertexArray(GLuint vao){
+	// Ids are reused, a new array with the same id would otherwise never be bound.
+	if(vao == _boundVertexArray){
+		_boundVertexArray = 0;
+	}
+	glDeleteVertexArrays(1, &vao);
+}
+
+size_t GLUtilities::resetVertexArrayBinds(){
+	const size_t binds = _vertexArrayBinds;
+	_vertexArrayBinds = 0;
+	return binds;
+}
+
 void GLUtilities::saveDefaultFramebuffer(const unsigned int width, const unsigned int height, const std::string & path){
 	
 	GLint currentBoundFB = 0;
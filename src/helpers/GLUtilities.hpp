@@ -6,6 +6,8 @@
 
 #include "../resources/MeshUtilities.hpp"
 #include "../Framebuffer.hpp"
+#include "TextureUtilities.hpp"
+#include "VertexUtilities.hpp"
 #include <PRP/Surface/plMipmap.h>
 #include <PRP/Surface/plCubicEnvironmap.h>
 #include <gl3w/gl3w.h>
@@ -32,7 +34,9 @@ struct TextureInfos {
 	int mipmap;
 	bool cubemap;
 	bool hdr;
-	TextureInfos() : id(0), width(0), height(0), mipmap(0), cubemap(false), hdr(false) {}
+	/// Approximate GPU memory used, in bytes.
+	size_t size;
+	TextureInfos() : id(0), width(0), height(0), mipmap(0), cubemap(false), hdr(false), size(0) {}
 
 };
 
@@ -158,11 +162,28 @@ struct MeshInfos {
 	GLuint vId;
 	GLuint eId;
 	GLsizei count;
+	/// GL_UNSIGNED_SHORT when all indices fit, else GL_UNSIGNED_INT.
+	GLenum indexType;
+	/// Range drawn when the mesh is a part of a shared buffer.
+	size_t firstIndex;
+	GLint baseVertex;
 	size_t uvCount;
 	BoundingBox bbox;
 	glm::vec3 centroid;
-	
-	MeshInfos() : vId(0), eId(0), count(0), uvCount(0), bbox(glm::vec3(0.0f), glm::vec3(0.0f)), centroid(0.0f) {}
+	/// All buffers referenced by the vertex array, elements included.
+	std::vector<GLuint> buffers;
+	/// GPU memory used, in bytes.
+	size_t size;
+	/// Packed in the shared buffers of a pool, buffers is then empty and the arrays are not owned.
+	bool pooled;
+	size_t poolId;
+	
+	MeshInfos() : vId(0), eId(0), count(0), indexType(GL_UNSIGNED_INT), firstIndex(0), baseVertex(0), uvCount(0), bbox(glm::vec3(0.0f), glm::vec3(0.0f)), centroid(0.0f), size(0), pooled(false), poolId(0) {}
+	
+	/// Offset of the first index drawn in the elements buffer.
+	const void * indexOffset() const {
+		return (const void*)((indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint)) * firstIndex);
+	}
 
 };
 
@@ -175,6 +196,10 @@ private:
 	
 	static void savePixels(const GLenum type, const GLenum format, const unsigned int width, const unsigned int height, const unsigned int components, const std::string & path, const bool flip, const bool ignoreAlpha);
 	
+	static GLuint _boundVertexArray;
+	
+	static size_t _vertexArrayBinds;
+	
 public:
 	
 	// Program setup.
@@ -182,7 +207,8 @@ public:
 	static GLuint createProgram(const std::string & vertexContent, const std::string & fragmentContent);
 	
 	// Texture loading.
-	static TextureInfos  loadTexture(const plMipmap * textureData);
+	/// JPEG and PNG mipmaps use the levels of chain if given, else the pyramid is generated from their top level.
+	static TextureInfos  loadTexture(const plMipmap * textureData, const MipChain * chain = nullptr);
 	
 	static TextureInfos loadCubemap(plCubicEnvironmap* textureData);
 	/// 2D texture.
@@ -194,6 +220,21 @@ public:
 	// Mesh loading.
 	static MeshInfos setupBuffers(const Mesh & mesh);
 	
+	/// Upload mesh data that doesn't have to be owned by a Mesh.
+	static MeshInfos setupBuffers(const MeshView & mesh);
+	
+	/// Enable and describe the attributes of layout, read from the buffer bound to GL_ARRAY_BUFFER, in the bound vertex array.
+	static void setupAttributes(const VertexUtilities::Layout & layout);
+	
+	/// Bind a vertex array, skipped if it is already bound. All vertex array binds should go through this.
+	static void bindVertexArray(GLuint vao);
+	
+	/// Delete a vertex array, forgetting it if it is bound.
+	static void deleteVertexArray(GLuint vao);
+	
+	/// Number of vertex array binds issued since the last call.
+	static size_t resetVertexArrayBinds();
+	
 	// Framebuffer saving to disk.
 	static void saveFramebuffer(const std::shared_ptr<Framebuffer> & framebuffer, const unsigned int width, const unsigned int height, const std::string & path, const bool flip = true, const bool ignoreAlpha = false);
 	
@@ -0,0 +1,20 @@
+#ifndef HashUtilities_h
+#define HashUtilities_h
+
+#include <cstddef>
+#include <cstdint>
+
+class HashUtilities {
+
+public:
+
+	/// XXH64 of size bytes, stable across runs and platforms. Chain calls by passing the previous hash as seed.
+	static uint64_t hash(const void * data, size_t size, uint64_t seed = 0);
+
+	template<typename T> static uint64_t hashValue(const T & value, uint64_t seed){
+		return hash(&value, sizeof(T), seed);
+	}
+
+};
+
+#endif
@@ -0,0 +1,675 @@
+#include "IndexUtilities.hpp"
+#include "HashUtilities.hpp"
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+
+bool IndexUtilities::isValid(const IndexRange & range, size_t vertexCount){
+	if(range.count % 3 != 0){
+		return false;
+	}
+	for(size_t iid = 0; iid < range.count; ++iid){
+		if(range.indices[iid] >= vertexCount){
+			return false;
+		}
+	}
+	return true;
+}
+
+IndexUtilities::CacheStats IndexUtilities::analyzeCache(const IndexRange & range, size_t vertexCount, size_t cacheSize){
+	CacheStats stats;
+	stats.triangles = range.count / 3;
+	stats.vertices = vertexCount;
+	// A vertex is in the FIFO if less than cacheSize vertices have been transformed since its own transformation.
+	std::vector<size_t> stamps(vertexCount, 0);
+	size_t time = cacheSize + 1;
+	for(size_t iid = 0; iid < range.count; ++iid){
+		const unsigned int vid = range.indices[iid];
+		if(time - stamps[vid] > cacheSize){
+			stamps[vid] = time++;
+			++stats.transformed;
+		}
+	}
+	return stats;
+}
+
+static uint64_t hashVertex(const MeshView & mesh, size_t vid){
+	uint64_t hash = 0;
+	if(mesh.positions){
+		hash = HashUtilities::hashValue(mesh.positions[vid], hash);
+	}
+	if(mesh.normals){
+		hash = HashUtilities::hashValue(mesh.normals[vid], hash);
+	}
+	if(mesh.colors){
+		hash = HashUtilities::hashValue(mesh.colors[vid], hash);
+	}
+	for(const auto & texcoords : mesh.texcoords){
+		if(texcoords){
+			hash = HashUtilities::hashValue(texcoords[vid], hash);
+		}
+	}
+	return hash;
+}
+
+static bool sameVertex(const MeshView & mesh, size_t left, size_t right){
+	if(mesh.positions && std::memcmp(&mesh.positions[left], &mesh.positions[right], sizeof(glm::vec3)) != 0){
+		return false;
+	}
+	if(mesh.normals && std::memcmp(&mesh.normals[left], &mesh.normals[right], sizeof(glm::vec3)) != 0){
+		return false;
+	}
+	if(mesh.colors && std::memcmp(&mesh.colors[left], &mesh.colors[right], sizeof(glm::u8vec4)) != 0){
+		return false;
+	}
+	for(const auto & texcoords : mesh.texcoords){
+		if(texcoords && std::memcmp(&texcoords[left], &texcoords[right], sizeof(glm::vec3)) != 0){
+			return false;
+		}
+	}
+	return true;
+}
+
+size_t IndexUtilities::weldVertices(const MeshView & mesh, size_t first, size_t vertexCount, std::vector<unsigned int> & remap){
+	remap.resize(vertexCount);
+	// Only the first vertex with a given hash is kept, a collision between different vertices only misses a weld.
+	std::unordered_map<uint64_t, unsigned int> firsts;
+	firsts.reserve(vertexCount);
+	size_t distinct = 0;
+	for(size_t vid = 0; vid < vertexCount; ++vid){
+		const auto existing = firsts.emplace(hashVertex(mesh, first + vid), (unsigned int)vid);
+		if(!existing.second && sameVertex(mesh, first + existing.first->second, first + vid)){
+			remap[vid] = existing.first->second;
+			continue;
+		}
+		remap[vid] = (unsigned int)vid;
+		++distinct;
+	}
+	return distinct;
+}
+
+void IndexUtilities::optimizeCache(const IndexRange & range, size_t vertexCount, std::vector<size_t> & clusters, size_t cacheSize){
+	clusters.clear();
+	const size_t triangleCount = range.count / 3;
+	if(triangleCount == 0){
+		return;
+	}
+	const unsigned int * indices = range.indices;
+
+	// Triangles using each vertex.
+	std::vector<unsigned int> offsets(vertexCount + 1, 0);
+	for(size_t iid = 0; iid < range.count; ++iid){
+		++offsets[indices[iid] + 1];
+	}
+	for(size_t vid = 0; vid < vertexCount; ++vid){
+		offsets[vid + 1] += offsets[vid];
+	}
+	std::vector<unsigned int> adjacency(range.count);
+	std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+	for(size_t iid = 0; iid < range.count; ++iid){
+		adjacency[fill[indices[iid]]++] = (unsigned int)(iid / 3);
+	}
+	// Triangles left to emit around each vertex.
+	std::vector<unsigned int> live(vertexCount);
+	for(size_t vid = 0; vid < vertexCount; ++vid){
+		live[vid] = offsets[vid + 1] - offsets[vid];
+	}
+
+	std::vector<size_t> stamps(vertexCount, 0);
+	size_t time = cacheSize + 1;
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<unsigned int> deadEnd;
+	std::vector<unsigned int> candidates;
+	std::vector<unsigned int> output;
+	output.reserve(triangleCount * 3);
+	size_t cursor = 0;
+
+	// Next vertex with triangles left, when the neighbourhood of the current fan is exhausted.
+	auto skipDeadEnd = [&]() -> long long {
+		while(!deadEnd.empty()){
+			const unsigned int vid = deadEnd.back();
+			deadEnd.pop_back();
+			if(live[vid] > 0){
+				return vid;
+			}
+		}
+		while(cursor < vertexCount){
+			if(live[cursor] > 0){
+				return (long long)cursor;
+			}
+			++cursor;
+		}
+		return -1;
+	};
+
+	long long fanning = skipDeadEnd();
+	clusters.push_back(0);
+	while(fanning >= 0){
+		// Emit all the triangles around the fanning vertex.
+		candidates.clear();
+		for(unsigned int aid = offsets[fanning]; aid < offsets[fanning + 1]; ++aid){
+			const unsigned int tid = adjacency[aid];
+			if(emitted[tid]){
+				continue;
+			}
+			for(size_t k = 0; k < 3; ++k){
+				const unsigned int vid = indices[3 * tid + k];
+				output.push_back(vid);
+				deadEnd.push_back(vid);
+				candidates.push_back(vid);
+				--live[vid];
+				if(time - stamps[vid] > cacheSize){
+					stamps[vid] = time++;
+				}
+			}
+			emitted[tid] = true;
+		}
+		// Prefer the oldest candidate that will still be in the cache once all its triangles are emitted.
+		long long best = -1;
+		long long bestPriority = -1;
+		for(const unsigned int vid : candidates){
+			if(live[vid] == 0){
+				continue;
+			}
+			long long priority = 0;
+			if(time - stamps[vid] + 2 * live[vid] <= cacheSize){
+				priority = (long long)(time - stamps[vid]);
+			}
+			if(priority > bestPriority){
+				bestPriority = priority;
+				best = vid;
+			}
+		}
+		if(best < 0){
+			// Dead end, the cache content is mostly lost, this starts a new cluster.
+			best = skipDeadEnd();
+			if(best >= 0){
+				clusters.push_back(output.size() / 3);
+			}
+		}
+		fanning = best;
+	}
+	std::copy(output.begin(), output.end(), range.indices);
+}
+
+void IndexUtilities::optimizeOverdraw(const IndexRange & range, const glm::vec3 * positions, const std::vector<size_t> & clusters){
+	const size_t triangleCount = range.count / 3;
+	if(clusters.size() < 2 || !positions){
+		return;
+	}
+	struct Cluster {
+		size_t start;
+		size_t end;
+		glm::vec3 centroid;
+		glm::vec3 normal;
+		float area;
+		float potential;
+	};
+	std::vector<Cluster> infos(clusters.size());
+	glm::vec3 center(0.0f);
+	float totalArea = 0.0f;
+	for(size_t cid = 0; cid < clusters.size(); ++cid){
+		Cluster & cluster = infos[cid];
+		cluster.start = clusters[cid];
+		cluster.end = cid + 1 < clusters.size() ? clusters[cid + 1] : triangleCount;
+		cluster.centroid = glm::vec3(0.0f);
+		cluster.normal = glm::vec3(0.0f);
+		cluster.area = 0.0f;
+		// Area weighted centroid and normal.
+		for(size_t tid = cluster.start; tid < cluster.end; ++tid){
+			const glm::vec3 & p0 = positions[range.indices[3 * tid + 0]];
+			const glm::vec3 & p1 = positions[range.indices[3 * tid + 1]];
+			const glm::vec3 & p2 = positions[range.indices[3 * tid + 2]];
+			const glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			const float area = glm::length(normal);
+			cluster.centroid += area * (p0 + p1 + p2) / 3.0f;
+			cluster.normal += normal;
+			cluster.area += area;
+		}
+		center += cluster.centroid;
+		totalArea += cluster.area;
+		if(cluster.area > 0.0f){
+			cluster.centroid /= cluster.area;
+		}
+	}
+	if(totalArea <= 0.0f){
+		return;
+	}
+	center /= totalArea;
+	for(auto & cluster : infos){
+		const float length = glm::length(cluster.normal);
+		cluster.potential = length > 0.0f ? glm::dot(cluster.centroid - center, cluster.normal / length) : 0.0f;
+	}
+	std::stable_sort(infos.begin(), infos.end(), [](const Cluster & left, const Cluster & right){
+		return left.potential > right.potential;
+	});
+
+	const std::vector<unsigned int> input(range.indices, range.indices + triangleCount * 3);
+	size_t current = 0;
+	for(const auto & cluster : infos){
+		std::copy(input.begin() + 3 * cluster.start, input.begin() + 3 * cluster.end, range.indices + current);
+		current += 3 * (cluster.end - cluster.start);
+	}
+}
+
+size_t IndexUtilities::optimizeFetch(const std::vector<IndexRange> & ranges, size_t vertexCount, std::vector<unsigned int> & remap){
+	remap.assign(vertexCount, (unsigned int)vertexCount);
+	unsigned int next = 0;
+	for(const auto & range : ranges){
+		for(size_t iid = 0; iid < range.count; ++iid){
+			unsigned int & vid = range.indices[iid];
+			if(remap[vid] == vertexCount){
+				remap[vid] = next++;
+			}
+			vid = remap[vid];
+		}
+	}
+	return next;
+}
+
+template<typename T> static void remapAttribute(T * attribute, size_t first, size_t vertexCount, const std::vector<unsigned int> & remap){
+	if(!attribute){
+		return;
+	}
+	const std::vector<T> input(attribute + first, attribute + first + vertexCount);
+	for(size_t vid = 0; vid < vertexCount; ++vid){
+		if(remap[vid] < vertexCount){
+			attribute[first + remap[vid]] = input[vid];
+		}
+	}
+}
+
+void IndexUtilities::remapVertices(MutableMeshView & mesh, size_t first, size_t vertexCount, const std::vector<unsigned int> & remap){
+	remapAttribute(mesh.positions, first, vertexCount, remap);
+	remapAttribute(mesh.normals, first, vertexCount, remap);
+	remapAttribute(mesh.colors, first, vertexCount, remap);
+	for(auto & texcoords : mesh.texcoords){
+		remapAttribute(texcoords, first, vertexCount, remap);
+	}
+}
+
+/// Sum of squared distances to a set of planes, as the upper half of a symmetric 4x4 matrix.
+struct Quadric {
+	double a[10] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+
+	void addPlane(const glm::dvec3 & n, double d){
+		a[0] += n.x * n.x; a[1] += n.x * n.y; a[2] += n.x * n.z; a[3] += n.x * d;
+		a[4] += n.y * n.y; a[5] += n.y * n.z; a[6] += n.y * d;
+		a[7] += n.z * n.z; a[8] += n.z * d;
+		a[9] += d * d;
+	}
+
+	Quadric & operator+=(const Quadric & other){
+		for(size_t i = 0; i < 10; ++i){
+			a[i] += other.a[i];
+		}
+		return *this;
+	}
+
+	double evaluate(const glm::dvec3 & p) const {
+		const double value = a[0] * p.x * p.x + 2.0 * a[1] * p.x * p.y + 2.0 * a[2] * p.x * p.z + 2.0 * a[3] * p.x
+						   + a[4] * p.y * p.y + 2.0 * a[5] * p.y * p.z + 2.0 * a[6] * p.y
+						   + a[7] * p.z * p.z + 2.0 * a[8] * p.z + a[9];
+		return (std::max)(value, 0.0);
+	}
+};
+
+static glm::dvec3 triangleNormal(const glm::vec3 * positions, unsigned int i0, unsigned int i1, unsigned int i2){
+	const glm::dvec3 p0(positions[i0]);
+	return glm::cross(glm::dvec3(positions[i1]) - p0, glm::dvec3(positions[i2]) - p0);
+}
+
+float IndexUtilities::simplify(const IndexRange & range, const glm::vec3 * positions, size_t vertexCount, size_t targetCount, std::vector<unsigned int> & destination){
+	destination.assign(range.indices, range.indices + range.count);
+	double maxCost = 0.0;
+
+	// Unweighted plane quadrics, so that costs are squared distances.
+	std::vector<Quadric> quadrics(vertexCount);
+	for(size_t iid = 0; iid + 2 < destination.size(); iid += 3){
+		const unsigned int * tri = &destination[iid];
+		const glm::dvec3 normal = triangleNormal(positions, tri[0], tri[1], tri[2]);
+		const double length = glm::length(normal);
+		if(length <= 0.0){
+			continue;
+		}
+		const glm::dvec3 n = normal / length;
+		const double d = -glm::dot(n, glm::dvec3(positions[tri[0]]));
+		for(size_t k = 0; k < 3; ++k){
+			quadrics[tri[k]].addPlane(n, d);
+		}
+	}
+
+	// Edges without an opposite half-edge are borders, their vertices are locked.
+	std::vector<bool> locked(vertexCount, false);
+	{
+		std::unordered_map<uint64_t, unsigned int> halfEdges;
+		halfEdges.reserve(destination.size());
+		for(size_t iid = 0; iid + 2 < destination.size(); iid += 3){
+			for(size_t k = 0; k < 3; ++k){
+				const uint64_t from = destination[iid + k];
+				const uint64_t to = destination[iid + (k + 1) % 3];
+				++halfEdges[(from << 32) | to];
+			}
+		}
+		for(const auto & edge : halfEdges){
+			const uint64_t from = edge.first >> 32;
+			const uint64_t to = edge.first & 0xFFFFFFFFull;
+			const auto opposite = halfEdges.find((to << 32) | from);
+			// Non-manifold edges are locked too.
+			if(opposite == halfEdges.end() || opposite->second != 1 || edge.second != 1){
+				locked[from] = true;
+				locked[to] = true;
+			}
+		}
+	}
+
+	struct Collapse {
+		double cost;
+		unsigned int from;
+		unsigned int to;
+	};
+	std::vector<Collapse> collapses;
+	std::vector<unsigned int> offsets;
+	std::vector<unsigned int> adjacency;
+	std::vector<bool> touched;
+	std::vector<unsigned int> remap(vertexCount);
+
+	while(destination.size() > targetCount){
+		const size_t triangleCount = destination.size() / 3;
+		// Triangles around each vertex.
+		offsets.assign(vertexCount + 1, 0);
+		for(const unsigned int vid : destination){
+			++offsets[vid + 1];
+		}
+		for(size_t vid = 0; vid < vertexCount; ++vid){
+			offsets[vid + 1] += offsets[vid];
+		}
+		adjacency.resize(destination.size());
+		{
+			std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+			for(size_t iid = 0; iid < destination.size(); ++iid){
+				adjacency[fill[destination[iid]]++] = (unsigned int)(iid / 3);
+			}
+		}
+		// Cost of moving each vertex onto each of its neighbours.
+		collapses.clear();
+		for(size_t iid = 0; iid < destination.size(); iid += 3){
+			for(size_t k = 0; k < 3; ++k){
+				const unsigned int from = destination[iid + k];
+				const unsigned int to = destination[iid + (k + 1) % 3];
+				Quadric quadric = quadrics[from];
+				quadric += quadrics[to];
+				const double cost = quadric.evaluate(glm::dvec3(positions[to]));
+				if(!locked[from]){
+					collapses.push_back({cost, from, to});
+				}
+				if(!locked[to]){
+					collapses.push_back({quadric.evaluate(glm::dvec3(positions[from])), to, from});
+				}
+			}
+		}
+		if(collapses.empty()){
+			break;
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse & left, const Collapse & right){
+			return left.cost < right.cost;
+		});
+
+		// Apply the cheapest independent collapses, each one removes about two triangles.
+		const size_t wanted = (std::max)(size_t(1), (triangleCount - targetCount / 3 + 1) / 2);
+		size_t applied = 0;
+		touched.assign(vertexCount, false);
+		for(size_t vid = 0; vid < vertexCount; ++vid){
+			remap[vid] = (unsigned int)vid;
+		}
+		for(const auto & collapse : collapses){
+			if(applied >= wanted){
+				break;
+			}
+			if(touched[collapse.from] || touched[collapse.to]){
+				continue;
+			}
+			// Reject collapses flipping or folding a triangle too much, the deviation would add up over passes.
+			bool flips = false;
+			for(unsigned int aid = offsets[collapse.from]; aid < offsets[collapse.from + 1] && !flips; ++aid){
+				const unsigned int * tri = &destination[3 * adjacency[aid]];
+				if(tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to){
+					continue;
+				}
+				unsigned int moved[3] = {tri[0], tri[1], tri[2]};
+				for(size_t k = 0; k < 3; ++k){
+					if(moved[k] == collapse.from){
+						moved[k] = collapse.to;
+					}
+				}
+				const glm::dvec3 before = triangleNormal(positions, tri[0], tri[1], tri[2]);
+				const glm::dvec3 after = triangleNormal(positions, moved[0], moved[1], moved[2]);
+				const double lengths = glm::length(before) * glm::length(after);
+				flips = lengths <= 0.0 || glm::dot(before, after) < 0.5 * lengths;
+			}
+			if(flips){
+				continue;
+			}
+			remap[collapse.from] = collapse.to;
+			quadrics[collapse.to] += quadrics[collapse.from];
+			maxCost = (std::max)(maxCost, collapse.cost);
+			++applied;
+			// The neighbourhood of the collapse can't move anymore in this pass, the flip checks would be outdated.
+			for(unsigned int aid = offsets[collapse.from]; aid < offsets[collapse.from + 1]; ++aid){
+				const unsigned int * tri = &destination[3 * adjacency[aid]];
+				touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = true;
+			}
+			touched[collapse.to] = true;
+		}
+		if(applied == 0){
+			break;
+		}
+		// Drop the triangles that became degenerate.
+		size_t kept = 0;
+		for(size_t iid = 0; iid < destination.size(); iid += 3){
+			const unsigned int i0 = remap[destination[iid]];
+			const unsigned int i1 = remap[destination[iid + 1]];
+			const unsigned int i2 = remap[destination[iid + 2]];
+			if(i0 == i1 || i1 == i2 || i2 == i0){
+				continue;
+			}
+			destination[kept++] = i0;
+			destination[kept++] = i1;
+			destination[kept++] = i2;
+		}
+		destination.resize(kept);
+	}
+	return float(std::sqrt(maxCost));
+}
+
+/// Bounding sphere and normal cone of the triangles [first, last) of range.
+static void meshletBounds(const IndexUtilities::IndexRange & range, const glm::vec3 * positions, size_t first, size_t last, std::vector<glm::vec3> & normals, IndexUtilities::Meshlet & meshlet){
+	// Sphere around the box of the triangles.
+	glm::vec3 mins = positions[range.indices[3 * first]];
+	glm::vec3 maxs = mins;
+	for(size_t iid = 3 * first; iid < 3 * last; ++iid){
+		mins = glm::min(mins, positions[range.indices[iid]]);
+		maxs = glm::max(maxs, positions[range.indices[iid]]);
+	}
+	meshlet.center = 0.5f * (mins + maxs);
+	meshlet.radius = 0.0f;
+	for(size_t iid = 3 * first; iid < 3 * last; ++iid){
+		meshlet.radius = (std::max)(meshlet.radius, glm::length(positions[range.indices[iid]] - meshlet.center));
+	}
+
+	// Cone around the average of the face normals.
+	normals.clear();
+	glm::vec3 axis(0.0f);
+	for(size_t tid = first; tid < last; ++tid){
+		const glm::vec3 & p0 = positions[range.indices[3 * tid + 0]];
+		const glm::vec3 & p1 = positions[range.indices[3 * tid + 1]];
+		const glm::vec3 & p2 = positions[range.indices[3 * tid + 2]];
+		const glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		const float length = glm::length(normal);
+		if(length <= 0.0f){
+			continue;
+		}
+		normals.push_back(normal / length);
+		axis += normals.back();
+	}
+	const float axisLength = glm::length(axis);
+	meshlet.coneAxis = axisLength > 0.0f ? axis / axisLength : glm::vec3(0.0f, 0.0f, 1.0f);
+	float minDot = axisLength > 0.0f ? 1.0f : -1.0f;
+	for(const auto & normal : normals){
+		minDot = (std::min)(minDot, glm::dot(normal, meshlet.coneAxis));
+	}
+	// Past a spread of about 85 degrees, the meshlet is never back-facing as a whole.
+	meshlet.coneCutoff = minDot <= 0.1f ? 1.0f : std::sqrt(1.0f - minDot * minDot);
+}
+
+/// Unassigned triangles considered to seed a meshlet when the previous one has no unassigned neighbour left.
+static const size_t kMeshletSeedWindow = 256;
+
+void IndexUtilities::buildMeshlets(const IndexRange & range, const glm::vec3 * positions, size_t vertexCount, std::vector<Meshlet> & meshlets, size_t maxTriangles){
+	meshlets.clear();
+	const size_t triangleCount = range.count / 3;
+	if(triangleCount == 0 || maxTriangles == 0){
+		return;
+	}
+	const unsigned int * indices = range.indices;
+
+	// Triangles using each vertex.
+	std::vector<unsigned int> offsets(vertexCount + 1, 0);
+	for(size_t iid = 0; iid < range.count; ++iid){
+		++offsets[indices[iid] + 1];
+	}
+	for(size_t vid = 0; vid < vertexCount; ++vid){
+		offsets[vid + 1] += offsets[vid];
+	}
+	std::vector<unsigned int> adjacency(range.count);
+	{
+		std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+		for(size_t iid = 0; iid < range.count; ++iid){
+			adjacency[fill[indices[iid]]++] = (unsigned int)(iid / 3);
+		}
+	}
+	std::vector<glm::vec3> centroids(triangleCount);
+	for(size_t tid = 0; tid < triangleCount; ++tid){
+		centroids[tid] = (positions[indices[3 * tid]] + positions[indices[3 * tid + 1]] + positions[indices[3 * tid + 2]]) / 3.0f;
+	}
+
+	// Grow each meshlet over the triangles sharing a vertex with it, picking the one closest to its current center.
+	std::vector<unsigned int> order;
+	order.reserve(triangleCount);
+	std::vector<bool> assigned(triangleCount, false);
+	std::vector<bool> queued(triangleCount, false);
+	std::vector<unsigned int> frontier;
+	std::vector<size_t> starts;
+	size_t cursor = 0;
+	while(order.size() < triangleCount){
+		starts.push_back(order.size());
+		glm::vec3 sum(0.0f);
+		size_t count = 0;
+		frontier.clear();
+		while(count < maxTriangles){
+			unsigned int next = 0;
+			if(frontier.empty()){
+				// Disconnected part: seed from the nearest unassigned triangle among the next ones.
+				while(cursor < triangleCount && assigned[cursor]){
+					++cursor;
+				}
+				if(cursor == triangleCount){
+					break;
+				}
+				next = (unsigned int)cursor;
+				if(count > 0){
+					const glm::vec3 center = sum / float(count);
+					float best = glm::distance(centroids[next], center);
+					for(size_t tid = cursor + 1, checked = 1; tid < triangleCount && checked < kMeshletSeedWindow; ++tid){
+						if(assigned[tid]){
+							continue;
+						}
+						++checked;
+						const float distance = glm::distance(centroids[tid], center);
+						if(distance < best){
+							best = distance;
+							next = (unsigned int)tid;
+						}
+					}
+				}
+			} else {
+				const glm::vec3 center = sum / float(count);
+				size_t bestId = 0;
+				float best = glm::distance(centroids[frontier[0]], center);
+				for(size_t fid = 1; fid < frontier.size(); ++fid){
+					const float distance = glm::distance(centroids[frontier[fid]], center);
+					if(distance < best){
+						best = distance;
+						bestId = fid;
+					}
+				}
+				next = frontier[bestId];
+				frontier[bestId] = frontier.back();
+				frontier.pop_back();
+			}
+			assigned[next] = true;
+			order.push_back(next);
+			sum += centroids[next];
+			++count;
+			for(size_t k = 0; k < 3; ++k){
+				const unsigned int vid = indices[3 * next + k];
+				for(unsigned int aid = offsets[vid]; aid < offsets[vid + 1]; ++aid){
+					const unsigned int neighbour = adjacency[aid];
+					if(!assigned[neighbour] && !queued[neighbour]){
+						queued[neighbour] = true;
+						frontier.push_back(neighbour);
+					}
+				}
+			}
+		}
+		// Neighbours left out can start or join another meshlet.
+		for(const unsigned int tid : frontier){
+			queued[tid] = false;
+		}
+	}
+	starts.push_back(triangleCount);
+
+	// Write the triangles in meshlet order, then reorder each meshlet for the vertex cache on its own vertices.
+	std::vector<unsigned int> sorted(range.count);
+	for(size_t tid = 0; tid < triangleCount; ++tid){
+		std::copy(indices + 3 * order[tid], indices + 3 * order[tid] + 3, sorted.begin() + 3 * tid);
+	}
+	std::copy(sorted.begin(), sorted.end(), range.indices);
+
+	std::vector<unsigned int> local(vertexCount, ~0u);
+	std::vector<unsigned int> global;
+	std::vector<unsigned int> localIndices;
+	std::vector<size_t> clusters;
+	std::vector<glm::vec3> normals;
+	for(size_t mid = 0; mid + 1 < starts.size(); ++mid){
+		const size_t first = starts[mid];
+		const size_t last = starts[mid + 1];
+		unsigned int * meshletIndices = range.indices + 3 * first;
+		const size_t indexCount = 3 * (last - first);
+		global.clear();
+		localIndices.resize(indexCount);
+		for(size_t iid = 0; iid < indexCount; ++iid){
+			const unsigned int vid = meshletIndices[iid];
+			if(local[vid] == ~0u){
+				local[vid] = (unsigned int)global.size();
+				global.push_back(vid);
+			}
+			localIndices[iid] = local[vid];
+		}
+		optimizeCache({localIndices.data(), indexCount}, global.size(), clusters);
+		for(size_t iid = 0; iid < indexCount; ++iid){
+			meshletIndices[iid] = global[localIndices[iid]];
+		}
+		for(const unsigned int vid : global){
+			local[vid] = ~0u;
+		}
+
+		Meshlet meshlet;
+		meshlet.firstIndex = 3 * first;
+		meshlet.indexCount = indexCount;
+		meshletBounds(range, positions, first, last, normals, meshlet);
+		meshlets.push_back(meshlet);
+	}
+}
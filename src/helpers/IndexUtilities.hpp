@@ -0,0 +1,96 @@
+#ifndef IndexUtilities_h
+#define IndexUtilities_h
+
+#include "../resources/MeshUtilities.hpp"
+#include <vector>
+#include <cstddef>
+
+/// Triangle list optimizations, on ranges of indices relative to a first vertex.
+class IndexUtilities {
+
+public:
+
+	/// Size of the simulated post-transform vertex cache, a FIFO.
+	static const size_t kCacheSize = 16;
+
+	/// Result of a cache simulation, summed over meshes.
+	struct CacheStats {
+		size_t triangles = 0;
+		size_t vertices = 0;
+		/// Vertices transformed, ie cache misses.
+		size_t transformed = 0;
+
+		/// Average cache miss ratio, transformed vertices per triangle (0.5 at best, 3 at worst).
+		double acmr() const { return triangles > 0 ? double(transformed) / double(triangles) : 0.0; }
+
+		/// Average transform to vertex ratio, transformed vertices per vertex of the range (1 at best).
+		double atvr() const { return vertices > 0 ? double(transformed) / double(vertices) : 0.0; }
+
+		CacheStats & operator+=(const CacheStats & other){
+			triangles += other.triangles;
+			vertices += other.vertices;
+			transformed += other.transformed;
+			return *this;
+		}
+	};
+
+	/// Triangles per meshlet.
+	static const size_t kMeshletTriangles = 96;
+
+	/// Consecutive triangles of a range, with bounds to cull them together.
+	struct Meshlet {
+		/// Offset and count in the indices of the range.
+		size_t firstIndex;
+		size_t indexCount;
+		/// Bounding sphere.
+		glm::vec3 center;
+		float radius;
+		/// All triangles face away from a point p when dot(center - p, coneAxis) >= coneCutoff * length(center - p) + radius.
+		/// coneCutoff is 1 when the normals are too spread for the test to ever succeed.
+		glm::vec3 coneAxis;
+		float coneCutoff;
+	};
+
+	/// Indices of a triangle list, relative to the first vertex of its range.
+	struct IndexRange {
+		unsigned int * indices;
+		size_t count;
+	};
+
+	/// True if range is a triangle list with all its indices below vertexCount.
+	static bool isValid(const IndexRange & range, size_t vertexCount);
+
+	/// Simulate drawing range through a FIFO cache of cacheSize vertices.
+	static CacheStats analyzeCache(const IndexRange & range, size_t vertexCount, size_t cacheSize = kCacheSize);
+
+	/// For the vertexCount vertices of mesh starting at first, store in remap the first vertex with exactly the same attributes.
+	/// Returns the number of distinct vertices.
+	static size_t weldVertices(const MeshView & mesh, size_t first, size_t vertexCount, std::vector<unsigned int> & remap);
+
+	/// Reorder the triangles of range for vertex cache locality, using Tipsify (Sander et al. 2007).
+	/// clusters receives the first triangle of each run started after the cache was flushed.
+	static void optimizeCache(const IndexRange & range, size_t vertexCount, std::vector<size_t> & clusters, size_t cacheSize = kCacheSize);
+
+	/// Reorder the clusters of an optimized range so that the ones facing away from the mesh center, likely to occlude the others,
+	/// are drawn first. Triangles stay in order in each cluster, preserving the cache efficiency.
+	static void optimizeOverdraw(const IndexRange & range, const glm::vec3 * positions, const std::vector<size_t> & clusters);
+
+	/// Simplify range by collapsing edges onto their existing endpoints in order of quadric error (Garland & Heckbert 1997),
+	/// until at most targetCount indices remain. Vertices on borders, attribute seams included, are never moved.
+	/// destination receives the indices, referencing the same vertices. Returns the largest collapse error, as a distance.
+	static float simplify(const IndexRange & range, const glm::vec3 * positions, size_t vertexCount, size_t targetCount, std::vector<unsigned int> & destination);
+
+	/// Reorder range in meshlets of at most maxTriangles triangles. Each meshlet is grown over the triangles sharing a vertex with it,
+	/// nearest to its center first, then its triangles are reordered for the vertex cache.
+	static void buildMeshlets(const IndexRange & range, const glm::vec3 * positions, size_t vertexCount, std::vector<Meshlet> & meshlets, size_t maxTriangles = kMeshletTriangles);
+
+	/// Renumber the vertexCount vertices referenced by ranges in the order they are first used, rewriting the indices.
+	/// remap receives the new position of each vertex, or vertexCount if it isn't used. Returns the number of used vertices.
+	static size_t optimizeFetch(const std::vector<IndexRange> & ranges, size_t vertexCount, std::vector<unsigned int> & remap);
+
+	/// Move the attributes of the vertexCount vertices of mesh starting at first to their position in remap.
+	static void remapVertices(MutableMeshView & mesh, size_t first, size_t vertexCount, const std::vector<unsigned int> & remap);
+
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include "Logger.hpp"
+#include "../Material.hpp"
 #include <PRP/Geometry/plDrawableSpans.h>
 #include <imgui/imgui.h>
 #include <ctime>
@@ -58,26 +59,26 @@ void logCompFlags(unsigned int cflags){
 	}
 }
 
-std::string logLayer(plLayerInterface * lay){
+std::string logLayer(const MaterialLayer & lay){
 	std::string layerString;
-	if(lay->getTexture().Exists()){
-		layerString.append("Texture: " + lay->getTexture()->getName().to_std_string() + ", LOD bias " + std::to_string(lay->getLODBias()) + ").\n");
+	if(lay.hasTexture()){
+		layerString.append("Texture: " + lay.texture + ", LOD bias " + std::to_string(lay.lodBias) + ").\n");
 	}
 	
-//	layerString.append("Opacity: " + lay->getOpacity() + ", ");
-//	"Power: " + lay->getSpecularPower() + ", ";
+//	layerString.append("Opacity: " + lay.opacity + ", ");
+//	"Power: " + lay.specularPower + ", ";
 //	std::endl;
-//	"Amb: " + lay->getAmbient() <<", ";
-//	"Pres: " + lay->getPreshade() <<", ";
-//	"Spec: " + lay->getSpecular() <<", ";
-//	"Run: " + lay->getRuntime() <<", ";
+//	"Amb: " + lay.ambient <<", ";
+//	"Pres: " + lay.preshade <<", ";
+//	"Spec: " + lay.specular <<", ";
+//	"Run: " + lay.runtime <<", ";
 //	layerString.append(std::endl;
 	
-	const unsigned int fblend = lay->getState().fBlendFlags;
-	const unsigned int fclamp = lay->getState().fClampFlags;
-	const unsigned int fmisc = lay->getState().fMiscFlags;
-	const unsigned int fshade = lay->getState().fShadeFlags;
-	const unsigned int fz = lay->getState().fZFlags;
+	const unsigned int fblend = lay.blendFlags;
+	const unsigned int fclamp = lay.clampFlags;
+	const unsigned int fmisc = lay.miscFlags;
+	const unsigned int fshade = lay.shadeFlags;
+	const unsigned int fz = lay.zFlags;
 	
 	if(fblend != 0){
 		layerString.append("Blend: ");
@@ -183,8 +184,8 @@ std::string logLayer(plLayerInterface * lay){
 		layerString.append("\n");
 	}
 	
-	if(lay->getUnderLay().Exists()){
-		layerString.append("Underlay: " + lay->getUnderLay()->getName().to_std_string() + "\n");
+	if(lay.underlay){
+		layerString.append("Underlay: " + lay.underlay->name + "\n");
 	}
 	return layerString;
 }
@@ -10,17 +10,19 @@
 #include <Math/hsGeometry3.h>
 #include <Math/hsMatrix44.h>
 #include <Sys/hsColor.h>
-#include <PRP/Surface/plLayerInterface.h>
+#include <PRP/Surface/hsGMatState.h>
 
 // Fix for Windows headers.
 #ifdef ERROR
 #undef ERROR
 #endif
 
+struct MaterialLayer;
+
 // Basic log helpers for Plasma structures.
 void logSpanProps(unsigned int iceflags);
 void logCompFlags(unsigned int cflags);
-std::string logLayer(plLayerInterface * lay);
+std::string logLayer(const MaterialLayer & lay);
 
 class Log {
 	
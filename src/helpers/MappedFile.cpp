@@ -0,0 +1,106 @@
+#include "MappedFile.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile() : _data(nullptr), _size(0), _file(INVALID_HANDLE_VALUE), _mapping(nullptr) {
+}
+
+bool MappedFile::open(const std::string & path, Advice advice){
+	close();
+	const DWORD flags = FILE_ATTRIBUTE_NORMAL | (advice == Sequential ? FILE_FLAG_SEQUENTIAL_SCAN : 0);
+	_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, flags, NULL);
+	if(_file == INVALID_HANDLE_VALUE){
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	if(!GetFileSizeEx(_file, &fileSize) || fileSize.QuadPart == 0){
+		close();
+		return false;
+	}
+	_mapping = CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(_mapping == nullptr){
+		close();
+		return false;
+	}
+	_data = (const unsigned char*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+	if(_data == nullptr){
+		close();
+		return false;
+	}
+	_size = size_t(fileSize.QuadPart);
+	return true;
+}
+
+void MappedFile::close(){
+	if(_data){
+		UnmapViewOfFile(_data);
+	}
+	if(_mapping){
+		CloseHandle(_mapping);
+	}
+	if(_file != INVALID_HANDLE_VALUE){
+		CloseHandle(_file);
+	}
+	_data = nullptr;
+	_size = 0;
+	_mapping = nullptr;
+	_file = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+MappedFile::MappedFile() : _data(nullptr), _size(0) {
+}
+
+bool MappedFile::open(const std::string & path, Advice advice){
+	close();
+	const int file = ::open(path.c_str(), O_RDONLY);
+	if(file < 0){
+		return false;
+	}
+	struct stat infos;
+	if(fstat(file, &infos) != 0 || infos.st_size == 0){
+		::close(file);
+		return false;
+	}
+	void * data = mmap(nullptr, size_t(infos.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+	// The mapping stays valid once the descriptor is closed.
+	::close(file);
+	if(data == MAP_FAILED){
+		return false;
+	}
+	_data = (const unsigned char*)data;
+	_size = size_t(infos.st_size);
+	if(advice == Sequential){
+		// More aggressive read-ahead, pages can be dropped once read.
+		madvise(data, _size, MADV_SEQUENTIAL);
+	} else if(advice == WillNeed){
+		// Start reading the whole file in the background.
+		madvise(data, _size, MADV_WILLNEED);
+	}
+	return true;
+}
+
+void MappedFile::close(){
+	if(_data){
+		munmap((void*)_data, _size);
+	}
+	_data = nullptr;
+	_size = 0;
+}
+
+#endif
+
+MappedFile::~MappedFile(){
+	close();
+}
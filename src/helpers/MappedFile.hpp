@@ -0,0 +1,46 @@
+#ifndef MappedFile_h
+#define MappedFile_h
+
+#include <string>
+#include <cstddef>
+
+/// Read-only memory mapping of a file, unmapped on destruction.
+class MappedFile {
+public:
+
+	/// Expected access pattern, forwarded to the OS as a hint.
+	enum Advice {
+		Normal, Sequential, WillNeed
+	};
+	
+	MappedFile();
+
+	~MappedFile();
+
+	/// Map the whole file at path, returns false if it can't be opened or is empty.
+	bool open(const std::string & path, Advice advice = Normal);
+
+	void close();
+
+	const unsigned char * data() const {
+		return _data;
+	}
+
+	size_t size() const {
+		return _size;
+	}
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile & operator=(const MappedFile &) = delete;
+
+private:
+
+	const unsigned char * _data;
+	size_t _size;
+#ifdef _WIN32
+	void * _file;
+	void * _mapping;
+#endif
+};
+
+#endif
@@ -0,0 +1,69 @@
+#include "MappedStream.hpp"
+#include <Debug/hsExceptions.hpp>
+#include <cstring>
+#include <algorithm>
+
+MappedStream::MappedStream() : _pos(0) {
+}
+
+bool MappedStream::open(const std::string & path){
+	_path = path;
+	_pos = 0;
+	return _file.open(path, MappedFile::Sequential);
+}
+
+void MappedStream::close(){
+	_file.close();
+	_pos = 0;
+}
+
+uint32_t MappedStream::size() const {
+	return uint32_t(_file.size());
+}
+
+uint32_t MappedStream::pos() const {
+	return _pos;
+}
+
+bool MappedStream::eof() const {
+	return _pos >= _file.size();
+}
+
+void MappedStream::seek(uint32_t pos){
+	_pos = std::min(pos, size());
+}
+
+void MappedStream::skip(int32_t count){
+	if(count < 0 && uint32_t(-int64_t(count)) > _pos){
+		_pos = 0;
+		return;
+	}
+	seek(uint32_t(int64_t(_pos) + count));
+}
+
+void MappedStream::fastForward(){
+	_pos = size();
+}
+
+void MappedStream::rewind(){
+	_pos = 0;
+}
+
+void MappedStream::flush(){
+}
+
+size_t MappedStream::read(size_t size, void * buf){
+	if(size == 0){
+		return 0;
+	}
+	if(size > _file.size() - _pos){
+		throw hsFileReadException(__FILE__, __LINE__, _path.c_str());
+	}
+	std::memcpy(buf, _file.data() + _pos, size);
+	_pos += uint32_t(size);
+	return size;
+}
+
+size_t MappedStream::write(size_t, const void *){
+	return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef MappedStream_h
+#define MappedStream_h
+
+#include "MappedFile.hpp"
+#include <Stream/hsStream.h>
+#include <string>
+
+/// Read-only hsStream reading directly from a memory mapping of the file, without intermediate buffering.
+class MappedStream : public hsStream {
+public:
+
+	MappedStream();
+
+	/// Map the file at path for a sequential read, returns false if it can't be opened or is empty.
+	bool open(const std::string & path);
+
+	void close();
+
+	uint32_t size() const;
+
+	uint32_t pos() const;
+
+	bool eof() const;
+
+	void seek(uint32_t pos);
+
+	void skip(int32_t count);
+
+	void fastForward();
+
+	void rewind();
+
+	void flush();
+
+	/// Copy size bytes from the mapping, throws hsFileReadException when reading past the end.
+	size_t read(size_t size, void * buf);
+
+	/// Mappings are read-only, nothing is written.
+	size_t write(size_t size, const void * buf);
+
+private:
+
+	MappedFile _file;
+	std::string _path;
+	uint32_t _pos;
+};
+
+#endif
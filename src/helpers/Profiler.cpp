@@ -0,0 +1,156 @@
+#include "Profiler.hpp"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> Profiler::_enabled(false);
+
+/// Zones kept per thread, older ones are overwritten.
+static const size_t kRingSize = 1 << 16;
+
+struct ZoneEvent {
+	const char * name;
+	uint64_t start;
+	uint64_t end;
+};
+
+/// Ring buffer of a thread. The lock is only contended while exporting.
+struct ThreadEvents {
+	std::mutex mutex;
+	std::vector<ZoneEvent> events;
+	size_t next = 0;
+	size_t count = 0;
+	unsigned int id = 0;
+};
+
+/// Buffers outlive their thread, so that zones of finished workers can be exported.
+/// The buffer of a finished thread is handed to the next new thread with its zones, so that
+/// short-lived workers don't each keep a ring: there are as many rings as concurrent threads.
+struct ThreadRegistry {
+	std::mutex mutex;
+	std::vector<std::shared_ptr<ThreadEvents>> threads;
+	std::vector<std::shared_ptr<ThreadEvents>> available;
+};
+
+static ThreadRegistry & registry(){
+	// Never destroyed, threads can still exit during static destruction.
+	static ThreadRegistry * registry = new ThreadRegistry();
+	return *registry;
+}
+
+/// Ring used by a thread while it runs, returned to the registry when it exits.
+struct LocalEvents {
+	
+	LocalEvents(){
+		ThreadRegistry & threads = registry();
+		std::lock_guard<std::mutex> lock(threads.mutex);
+		if(!threads.available.empty()){
+			events = threads.available.back();
+			threads.available.pop_back();
+			return;
+		}
+		events = std::make_shared<ThreadEvents>();
+		events->events.resize(kRingSize);
+		events->id = (unsigned int)threads.threads.size();
+		threads.threads.push_back(events);
+	}
+	
+	~LocalEvents(){
+		ThreadRegistry & threads = registry();
+		std::lock_guard<std::mutex> lock(threads.mutex);
+		threads.available.push_back(events);
+	}
+	
+	std::shared_ptr<ThreadEvents> events;
+};
+
+static ThreadEvents & localEvents(){
+	thread_local LocalEvents local;
+	return *local.events;
+}
+
+/// Time of the first use of the profiler, exported timestamps are relative to it.
+static uint64_t origin(){
+	static const uint64_t start = Profiler::now();
+	return start;
+}
+
+void Profiler::setEnabled(bool enabled){
+	// Fix the origin before the first zone.
+	origin();
+	_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+uint64_t Profiler::now(){
+	const uint64_t time = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+	return time == 0 ? 1 : time;
+}
+
+void Profiler::record(const char * name, uint64_t start, uint64_t end){
+	ThreadEvents & events = localEvents();
+	std::lock_guard<std::mutex> lock(events.mutex);
+	events.events[events.next] = {name, start, end};
+	events.next = (events.next + 1) % kRingSize;
+	events.count = (std::min)(events.count + 1, kRingSize);
+}
+
+void Profiler::clear(){
+	ThreadRegistry & threads = registry();
+	std::lock_guard<std::mutex> lock(threads.mutex);
+	for(auto & thread : threads.threads){
+		std::lock_guard<std::mutex> threadLock(thread->mutex);
+		thread->next = 0;
+		thread->count = 0;
+	}
+}
+
+static void writeEscaped(std::ofstream & out, const char * str){
+	for(const char * c = str; *c != '\0'; ++c){
+		if(*c == '"' || *c == '\\'){
+			out << '\\';
+		}
+		out << *c;
+	}
+}
+
+bool Profiler::exportTrace(const std::string & path){
+	std::ofstream out(path, std::ios::trunc);
+	if(!out.is_open()){
+		return false;
+	}
+	const uint64_t start = origin();
+	
+	// Timestamps and durations are in microseconds.
+	out << std::fixed << std::setprecision(3);
+	out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+	bool first = true;
+	ThreadRegistry & threads = registry();
+	std::lock_guard<std::mutex> lock(threads.mutex);
+	for(auto & thread : threads.threads){
+		std::vector<ZoneEvent> events;
+		{
+			std::lock_guard<std::mutex> threadLock(thread->mutex);
+			const size_t oldest = (thread->next + kRingSize - thread->count) % kRingSize;
+			for(size_t eid = 0; eid < thread->count; ++eid){
+				events.push_back(thread->events[(oldest + eid) % kRingSize]);
+			}
+		}
+		// Rings are numbered in the order they were created, a ring holds the zones of successive threads.
+		out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->id;
+		out << ",\"args\":{\"name\":\"Thread " << thread->id << "\"}}";
+		first = false;
+		for(const auto & event : events){
+			const double ts = double(event.start - (std::min)(event.start, start)) / 1000.0;
+			const double dur = double(event.end - event.start) / 1000.0;
+			out << ",\n{\"name\":\"";
+			writeEscaped(out, event.name);
+			out << "\",\"cat\":\"zone\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->id << ",\"ts\":" << ts << ",\"dur\":" << dur << "}";
+		}
+	}
+	out << "\n]}\n";
+	return out.good();
+}
@@ -0,0 +1,76 @@
+#ifndef Profiler_h
+#define Profiler_h
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// By disabling PROFILER_ZONES, PROFILE_ZONE scopes are compiled out entirely.
+// When compiled in, a disabled profiler only costs a relaxed atomic load per zone.
+
+#define PROFILER_ZONES
+
+/// Thread-aware zone profiler. Zones are recorded in per-thread ring buffers
+/// and exported as Chrome trace events (chrome://tracing, ui.perfetto.dev).
+class Profiler {
+
+public:
+
+	static void setEnabled(bool enabled);
+
+	static bool enabled(){
+		return _enabled.load(std::memory_order_relaxed);
+	}
+
+	/// Current time in nanoseconds, never 0.
+	static uint64_t now();
+
+	/// Record a zone for the calling thread. The name is kept as is, it must be a string literal.
+	static void record(const char * name, uint64_t start, uint64_t end);
+
+	/// Write the zones recorded by all threads as trace_event JSON. Older zones are dropped when a thread records too many.
+	static bool exportTrace(const std::string & path);
+
+	/// Forget all recorded zones.
+	static void clear();
+
+	/// Record the time between construction and destruction (or the call to end).
+	class Zone {
+	public:
+
+		explicit Zone(const char * name) : _name(name), _start(Profiler::enabled() ? Profiler::now() : 0) {}
+
+		~Zone(){
+			end();
+		}
+
+		void end(){
+			if(_start != 0){
+				Profiler::record(_name, _start, Profiler::now());
+				_start = 0;
+			}
+		}
+
+		Zone(const Zone &) = delete;
+		Zone & operator=(const Zone &) = delete;
+
+	private:
+		const char * _name;
+		uint64_t _start;
+	};
+
+private:
+
+	static std::atomic<bool> _enabled;
+
+};
+
+#ifdef PROFILER_ZONES
+#define PROFILER_CONCAT_IMPL(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_IMPL(a, b)
+#define PROFILE_ZONE(name) Profiler::Zone PROFILER_CONCAT(profilerZone, __LINE__)(name)
+#else
+#define PROFILE_ZONE(name)
+#endif
+
+#endif
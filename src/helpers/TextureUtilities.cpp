@@ -0,0 +1,47 @@
+#include "TextureUtilities.hpp"
+#include <PRP/Surface/plMipmap.h>
+#include <algorithm>
+
+bool TextureUtilities::isDecoded(const plMipmap * mipmap){
+	const unsigned char compression = mipmap->getCompressionType();
+	return compression == plBitmap::kJPEGCompression || compression == plBitmap::kPNGCompression;
+}
+
+void TextureUtilities::buildMipChain(const plMipmap * mipmap, MipChain & chain){
+	chain.levels.clear();
+	unsigned int width = (unsigned int)mipmap->getLevelWidth(0);
+	unsigned int height = (unsigned int)mipmap->getLevelHeight(0);
+	const unsigned char * src = mipmap->getLevelData(0);
+	if(src == nullptr || width == 0 || height == 0){
+		return;
+	}
+	while(width > 1 || height > 1){
+		const unsigned int dstWidth = (std::max)(1u, width / 2);
+		const unsigned int dstHeight = (std::max)(1u, height / 2);
+		MipChain::Level level;
+		level.width = dstWidth;
+		level.height = dstHeight;
+		level.pixels.resize(size_t(4) * dstWidth * dstHeight);
+		// Average each 2x2 block, clamped on odd or 1-pixel-wide sides.
+		for(unsigned int y = 0; y < dstHeight; ++y){
+			const unsigned int y0 = (std::min)(2 * y, height - 1);
+			const unsigned int y1 = (std::min)(2 * y + 1, height - 1);
+			for(unsigned int x = 0; x < dstWidth; ++x){
+				const unsigned int x0 = (std::min)(2 * x, width - 1);
+				const unsigned int x1 = (std::min)(2 * x + 1, width - 1);
+				const unsigned char * p00 = src + 4 * (size_t(y0) * width + x0);
+				const unsigned char * p01 = src + 4 * (size_t(y0) * width + x1);
+				const unsigned char * p10 = src + 4 * (size_t(y1) * width + x0);
+				const unsigned char * p11 = src + 4 * (size_t(y1) * width + x1);
+				unsigned char * dst = &level.pixels[4 * (size_t(y) * dstWidth + x)];
+				for(int c = 0; c < 4; ++c){
+					dst[c] = (unsigned char)((p00[c] + p01[c] + p10[c] + p11[c] + 2) / 4);
+				}
+			}
+		}
+		chain.levels.push_back(std::move(level));
+		src = chain.levels.back().pixels.data();
+		width = dstWidth;
+		height = dstHeight;
+	}
+}
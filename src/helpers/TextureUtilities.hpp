@@ -0,0 +1,33 @@
+#ifndef TextureUtilities_h
+#define TextureUtilities_h
+
+#include <vector>
+#include <cstddef>
+
+class plMipmap;
+
+/// Levels below the top one of a texture, prepared on the CPU.
+struct MipChain {
+	struct Level {
+		unsigned int width;
+		unsigned int height;
+		/// 32 bits BGRA pixels.
+		std::vector<unsigned char> pixels;
+	};
+	std::vector<Level> levels;
+};
+
+class TextureUtilities {
+
+public:
+
+	/// JPEG and PNG payloads are decoded by libhsplasma into a 32 bits BGRA top level only,
+	/// the other levels stored in the mipmap are not valid.
+	static bool isDecoded(const plMipmap * mipmap);
+
+	/// Box-filter the top level of a decoded mipmap down to 1x1, into chain. Can run on any thread.
+	static void buildMipChain(const plMipmap * mipmap, MipChain & chain);
+
+};
+
+#endif
@@ -0,0 +1,39 @@
+#include "ThreadUtilities.hpp"
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+unsigned int ThreadUtilities::workerCount(unsigned int requested){
+	if(requested > 0){
+		return requested;
+	}
+	// hardware_concurrency can return 0 when the information is not available.
+	return (std::max)(1u, std::thread::hardware_concurrency());
+}
+
+void ThreadUtilities::parallelFor(size_t count, unsigned int threadCount, const std::function<void(size_t)> & func){
+	if(count == 0){
+		return;
+	}
+	const size_t workers = (std::min)(size_t(workerCount(threadCount)), count);
+
+	// Each worker picks the next unprocessed index until none are left.
+	std::atomic<size_t> nextIndex(0);
+	auto work = [&nextIndex, &func, count](){
+		for(size_t i = nextIndex++; i < count; i = nextIndex++){
+			func(i);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(workers - 1);
+	for(size_t tid = 1; tid < workers; ++tid){
+		threads.emplace_back(work);
+	}
+	// The calling thread takes its share too.
+	work();
+	for(auto & thread : threads){
+		thread.join();
+	}
+}
@@ -0,0 +1,20 @@
+#ifndef ThreadUtilities_h
+#define ThreadUtilities_h
+
+#include <functional>
+#include <cstddef>
+
+class ThreadUtilities {
+
+public:
+
+	/// Number of threads to use for a requested count, 0 meaning one per hardware thread.
+	static unsigned int workerCount(unsigned int requested);
+
+	/// Call func(i) for each i in [0, count) from up to threadCount threads, the caller included.
+	/// Indices are picked in increasing order. Blocks until all calls are done, func shouldn't throw.
+	static void parallelFor(size_t count, unsigned int threadCount, const std::function<void(size_t)> & func);
+
+};
+
+#endif
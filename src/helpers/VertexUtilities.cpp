@@ -0,0 +1,369 @@
+#include "VertexUtilities.hpp"
+#include "Arena.hpp"
+#include <Math/hsMatrix44.h>
+#include <PRP/Geometry/plGBufferGroup.h>
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define VERTEX_SIMD
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+// MSVC allows intrinsics for any instruction set without flags.
+#define TARGET_SSE41
+#define TARGET_AVX2
+#else
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// All kernels compute each component as ((m0 * x + m1 * y) + m2 * z) + m3, in this order and without
+// fused multiply-add, the same way hsMatrix44::multPoint/multVector do, so that results are bit-identical.
+
+/// Vertices read in place: attributes at fixed byte offsets in each vertex, UV channels of three floats following each other.
+struct VertexSource {
+	const unsigned char * data;
+	size_t stride;
+	size_t position;
+	size_t normal;
+	size_t color;
+	size_t uvs;
+	
+	const unsigned char * vertex(size_t j) const {
+		return data + j * stride;
+	}
+};
+
+static inline float readFloat(const unsigned char * ptr){
+	float value;
+	std::memcpy(&value, ptr, sizeof(float));
+	return value;
+}
+
+static inline unsigned int readColor(const VertexSource & verts, size_t j){
+	unsigned int value;
+	std::memcpy(&value, verts.vertex(j) + verts.color, sizeof(unsigned int));
+	return value;
+}
+
+static void convertScalar(const VertexSource & verts, size_t start, size_t end, const float m[3][4], MutableMeshView & mesh, size_t first){
+	const size_t uvCount = mesh.texcoords.size();
+	for(size_t j = start; j < end; ++j){
+		const unsigned char * vert = verts.vertex(j);
+		const glm::vec3 pos(readFloat(vert + verts.position), readFloat(vert + verts.position + 4), readFloat(vert + verts.position + 8));
+		const glm::vec3 nor(readFloat(vert + verts.normal), readFloat(vert + verts.normal + 4), readFloat(vert + verts.normal + 8));
+		mesh.positions[first + j] = glm::vec3(m[0][0] * pos.x + m[0][1] * pos.y + m[0][2] * pos.z + m[0][3],
+									  m[1][0] * pos.x + m[1][1] * pos.y + m[1][2] * pos.z + m[1][3],
+									  m[2][0] * pos.x + m[2][1] * pos.y + m[2][2] * pos.z + m[2][3]);
+		mesh.normals[first + j] = glm::vec3(m[0][0] * nor.x + m[0][1] * nor.y + m[0][2] * nor.z,
+									m[1][0] * nor.x + m[1][1] * nor.y + m[1][2] * nor.z,
+									m[2][0] * nor.x + m[2][1] * nor.y + m[2][2] * nor.z);
+		// ARGB to RGBA.
+		const unsigned int color = readColor(verts, j);
+		mesh.colors[first + j] = glm::u8vec4((color >> 16) & 0xFF, (color >> 8) & 0xFF, color & 0xFF, (color >> 24) & 0xFF);
+		for(size_t uvid = 0; uvid < uvCount; ++uvid){
+			std::memcpy(&mesh.texcoords[uvid][first + j][0], vert + verts.uvs + uvid * 3 * sizeof(float), 3 * sizeof(float));
+		}
+	}
+}
+
+#ifdef VERTEX_SIMD
+
+// Vectors are written with 16 bytes stores, overflowing on the next element that is written afterwards.
+// The last vertex is thus always converted by the scalar path. For the same reason UVs are read with 16 bytes
+// loads that can overflow on the next vertex.
+
+TARGET_SSE41 static void convertSSE41(const VertexSource & verts, size_t count, const float m[3][4], MutableMeshView & mesh, size_t first){
+	const size_t uvCount = mesh.texcoords.size();
+	// Columns of the transformation, one output component per lane.
+	const __m128 col0 = _mm_setr_ps(m[0][0], m[1][0], m[2][0], 0.0f);
+	const __m128 col1 = _mm_setr_ps(m[0][1], m[1][1], m[2][1], 0.0f);
+	const __m128 col2 = _mm_setr_ps(m[0][2], m[1][2], m[2][2], 0.0f);
+	const __m128 col3 = _mm_setr_ps(m[0][3], m[1][3], m[2][3], 0.0f);
+	// Swap red and blue bytes.
+	const __m128i swizzle = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+
+	size_t j = 0;
+	for(; j + 4 < count; j += 4){
+		for(size_t k = j; k < j + 4; ++k){
+			const unsigned char * vert = verts.vertex(k);
+			const unsigned char * p = vert + verts.position;
+			const unsigned char * n = vert + verts.normal;
+			const __m128 pos = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(col0, _mm_set1_ps(readFloat(p))), _mm_mul_ps(col1, _mm_set1_ps(readFloat(p + 4)))), _mm_mul_ps(col2, _mm_set1_ps(readFloat(p + 8)))), col3);
+			const __m128 nor = _mm_add_ps(_mm_add_ps(_mm_mul_ps(col0, _mm_set1_ps(readFloat(n))), _mm_mul_ps(col1, _mm_set1_ps(readFloat(n + 4)))), _mm_mul_ps(col2, _mm_set1_ps(readFloat(n + 8))));
+			_mm_storeu_ps(&mesh.positions[first + k][0], pos);
+			_mm_storeu_ps(&mesh.normals[first + k][0], nor);
+			for(size_t uvid = 0; uvid < uvCount; ++uvid){
+				_mm_storeu_ps(&mesh.texcoords[uvid][first + k][0], _mm_loadu_ps((const float *)(vert + verts.uvs + uvid * 3 * sizeof(float))));
+			}
+		}
+		const __m128i colors = _mm_setr_epi32(int(readColor(verts, j)), int(readColor(verts, j+1)), int(readColor(verts, j+2)), int(readColor(verts, j+3)));
+		_mm_storeu_si128((__m128i*)&mesh.colors[first + j], _mm_shuffle_epi8(colors, swizzle));
+	}
+	convertScalar(verts, j, count, m, mesh, first);
+}
+
+/// The float at offset in two vertices, each broadcast to the four lanes of its half.
+TARGET_AVX2 static inline __m256 broadcastPair(const unsigned char * v0, const unsigned char * v1, size_t offset){
+	const float a = readFloat(v0 + offset);
+	const float b = readFloat(v1 + offset);
+	return _mm256_setr_ps(a, a, a, a, b, b, b, b);
+}
+
+TARGET_AVX2 static void convertAVX2(const VertexSource & verts, size_t count, const float m[3][4], MutableMeshView & mesh, size_t first){
+	const size_t uvCount = mesh.texcoords.size();
+	// Columns of the transformation, two vertices per register.
+	const __m256 col0 = _mm256_setr_ps(m[0][0], m[1][0], m[2][0], 0.0f, m[0][0], m[1][0], m[2][0], 0.0f);
+	const __m256 col1 = _mm256_setr_ps(m[0][1], m[1][1], m[2][1], 0.0f, m[0][1], m[1][1], m[2][1], 0.0f);
+	const __m256 col2 = _mm256_setr_ps(m[0][2], m[1][2], m[2][2], 0.0f, m[0][2], m[1][2], m[2][2], 0.0f);
+	const __m256 col3 = _mm256_setr_ps(m[0][3], m[1][3], m[2][3], 0.0f, m[0][3], m[1][3], m[2][3], 0.0f);
+	// Swap red and blue bytes, the shuffle works in each 128 bits lane.
+	const __m256i swizzle = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+											 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+
+	size_t j = 0;
+	for(; j + 8 < count; j += 8){
+		for(size_t k = j; k < j + 8; k += 2){
+			const unsigned char * v0 = verts.vertex(k);
+			const unsigned char * v1 = verts.vertex(k+1);
+			const __m256 px = broadcastPair(v0, v1, verts.position);
+			const __m256 py = broadcastPair(v0, v1, verts.position + 4);
+			const __m256 pz = broadcastPair(v0, v1, verts.position + 8);
+			const __m256 nx = broadcastPair(v0, v1, verts.normal);
+			const __m256 ny = broadcastPair(v0, v1, verts.normal + 4);
+			const __m256 nz = broadcastPair(v0, v1, verts.normal + 8);
+			const __m256 pos = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(col0, px), _mm256_mul_ps(col1, py)), _mm256_mul_ps(col2, pz)), col3);
+			const __m256 nor = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(col0, nx), _mm256_mul_ps(col1, ny)), _mm256_mul_ps(col2, nz));
+			_mm_storeu_ps(&mesh.positions[first + k][0], _mm256_castps256_ps128(pos));
+			_mm_storeu_ps(&mesh.positions[first + k + 1][0], _mm256_extractf128_ps(pos, 1));
+			_mm_storeu_ps(&mesh.normals[first + k][0], _mm256_castps256_ps128(nor));
+			_mm_storeu_ps(&mesh.normals[first + k + 1][0], _mm256_extractf128_ps(nor, 1));
+			for(size_t uvid = 0; uvid < uvCount; ++uvid){
+				const size_t offset = verts.uvs + uvid * 3 * sizeof(float);
+				_mm_storeu_ps(&mesh.texcoords[uvid][first + k][0], _mm_loadu_ps((const float *)(v0 + offset)));
+				_mm_storeu_ps(&mesh.texcoords[uvid][first + k + 1][0], _mm_loadu_ps((const float *)(v1 + offset)));
+			}
+		}
+		const __m256i colors = _mm256_setr_epi32(int(readColor(verts, j)), int(readColor(verts, j+1)), int(readColor(verts, j+2)), int(readColor(verts, j+3)),
+												 int(readColor(verts, j+4)), int(readColor(verts, j+5)), int(readColor(verts, j+6)), int(readColor(verts, j+7)));
+		_mm256_storeu_si256((__m256i*)&mesh.colors[first + j], _mm256_shuffle_epi8(colors, swizzle));
+	}
+	convertScalar(verts, j, count, m, mesh, first);
+}
+
+#endif
+
+VertexUtilities::Kernel VertexUtilities::bestKernel(){
+#ifdef VERTEX_SIMD
+	static const Kernel kernel = [](){
+#if defined(_MSC_VER) && !defined(__clang__)
+		int infos[4];
+		__cpuid(infos, 1);
+		const bool sse41 = (infos[2] & (1 << 19)) != 0;
+		// AVX also needs the OS to save the YMM registers.
+		const bool avx = (infos[2] & (1 << 27)) != 0 && (infos[2] & (1 << 28)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+		__cpuidex(infos, 7, 0);
+		const bool avx2 = avx && (infos[1] & (1 << 5)) != 0;
+#else
+		__builtin_cpu_init();
+		const bool sse41 = __builtin_cpu_supports("sse4.1");
+		const bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+		return avx2 ? AVX2 : (sse41 ? SSE41 : Scalar);
+	}();
+	return kernel;
+#else
+	return Scalar;
+#endif
+}
+
+const char * VertexUtilities::kernelName(Kernel kernel){
+	switch(kernel){
+		case AVX2:
+			return "AVX2";
+		case SSE41:
+			return "SSE4.1";
+		default:
+			return "scalar";
+	}
+}
+
+static void convertSource(const VertexSource & verts, size_t count, const hsMatrix44 & transfo, MutableMeshView & mesh, size_t first, VertexUtilities::Kernel kernel){
+	float m[3][4];
+	for(int r = 0; r < 3; ++r){
+		for(int c = 0; c < 4; ++c){
+			m[r][c] = transfo(r, c);
+		}
+	}
+#ifdef VERTEX_SIMD
+	if(kernel == VertexUtilities::AVX2){
+		convertAVX2(verts, count, m, mesh, first);
+		return;
+	}
+	if(kernel == VertexUtilities::SSE41){
+		convertSSE41(verts, count, m, mesh, first);
+		return;
+	}
+#endif
+	convertScalar(verts, 0, count, m, mesh, first);
+}
+
+void VertexUtilities::convert(const std::vector<plGBufferVertex> & verts, const hsMatrix44 & transfo, MutableMeshView & mesh, size_t first, Kernel kernel){
+	if(verts.empty()){
+		return;
+	}
+	const VertexSource source = {
+		reinterpret_cast<const unsigned char *>(verts.data()), sizeof(plGBufferVertex),
+		offsetof(plGBufferVertex, fPos), offsetof(plGBufferVertex, fNormal), offsetof(plGBufferVertex, fColor), offsetof(plGBufferVertex, fUVWs)
+	};
+	convertSource(source, verts.size(), transfo, mesh, first, kernel);
+}
+
+void VertexUtilities::allocate(MutableMeshView & mesh, Arena & arena){
+	mesh.indices = arena.allocate<unsigned int>(mesh.indexCount);
+	mesh.positions = arena.allocate<glm::vec3>(mesh.vertexCount);
+	mesh.normals = arena.allocate<glm::vec3>(mesh.vertexCount);
+	mesh.colors = arena.allocate<glm::u8vec4>(mesh.vertexCount);
+	for(auto & texcoords : mesh.texcoords){
+		texcoords = arena.allocate<glm::vec3>(mesh.vertexCount);
+	}
+}
+
+void VertexUtilities::stage(const Range & range, const hsMatrix44 & transfo, bool copyVertices, MutableMeshView & mesh, size_t baseVertex, size_t firstIndex, Kernel kernel){
+	const plGBufferGroup & group = *range.group;
+	if(copyVertices && range.vertexCount > 0){
+		// Decoded storage of a vertex: position, skin weights and index, normal, color, specular color, then the UV channels.
+		const unsigned int format = group.getFormat();
+		const size_t weights = (format & plGBufferGroup::kSkinWeightMask) >> 4;
+		const size_t normal = 3 * sizeof(float) + weights * sizeof(float) + ((format & plGBufferGroup::kSkinIndices) ? sizeof(int) : 0);
+		const size_t color = normal + 3 * sizeof(float);
+		const size_t uvs = color + 2 * sizeof(unsigned int);
+		const size_t stride = group.getStride();
+		if(range.vertexBuffer >= group.getNumVertBuffers() || stride < uvs + group.getNumUVs() * 3 * sizeof(float) || mesh.texcoords.size() > group.getNumUVs()
+		   || (range.vertexStart + range.vertexCount) * stride > group.getVertBufferSize(range.vertexBuffer)){
+			throw std::runtime_error("unexpected icicle vertex range");
+		}
+		const VertexSource source = { group.getVertBufferStorage(range.vertexBuffer) + range.vertexStart * stride, stride, 0, normal, color, uvs };
+		convertSource(source, range.vertexCount, transfo, mesh, baseVertex, kernel);
+	}
+	if(range.indexCount == 0){
+		return;
+	}
+	if(range.indexBuffer >= group.getNumIdxBuffers() || range.indexStart + range.indexCount > group.getIdxBufferCount(range.indexBuffer)){
+		throw std::runtime_error("unexpected icicle index range");
+	}
+	// Relative to the first vertex of the range, on 16 bits as plDrawableSpans::getIndices does.
+	const unsigned short * indices = group.getIdxBufferStorage(range.indexBuffer) + range.indexStart;
+	for(size_t iid = 0; iid < range.indexCount; ++iid){
+		mesh.indices[firstIndex + iid] = (unsigned short)(indices[iid] - range.vertexStart);
+	}
+}
+
+/// Half floats are spaced by at most 2^-11 in [-1,1], UVs are then off by at most 2^-12: a quarter
+/// of a texel of a 1024 pixels texture. UVs scaled by their layer transformation are compared once scaled.
+static const float kHalfUVRange = 1.0f;
+
+VertexUtilities::Layout VertexUtilities::layout(const MeshView & mesh){
+	Layout layout;
+	if(mesh.positions){
+		layout.positions = true;
+		layout.positionOffset = layout.stride;
+		layout.stride += 3 * sizeof(float);
+	}
+	if(mesh.normals){
+		layout.normals = true;
+		layout.normalOffset = layout.stride;
+		layout.stride += 2 * sizeof(int16_t);
+	}
+	if(mesh.colors){
+		layout.colors = true;
+		layout.colorOffset = layout.stride;
+		layout.stride += 4 * sizeof(uint8_t);
+	}
+	for(size_t uvid = 0; uvid < mesh.texcoords.size(); ++uvid){
+		const glm::vec3 * texcoords = mesh.texcoords[uvid];
+		if(!texcoords){
+			continue;
+		}
+		// Most channels only use two components, the third one is then always 0.
+		bool useW = false;
+		float range = 0.0f;
+		for(size_t vid = 0; vid < mesh.vertexCount; ++vid){
+			const glm::vec3 & uv = texcoords[vid];
+			useW = useW || uv.z != 0.0f;
+			range = (std::max)(range, (std::max)(std::abs(uv.x), (std::max)(std::abs(uv.y), std::abs(uv.z))));
+		}
+		Layout::UV uv;
+		uv.offset = layout.stride;
+		uv.components = useW ? 3 : 2;
+		const float scale = uvid < mesh.uvScales.size() ? mesh.uvScales[uvid] : 1.0f;
+		uv.half = range * scale <= kHalfUVRange;
+		// Keep attributes 4-bytes aligned.
+		layout.stride += uv.half ? (uv.components == 3 ? 4 : 2) * sizeof(uint16_t) : uv.components * sizeof(float);
+		layout.uvs.push_back(uv);
+	}
+	return layout;
+}
+
+void VertexUtilities::interleave(const MeshView & mesh, const Layout & layout, unsigned char * dst){
+	// Channels are listed in the layout in the same order as the present mesh channels.
+	std::vector<const glm::vec3 *> texcoords;
+	for(const glm::vec3 * channel : mesh.texcoords){
+		if(channel){
+			texcoords.push_back(channel);
+		}
+	}
+	for(size_t vid = 0; vid < mesh.vertexCount; ++vid){
+		unsigned char * vertex = dst + vid * layout.stride;
+		if(layout.positions){
+			std::memcpy(vertex + layout.positionOffset, &mesh.positions[vid][0], 3 * sizeof(float));
+		}
+		if(layout.normals){
+			const glm::vec2 oct = encodeOctahedral(mesh.normals[vid]);
+			const uint16_t packed[2] = { glm::packSnorm1x16(oct.x), glm::packSnorm1x16(oct.y) };
+			std::memcpy(vertex + layout.normalOffset, packed, sizeof(packed));
+		}
+		if(layout.colors){
+			std::memcpy(vertex + layout.colorOffset, &mesh.colors[vid][0], 4 * sizeof(uint8_t));
+		}
+		for(size_t uvid = 0; uvid < layout.uvs.size(); ++uvid){
+			const Layout::UV & uv = layout.uvs[uvid];
+			const glm::vec3 & value = texcoords[uvid][vid];
+			if(uv.half){
+				const uint16_t packed[4] = { glm::packHalf1x16(value.x), glm::packHalf1x16(value.y), glm::packHalf1x16(value.z), 0 };
+				std::memcpy(vertex + uv.offset, packed, (uv.components == 3 ? 4 : 2) * sizeof(uint16_t));
+			} else {
+				std::memcpy(vertex + uv.offset, &value[0], uv.components * sizeof(float));
+			}
+		}
+	}
+}
+
+glm::vec2 VertexUtilities::encodeOctahedral(const glm::vec3 & dir){
+	const float norm = std::abs(dir.x) + std::abs(dir.y) + std::abs(dir.z);
+	if(norm == 0.0f){
+		return glm::vec2(0.0f);
+	}
+	const glm::vec2 p = glm::vec2(dir.x, dir.y) / norm;
+	if(dir.z >= 0.0f){
+		return p;
+	}
+	// Fold the lower hemisphere over the diagonals.
+	return glm::vec2((1.0f - std::abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f), (1.0f - std::abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f));
+}
+
+bool VertexUtilities::fitsShortIndices(const unsigned int * indices, size_t count){
+	for(size_t iid = 0; iid < count; ++iid){
+		if(indices[iid] > 0xFFFF){
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,81 @@
+#ifndef VertexUtilities_h
+#define VertexUtilities_h
+
+#include "../resources/MeshUtilities.hpp"
+#include <vector>
+
+struct plGBufferVertex;
+class plGBufferGroup;
+class hsMatrix44;
+class Arena;
+
+class VertexUtilities {
+
+public:
+
+	enum Kernel {
+		Scalar, SSE41, AVX2
+	};
+
+	/// Most efficient kernel supported by the current CPU.
+	static Kernel bestKernel();
+
+	static const char * kernelName(Kernel kernel);
+
+	/// Transform positions and normals by transfo (normals ignore the translation), unpack ARGB colors to RGBA
+	/// and split UV channels, into the attributes of mesh starting at vertex first. The attributes must already
+	/// hold first + verts.size() vertices. All kernels produce bit-identical results.
+	static void convert(const std::vector<plGBufferVertex> & verts, const hsMatrix44 & transfo, MutableMeshView & mesh, size_t first = 0, Kernel kernel = bestKernel());
+	
+	/// Allocate the indices and attributes of mesh in arena, for its counts and number of UV channels.
+	static void allocate(MutableMeshView & mesh, Arena & arena);
+	
+	/// Geometry of an icicle in the buffers of a plGBufferGroup.
+	struct Range {
+		const plGBufferGroup * group = nullptr;
+		size_t vertexBuffer = 0;
+		size_t vertexStart = 0;
+		size_t vertexCount = 0;
+		size_t indexBuffer = 0;
+		size_t indexStart = 0;
+		size_t indexCount = 0;
+	};
+	
+	/// Copy range into mesh, reading the storage of the group in place: vertices are converted as by convert, at baseVertex,
+	/// unless copyVertices is false, and indices are written at firstIndex relative to the first vertex of the range.
+	/// Nothing is allocated. Throws std::runtime_error if the range is outside the group buffers.
+	static void stage(const Range & range, const hsMatrix44 & transfo, bool copyVertices, MutableMeshView & mesh, size_t baseVertex, size_t firstIndex, Kernel kernel = bestKernel());
+	
+	/// Interleaved GPU layout of the vertices of a mesh: float positions, octahedral normals on two signed shorts,
+	/// RGBA8 colors, then each UV channel on two or three components, in half floats when their range allows it.
+	struct Layout {
+		struct UV {
+			size_t offset;
+			unsigned int components;
+			bool half;
+		};
+		size_t stride = 0;
+		size_t positionOffset = 0;
+		size_t normalOffset = 0;
+		size_t colorOffset = 0;
+		bool positions = false;
+		bool normals = false;
+		bool colors = false;
+		std::vector<UV> uvs;
+	};
+	
+	/// Layout for the attributes present in mesh, UV channels that are missing are skipped.
+	static Layout layout(const MeshView & mesh);
+	
+	/// Write the vertices of mesh to dst following layout, dst holds layout.stride * mesh.vertexCount bytes.
+	static void interleave(const MeshView & mesh, const Layout & layout, unsigned char * dst);
+	
+	/// Octahedral mapping of a direction to the [-1,1] square, decoded in the object shaders.
+	static glm::vec2 encodeOctahedral(const glm::vec3 & dir);
+	
+	/// True if all the indices can be stored on 16 bits.
+	static bool fitsShortIndices(const unsigned int * indices, size_t count);
+
+};
+
+#endif
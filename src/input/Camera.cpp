@@ -38,6 +38,15 @@ void Camera::setCenter(const glm::vec3 & newCenter){
 	_center = newCenter;
 }
 
+void Camera::lookAt(const glm::vec3 & eye, const glm::vec3 & center){
+	_eye = eye;
+	_center = center;
+	const glm::vec3 look = normalize(_center - _eye);
+	_right = normalize(cross(look, glm::vec3(0.0f,1.0f,0.0f)));
+	_up = normalize(cross(_right, look));
+	_view = glm::lookAt(_eye, _center, _up);
+}
+
 void Camera::update(){
 	if(Input::manager().triggered(Input::KeyR)){
 		reset();
@@ -42,6 +42,9 @@ public:
 	
 	void setCenter(const glm::vec3 & newCenter);
 	
+	/// Place the camera at eye, looking at center with the vertical up.
+	void lookAt(const glm::vec3 & eye, const glm::vec3 & center);
+	
 	const glm::vec3 & getCenter() const { return _center; }
 	
 	const glm::vec3 & getPosition() const { return _eye; }
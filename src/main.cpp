@@ -8,6 +8,7 @@
 #include "Renderer.hpp"
 #include "helpers/Logger.hpp"
 #include "resources/ResourcesManager.hpp"
+#include "helpers/Profiler.hpp"
 #include <stdio.h>
 #include <memory>
 
@@ -61,6 +62,10 @@ int main(int argc, char** argv) {
 		Log::setDefaultFile(config.logPath);
 	}
 	Log::setDefaultVerbose(config.logVerbose);
+	// Record zones from the start, they are exported on exit.
+	if(!config.tracePath.empty()){
+		Profiler::setEnabled(true);
+	}
 	
 	// Initialize glfw, which will create and setup an OpenGL context.
 	if (!glfwInit()) {
@@ -158,6 +163,7 @@ int main(int argc, char** argv) {
 		
 		ImGui_ImplGlfwGL3_NewFrame();
 		
+		PROFILE_ZONE("Frame");
 		// Update events (inputs,...).
 		Input::manager().update();
 		// Handle quitting.
@@ -209,6 +215,14 @@ int main(int argc, char** argv) {
 	// Close GL context and any other GLFW resources.
 	glfwTerminate();
 	
+	if(!config.tracePath.empty()){
+		if(Profiler::exportTrace(config.tracePath)){
+			Log::Info() << "Trace saved to " << config.tracePath << "." << std::endl;
+		} else {
+			Log::Error() << "Unable to save trace to " << config.tracePath << "." << std::endl;
+		}
+	}
+	
 	return 0;
 }
 
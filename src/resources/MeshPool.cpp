@@ -0,0 +1,265 @@
+#include "MeshPool.hpp"
+#include <algorithm>
+#include <iterator>
+
+// Blocks are large enough to hold a few pages, bigger meshes get a block of their own size.
+static const size_t kBlockVertexSize = size_t(32) << 20;
+static const size_t kBlockIndexSize = size_t(8) << 20;
+
+/// Remove a range of size elements aligned on alignment from the first free range that can hold it.
+static bool takeRange(std::map<size_t, size_t> & ranges, size_t size, size_t alignment, size_t & offset){
+	if(size == 0){
+		offset = 0;
+		return true;
+	}
+	for(auto range = ranges.begin(); range != ranges.end(); ++range){
+		const size_t start = (range->first + alignment - 1) / alignment * alignment;
+		const size_t end = range->first + range->second;
+		if(start + size > end){
+			continue;
+		}
+		const size_t rangeStart = range->first;
+		ranges.erase(range);
+		if(start > rangeStart){
+			ranges[rangeStart] = start - rangeStart;
+		}
+		if(start + size < end){
+			ranges[start + size] = end - start - size;
+		}
+		offset = start;
+		return true;
+	}
+	return false;
+}
+
+/// Give a range back, merged with the adjacent free ranges.
+static void giveRange(std::map<size_t, size_t> & ranges, size_t offset, size_t size){
+	if(size == 0){
+		return;
+	}
+	auto next = ranges.lower_bound(offset);
+	if(next != ranges.begin()){
+		auto previous = std::prev(next);
+		if(previous->first + previous->second == offset){
+			offset = previous->first;
+			size += previous->second;
+			ranges.erase(previous);
+		}
+	}
+	if(next != ranges.end() && offset + size == next->first){
+		size += next->second;
+		ranges.erase(next);
+	}
+	ranges[offset] = size;
+}
+
+static bool sameLayout(const VertexUtilities::Layout & left, const VertexUtilities::Layout & right){
+	if(left.stride != right.stride || left.positions != right.positions || left.normals != right.normals || left.colors != right.colors
+	   || left.positionOffset != right.positionOffset || left.normalOffset != right.normalOffset || left.colorOffset != right.colorOffset
+	   || left.uvs.size() != right.uvs.size()){
+		return false;
+	}
+	for(size_t uvid = 0; uvid < left.uvs.size(); ++uvid){
+		const auto & luv = left.uvs[uvid];
+		const auto & ruv = right.uvs[uvid];
+		if(luv.offset != ruv.offset || luv.components != ruv.components || luv.half != ruv.half){
+			return false;
+		}
+	}
+	return true;
+}
+
+size_t MeshPool::findFormat(const VertexUtilities::Layout & layout){
+	for(size_t fid = 0; fid < _formats.size(); ++fid){
+		if(sameLayout(_formats[fid].layout, layout)){
+			return fid;
+		}
+	}
+	_formats.emplace_back();
+	_formats.back().layout = layout;
+	return _formats.size() - 1;
+}
+
+static void deleteBlock(GLuint vao, GLuint vbo, GLuint ebo){
+	GLUtilities::deleteVertexArray(vao);
+	glDeleteBuffers(1, &vbo);
+	glDeleteBuffers(1, &ebo);
+}
+
+MeshPool::Block MeshPool::createBlock(const VertexUtilities::Layout & layout, size_t vertexCount, size_t indexSize){
+	Block block;
+	const size_t stride = (std::max)(layout.stride, size_t(1));
+	block.vertexCapacity = (std::max)(kBlockVertexSize / stride, vertexCount);
+	block.indexCapacity = (std::max)(kBlockIndexSize, indexSize);
+	block.freeVertices[0] = block.vertexCapacity;
+	block.freeIndices[0] = block.indexCapacity;
+
+	glGenBuffers(1, &block.vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, block.vbo);
+	glBufferData(GL_ARRAY_BUFFER, block.vertexCapacity * stride, nullptr, GL_STATIC_DRAW);
+	glGenBuffers(1, &block.ebo);
+
+	// The vertex array references both buffers, meshes are drawn with offsets.
+	glGenVertexArrays(1, &block.vao);
+	GLUtilities::bindVertexArray(block.vao);
+	GLUtilities::setupAttributes(layout);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, block.ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, block.indexCapacity, nullptr, GL_STATIC_DRAW);
+	GLUtilities::bindVertexArray(0);
+	return block;
+}
+
+size_t MeshPool::allocate(const MeshView & mesh, MeshInfos & infos){
+	const VertexUtilities::Layout layout = VertexUtilities::layout(mesh);
+	const bool shortIndices = VertexUtilities::fitsShortIndices(mesh.indices, mesh.indexCount);
+	const size_t indexTypeSize = shortIndices ? sizeof(GLushort) : sizeof(GLuint);
+	const size_t indexSize = indexTypeSize * mesh.indexCount;
+
+	Allocation allocation;
+	allocation.format = findFormat(layout);
+	allocation.vertexCount = mesh.vertexCount;
+	allocation.indexSize = indexSize;
+	allocation.used = true;
+	Format & format = _formats[allocation.format];
+
+	// First block with room for both the vertices and the indices.
+	bool found = false;
+	for(size_t bid = 0; bid < format.blocks.size() && !found; ++bid){
+		Block & block = format.blocks[bid];
+		if(block.vao == 0 || !takeRange(block.freeVertices, mesh.vertexCount, 1, allocation.firstVertex)){
+			continue;
+		}
+		// Indices are 4-bytes aligned, whatever their type.
+		if(!takeRange(block.freeIndices, indexSize, sizeof(GLuint), allocation.indexOffset)){
+			giveRange(block.freeVertices, allocation.firstVertex, mesh.vertexCount);
+			continue;
+		}
+		allocation.block = bid;
+		found = true;
+	}
+	if(!found){
+		// Reuse the slot of a deleted block if there is one.
+		allocation.block = format.blocks.size();
+		for(size_t bid = 0; bid < format.blocks.size(); ++bid){
+			if(format.blocks[bid].vao == 0){
+				allocation.block = bid;
+				break;
+			}
+		}
+		if(allocation.block == format.blocks.size()){
+			format.blocks.emplace_back();
+		}
+		Block & block = format.blocks[allocation.block];
+		block = createBlock(layout, mesh.vertexCount, indexSize);
+		takeRange(block.freeVertices, mesh.vertexCount, 1, allocation.firstVertex);
+		takeRange(block.freeIndices, indexSize, sizeof(GLuint), allocation.indexOffset);
+	}
+	Block & block = format.blocks[allocation.block];
+	++block.meshes;
+
+	// Upload through the copy target, the elements binding belongs to the vertex arrays.
+	if(layout.stride > 0 && mesh.vertexCount > 0){
+		std::vector<unsigned char> vertices(layout.stride * mesh.vertexCount);
+		VertexUtilities::interleave(mesh, layout, vertices.data());
+		glBindBuffer(GL_COPY_WRITE_BUFFER, block.vbo);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, GLintptr(allocation.firstVertex * layout.stride), GLsizeiptr(vertices.size()), vertices.data());
+	}
+	if(indexSize > 0){
+		glBindBuffer(GL_COPY_WRITE_BUFFER, block.ebo);
+		if(shortIndices){
+			const std::vector<GLushort> indices(mesh.indices, mesh.indices + mesh.indexCount);
+			glBufferSubData(GL_COPY_WRITE_BUFFER, GLintptr(allocation.indexOffset), GLsizeiptr(indexSize), indices.data());
+		} else {
+			glBufferSubData(GL_COPY_WRITE_BUFFER, GLintptr(allocation.indexOffset), GLsizeiptr(indexSize), mesh.indices);
+		}
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	infos.vId = block.vao;
+	infos.eId = block.ebo;
+	infos.count = GLsizei(mesh.indexCount);
+	infos.indexType = shortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	infos.firstIndex = allocation.indexOffset / indexTypeSize;
+	infos.baseVertex = GLint(allocation.firstVertex);
+	infos.uvCount = mesh.texcoords.size();
+	infos.size = layout.stride * mesh.vertexCount + indexSize;
+
+	size_t id = _allocations.size();
+	if(!_freeIds.empty()){
+		id = _freeIds.back();
+		_freeIds.pop_back();
+		_allocations[id] = allocation;
+	} else {
+		_allocations.push_back(allocation);
+	}
+	return id;
+}
+
+void MeshPool::release(size_t id){
+	if(id >= _allocations.size() || !_allocations[id].used){
+		return;
+	}
+	Allocation & allocation = _allocations[id];
+	Format & format = _formats[allocation.format];
+	Block & block = format.blocks[allocation.block];
+	giveRange(block.freeVertices, allocation.firstVertex, allocation.vertexCount);
+	giveRange(block.freeIndices, allocation.indexOffset, allocation.indexSize);
+	allocation.used = false;
+	_freeIds.push_back(id);
+
+	if(--block.meshes > 0){
+		return;
+	}
+	// Keep one empty block of the default size per format for the next pages, delete the others.
+	bool keep = block.vertexCapacity * (std::max)(format.layout.stride, size_t(1)) <= kBlockVertexSize && block.indexCapacity <= kBlockIndexSize;
+	for(size_t bid = 0; bid < format.blocks.size() && keep; ++bid){
+		const Block & other = format.blocks[bid];
+		keep = bid == allocation.block || other.vao == 0 || other.meshes > 0;
+	}
+	if(!keep){
+		deleteBlock(block.vao, block.vbo, block.ebo);
+		block = Block();
+	}
+}
+
+void MeshPool::clear(){
+	for(const auto & format : _formats){
+		for(const auto & block : format.blocks){
+			if(block.vao != 0){
+				deleteBlock(block.vao, block.vbo, block.ebo);
+			}
+		}
+	}
+	_formats.clear();
+	_allocations.clear();
+	_freeIds.clear();
+}
+
+MeshPool::Stats MeshPool::stats() const {
+	Stats stats;
+	stats.formats = _formats.size();
+	stats.meshes = _allocations.size() - _freeIds.size();
+	for(const auto & format : _formats){
+		const size_t stride = format.layout.stride;
+		for(const auto & block : format.blocks){
+			if(block.vao == 0){
+				continue;
+			}
+			++stats.blocks;
+			const size_t capacity = block.vertexCapacity * stride + block.indexCapacity;
+			size_t free = 0;
+			for(const auto & range : block.freeVertices){
+				free += range.second * stride;
+				stats.largestFree = (std::max)(stats.largestFree, range.second * stride);
+			}
+			for(const auto & range : block.freeIndices){
+				free += range.second;
+				stats.largestFree = (std::max)(stats.largestFree, range.second);
+			}
+			stats.freeRanges += block.freeVertices.size() + block.freeIndices.size();
+			stats.capacity += capacity;
+			stats.used += capacity - free;
+		}
+	}
+	return stats;
+}
@@ -0,0 +1,87 @@
+#ifndef MeshPool_h
+#define MeshPool_h
+
+#include "../helpers/GLUtilities.hpp"
+#include <gl3w/gl3w.h>
+#include <vector>
+#include <map>
+#include <cstddef>
+
+/// Packs meshes sharing a vertex format into a few large vertex and index buffers.
+/// Each block of buffers is drawn through a single vertex array, meshes are ranges in it.
+class MeshPool {
+public:
+
+	/// Usage of the pool, to monitor fragmentation.
+	struct Stats {
+		size_t formats = 0;
+		size_t blocks = 0;
+		size_t meshes = 0;
+		/// Bytes allocated on the GPU, and used by meshes.
+		size_t capacity = 0;
+		size_t used = 0;
+		/// Free ranges over all blocks, and the largest one, in bytes.
+		size_t freeRanges = 0;
+		size_t largestFree = 0;
+	};
+
+	/// Upload mesh in the blocks of its format. infos receives the block vertex array and elements buffer,
+	/// and the offsets of the mesh in them. Returns an id to release the mesh with.
+	size_t allocate(const MeshView & mesh, MeshInfos & infos);
+
+	/// Give the ranges of a mesh back to its block, merged with the free neighbouring ranges.
+	/// Blocks left empty are deleted, except one spare block per format.
+	void release(size_t id);
+
+	/// Delete all blocks, allocations are invalid afterwards.
+	void clear();
+
+	Stats stats() const;
+
+private:
+
+	/// Free ranges, offset to size.
+	typedef std::map<size_t, size_t> Ranges;
+
+	/// Deleted blocks keep their slot, with a null vertex array, so that allocations can refer to blocks by index.
+	struct Block {
+		GLuint vao = 0;
+		GLuint vbo = 0;
+		GLuint ebo = 0;
+		/// Capacities in vertices and bytes.
+		size_t vertexCapacity = 0;
+		size_t indexCapacity = 0;
+		/// Number of meshes stored in the block.
+		size_t meshes = 0;
+		Ranges freeVertices;
+		Ranges freeIndices;
+	};
+
+	struct Format {
+		VertexUtilities::Layout layout;
+		std::vector<Block> blocks;
+	};
+
+	struct Allocation {
+		size_t format;
+		size_t block;
+		size_t firstVertex;
+		size_t vertexCount;
+		size_t indexOffset;
+		size_t indexSize;
+		bool used;
+	};
+
+	/// Create a block able to hold at least vertexCount vertices and indexSize bytes of indices.
+	Block createBlock(const VertexUtilities::Layout & layout, size_t vertexCount, size_t indexSize);
+
+	/// Find the format with the same layout, or add it.
+	size_t findFormat(const VertexUtilities::Layout & layout);
+
+	std::vector<Format> _formats;
+	std::vector<Allocation> _allocations;
+	/// Released allocation ids, reused first.
+	std::vector<size_t> _freeIds;
+};
+
+#endif
@@ -14,6 +14,54 @@ typedef struct {
 	std::vector<std::vector<glm::vec3>> texcoords;
 } Mesh;
 
+/// Non-owning writable view on mesh data, for instance allocated in an arena.
+struct MutableMeshView {
+	unsigned int * indices = nullptr;
+	glm::vec3 * positions = nullptr;
+	glm::vec3 * normals = nullptr;
+	glm::u8vec4 * colors = nullptr;
+	std::vector<glm::vec3 *> texcoords;
+	size_t indexCount = 0;
+	size_t vertexCount = 0;
+};
+
+/// Non-owning view on mesh data, either from a Mesh, an arena or a memory-mapped cache.
+struct MeshView {
+	const unsigned int * indices = nullptr;
+	const glm::vec3 * positions = nullptr;
+	const glm::vec3 * normals = nullptr;
+	const glm::u8vec4 * colors = nullptr;
+	std::vector<const glm::vec3 *> texcoords;
+	/// Largest scale applied to each UV channel by the materials drawing the mesh, 1 if missing.
+	/// UVs are stored with less precision on the GPU when the scaled error stays small enough.
+	std::vector<float> uvScales;
+	size_t indexCount = 0;
+	size_t vertexCount = 0;
+	
+	MeshView(){}
+	
+	MeshView(const Mesh & mesh){
+		indices = mesh.indices.data();
+		positions = mesh.positions.empty() ? nullptr : mesh.positions.data();
+		normals = mesh.normals.empty() ? nullptr : mesh.normals.data();
+		colors = mesh.colors.empty() ? nullptr : mesh.colors.data();
+		for(const auto & uvs : mesh.texcoords){
+			texcoords.push_back(uvs.empty() ? nullptr : uvs.data());
+		}
+		indexCount = mesh.indices.size();
+		vertexCount = mesh.positions.size();
+	}
+	
+	MeshView(const MutableMeshView & mesh){
+		indices = mesh.indices;
+		positions = mesh.positions;
+		normals = mesh.normals;
+		colors = mesh.colors;
+		texcoords.assign(mesh.texcoords.begin(), mesh.texcoords.end());
+		indexCount = mesh.indexCount;
+		vertexCount = mesh.vertexCount;
+	}
+};
 
 
 class MeshUtilities {
@@ -1,8 +1,10 @@
 #include "ResourcesManager.hpp"
 #include "MeshUtilities.hpp"
 #include "../helpers/Logger.hpp"
+#include "../helpers/Profiler.hpp"
 #include <fstream>
 #include <sstream>
+#include <chrono>
 #include <tinydir/tinydir.h>
 #include <miniz/miniz.h>
 
@@ -232,32 +234,97 @@ const MeshInfos Resources::getMesh(const std::string & name){
 }
 
 const MeshInfos Resources::registerMesh(const std::string & name, const std::vector<unsigned int> & indices, const std::vector<glm::vec3> & positions, const std::vector<glm::vec3> & normals, const std::vector<glm::u8vec4> & colors, const std::vector<std::vector<glm::vec3>> & texcoords){
+	// Point to the data directly, no need for a copy.
+	MeshView mesh;
+	mesh.indices = indices.data();
+	mesh.positions = positions.empty() ? nullptr : positions.data();
+	mesh.normals = normals.empty() ? nullptr : normals.data();
+	mesh.colors = colors.empty() ? nullptr : colors.data();
+	for(const auto & uvs : texcoords){
+		mesh.texcoords.push_back(uvs.empty() ? nullptr : uvs.data());
+	}
+	mesh.indexCount = indices.size();
+	mesh.vertexCount = positions.size();
+	return registerMesh(name, mesh);
+}
+
+/// Keep the registrations of a name as stale, before binding the name to other content.
+template<typename Contents, typename Stale>
+static void retireContent(Contents & contents, typename Contents::iterator content, Stale & stale){
+	stale[{content->first, content->second.hash}] += content->second.registrations;
+	contents.erase(content);
+}
+
+const MeshInfos Resources::registerMesh(const std::string & name, const MeshView & mesh, uint64_t hash){
 	MeshInfos infos;
-	Mesh mesh;
-	//Init the mesh.
-	mesh.indices = indices;
-	mesh.positions = positions;
-	mesh.normals = normals;
-	mesh.colors = colors;
-	mesh.texcoords = texcoords;
+	
+	// Reuse the buffers of identical content.
+	if(hash != 0){
+		auto content = _meshContents.find(name);
+		if(content != _meshContents.end()){
+			if(content->second.hash == hash){
+				++content->second.registrations;
+				++_sharedMeshes.at(hash).users;
+				return _meshes[name];
+			}
+			// The name now designates other content (a modified page for instance).
+			retireContent(_meshContents, content, _staleMeshes);
+		}
+		auto shared = _sharedMeshes.find(hash);
+		if(shared != _sharedMeshes.end()){
+			++shared->second.users;
+			_meshContents[name] = {hash, true, 1};
+			_meshes[name] = shared->second.infos;
+			return shared->second.infos;
+		}
+	}
 	
 	// If uv or positions are missing, tangent/binormals won't be computed.
 	//MeshUtilities::computeTangentsAndBinormals(mesh);
 	//MeshUtilities::centerAndUnitMesh(mesh);
-	infos = GLUtilities::setupBuffers(mesh);
+	infos.poolId = _meshPool.allocate(mesh, infos);
+	infos.pooled = true;
 	infos.centroid = glm::vec3(0.0f);
 	
-	if(!positions.empty()){
-		infos.bbox = BoundingBox(positions[0], positions[0]);
-		for(const auto & pos : positions){
-			infos.bbox += pos;
-			infos.centroid += pos;
+	if(mesh.positions && mesh.vertexCount > 0){
+		infos.bbox = BoundingBox(mesh.positions[0], mesh.positions[0]);
+		for(size_t vid = 0; vid < mesh.vertexCount; ++vid){
+			infos.bbox += mesh.positions[vid];
+			infos.centroid += mesh.positions[vid];
 		}
 		infos.bbox.updateValues();
-		infos.centroid /= positions.size();
+		infos.centroid /= mesh.vertexCount;
 	}
 	
 	_meshes[name] = infos;
+	if(hash != 0){
+		_sharedMeshes[hash] = {infos, 1};
+		_meshContents[name] = {hash, false, 1};
+	}
+	return infos;
+}
+
+const MeshInfos Resources::meshRange(const MeshInfos & buffer, const MeshView & mesh, size_t firstIndex, size_t indexCount, size_t baseVertex, size_t vertexCount){
+	MeshInfos infos;
+	infos.vId = buffer.vId;
+	infos.eId = buffer.eId;
+	infos.indexType = buffer.indexType;
+	infos.uvCount = buffer.uvCount;
+	infos.count = GLsizei(indexCount);
+	// Offsets are relative to the range of the buffer in its pool block.
+	infos.firstIndex = buffer.firstIndex + firstIndex;
+	infos.baseVertex = buffer.baseVertex + GLint(baseVertex);
+	
+	if(mesh.positions && vertexCount > 0){
+		const glm::vec3 * positions = mesh.positions + baseVertex;
+		infos.bbox = BoundingBox(positions[0], positions[0]);
+		for(size_t vid = 0; vid < vertexCount; ++vid){
+			infos.bbox += positions[vid];
+			infos.centroid += positions[vid];
+		}
+		infos.bbox.updateValues();
+		infos.centroid /= vertexCount;
+	}
 	return infos;
 }
 
@@ -270,6 +337,21 @@ const TextureInfos Resources::getTexture(const std::string & name, bool srgb){
 		return _textures[name];
 	}
 	
+	// If the texture is deferred, request its upload.
+	auto pending = _pendingTextures.find(name);
+	if(pending != _pendingTextures.end()){
+		// Identical content might already be on the GPU.
+		if(pending->second.hash != 0 && bindSharedTexture(name, pending->second.hash, pending->second.registrations)){
+			_pendingTextures.erase(pending);
+			return _textures[name];
+		}
+		if(!pending->second.requested){
+			pending->second.requested = true;
+			_textureRequests.push_back(name);
+		}
+		return placeholder(pending->second.cubemap != nullptr);
+	}
+	
 	// Else, find the corresponding file.
 	TextureInfos infos;
 	std::string path = getImagePath(name);
@@ -308,29 +390,334 @@ const TextureInfos Resources::getTexture(const std::string & name, bool srgb){
 	return getTexture("DEBUG_DEFAULT");
 }
 
-const TextureInfos Resources::registerTexture(const std::string & name, const plMipmap* textureData ){
-	
+const TextureInfos Resources::registerTexture(const std::string & name, const plMipmap* textureData, uint64_t hash){
+	PROFILE_ZONE("Resources::registerTexture");
+	if(retainTexture(name, hash) || (hash != 0 && bindSharedTexture(name, hash, 1))){
+		return _textures[name];
+	}
 	TextureInfos infos = GLUtilities::loadTexture(textureData);
 	_textures[name] = infos;
+	shareTexture(name, hash, 1);
 	return infos;
 }
 
-const TextureInfos Resources::registerCubemap(const std::string & name, plCubicEnvironmap* textureData ){
+const TextureInfos Resources::registerCubemap(const std::string & name, plCubicEnvironmap* textureData, uint64_t hash){
+	PROFILE_ZONE("Resources::registerCubemap");
+	if(retainTexture(name, hash) || (hash != 0 && bindSharedTexture(name, hash, 1))){
+		return _textures[name];
+	}
 	TextureInfos infos = GLUtilities::loadCubemap(textureData);
 	_textures[name] = infos;
+	shareTexture(name, hash, 1);
+	return infos;
+}
+
+void Resources::deferTexture(const std::string & name, const plMipmap* textureData, const std::shared_ptr<void> & owner, uint64_t hash, const std::shared_ptr<const MipChain> & chain){
+	deferData(name, {textureData, nullptr, false, owner, hash, 1, chain});
+}
+
+void Resources::deferCubemap(const std::string & name, plCubicEnvironmap* textureData, const std::shared_ptr<void> & owner, uint64_t hash){
+	deferData(name, {nullptr, textureData, false, owner, hash, 1, nullptr});
+}
+
+void Resources::deferData(const std::string & name, const PendingTexture & data){
+	// Names bound to shared content, or whose content is already on the GPU, are immediately available.
+	if(retainTexture(name, data.hash) || (data.hash != 0 && bindSharedTexture(name, data.hash, 1))){
+		return;
+	}
+	auto pending = _pendingTextures.find(name);
+	if(pending != _pendingTextures.end()){
+		// Other content deferred under the same name (by another age for instance) is replaced,
+		// the name only designates the latest content and the previous registrations are dropped with their data.
+		const bool sameContent = pending->second.hash == data.hash;
+		const size_t registrations = (sameContent ? pending->second.registrations : 0) + 1;
+		const bool requested = pending->second.requested;
+		pending->second = data;
+		pending->second.registrations = registrations;
+		pending->second.requested = requested;
+		return;
+	}
+	// A released texture leaves an empty entry, that would hide the pending one.
+	auto texture = _textures.find(name);
+	if(texture != _textures.end() && texture->second.id == 0){
+		_textures.erase(texture);
+	}
+	_pendingTextures[name] = data;
+}
+
+bool Resources::retainTexture(const std::string & name, uint64_t hash){
+	auto content = _textureContents.find(name);
+	if(content == _textureContents.end()){
+		return false;
+	}
+	if(content->second.hash != hash){
+		// The previous texture stays alive through its shared entry until its stale registrations are released.
+		retireContent(_textureContents, content, _staleTextures);
+		_textures.erase(name);
+		return false;
+	}
+	++content->second.registrations;
+	++_sharedTextures.at(content->second.hash).users;
+	return true;
+}
+
+bool Resources::bindSharedTexture(const std::string & name, uint64_t hash, size_t registrations){
+	auto shared = _sharedTextures.find(hash);
+	if(shared == _sharedTextures.end()){
+		return false;
+	}
+	shared->second.users += registrations;
+	_textureContents[name] = {hash, true, registrations};
+	_textures[name] = shared->second.infos;
+	return true;
+}
+
+void Resources::shareTexture(const std::string & name, uint64_t hash, size_t registrations){
+	if(hash == 0){
+		return;
+	}
+	_sharedTextures[hash] = {_textures[name], registrations};
+	_textureContents[name] = {hash, false, registrations};
+}
+
+size_t Resources::uploadRequestedTextures(double budget){
+	const auto startTime = std::chrono::steady_clock::now();
+	size_t uploadCount = 0;
+	size_t rid = 0;
+	for(; rid < _textureRequests.size(); ++rid){
+		auto pending = _pendingTextures.find(_textureRequests[rid]);
+		// The texture might have been released in the meantime.
+		if(pending == _pendingTextures.end()){
+			continue;
+		}
+		const uint64_t hash = pending->second.hash;
+		// A texture with the same content might have been uploaded earlier in the batch.
+		if(hash != 0 && bindSharedTexture(pending->first, hash, pending->second.registrations)){
+			_pendingTextures.erase(pending);
+			continue;
+		}
+		if(pending->second.cubemap){
+			PROFILE_ZONE("Resources::uploadCubemap");
+			_textures[pending->first] = GLUtilities::loadCubemap(pending->second.cubemap);
+		} else {
+			PROFILE_ZONE("Resources::uploadTexture");
+			_textures[pending->first] = GLUtilities::loadTexture(pending->second.mipmap, pending->second.chain.get());
+		}
+		shareTexture(pending->first, hash, pending->second.registrations);
+		_pendingTextures.erase(pending);
+		++uploadCount;
+		
+		const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+		if(elapsed > budget){
+			++rid;
+			break;
+		}
+	}
+	_textureRequests.erase(_textureRequests.begin(), _textureRequests.begin() + rid);
+	return uploadCount;
+}
+
+size_t Resources::untouchedTextureCount() const {
+	size_t count = 0;
+	for(const auto & pending : _pendingTextures){
+		count += pending.second.requested ? 0 : 1;
+	}
+	return count;
+}
+
+size_t Resources::uploadedTextureCount() const {
+	size_t count = 0;
+	for(const auto & texture : _textures){
+		count += texture.second.id > 0 ? 1 : 0;
+	}
+	return count;
+}
+
+size_t Resources::textureSize(const std::vector<std::string> & names) const {
+	size_t size = 0;
+	for(const auto & name : names){
+		const auto texture = _textures.find(name);
+		if(texture != _textures.end()){
+			size += texture->second.size;
+		}
+	}
+	return size;
+}
+
+size_t Resources::deduplicatedSize(const std::vector<std::pair<std::string, uint64_t>> & meshes, const std::vector<std::pair<std::string, uint64_t>> & textures) const {
+	size_t size = 0;
+	for(const auto & mesh : meshes){
+		const auto content = _meshContents.find(mesh.first);
+		if(content != _meshContents.end() && content->second.hash == mesh.second && content->second.reused){
+			size += _sharedMeshes.at(content->second.hash).infos.size;
+		}
+	}
+	for(const auto & texture : textures){
+		const auto content = _textureContents.find(texture.first);
+		if(content != _textureContents.end() && content->second.hash == texture.second && content->second.reused){
+			size += _sharedTextures.at(content->second.hash).infos.size;
+		}
+	}
+	return size;
+}
+
+const TextureInfos & Resources::placeholder(bool cubemap){
+	TextureInfos & infos = cubemap ? _placeholderCubemap : _placeholder;
+	if(infos.id > 0){
+		return infos;
+	}
+	const GLenum target = cubemap ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+	const unsigned char grey[4] = {128, 128, 128, 255};
+	glGenTextures(1, &infos.id);
+	glBindTexture(target, infos.id);
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	if(cubemap){
+		for(GLenum face = 0; face < 6; ++face){
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+		}
+	} else {
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+	}
+	infos.width = infos.height = 1;
+	infos.mipmap = 1;
+	infos.cubemap = cubemap;
+	infos.size = cubemap ? 24 : 4;
 	return infos;
 }
 
 void Resources::reset(){
 	
+	// Shared objects are deleted once, through their shared entry.
 	for(auto & tex : _textures){
-		glDeleteTextures(1, &(tex.second.id));
+		if(_textureContents.count(tex.first) == 0){
+			glDeleteTextures(1, &(tex.second.id));
+		}
+	}
+	for(auto & tex : _sharedTextures){
+		glDeleteTextures(1, &(tex.second.infos.id));
 	}
 	for(auto & mesh : _meshes){
-		glDeleteVertexArrays(1, &(mesh.second.vId));
+		if(_meshContents.count(mesh.first) == 0 && !mesh.second.pooled){
+			deleteMesh(mesh.second);
+		}
+	}
+	for(auto & mesh : _sharedMeshes){
+		if(!mesh.second.infos.pooled){
+			deleteMesh(mesh.second.infos);
+		}
 	}
+	// Pooled meshes all go with their blocks.
+	_meshPool.clear();
 	_textures.clear();
 	_meshes.clear();
+	_sharedTextures.clear();
+	_sharedMeshes.clear();
+	_textureContents.clear();
+	_meshContents.clear();
+	_staleMeshes.clear();
+	_staleTextures.clear();
+	_pendingTextures.clear();
+	_textureRequests.clear();
+}
+
+void Resources::releaseMesh(const std::string & name, uint64_t hash){
+	// Registrations of content the name doesn't designate anymore only hold their shared buffers.
+	auto stale = _staleMeshes.find({name, hash});
+	if(hash != 0 && stale != _staleMeshes.end()){
+		if(--stale->second == 0){
+			_staleMeshes.erase(stale);
+		}
+		auto shared = _sharedMeshes.find(hash);
+		if(--shared->second.users == 0){
+			deleteMesh(shared->second.infos);
+			_sharedMeshes.erase(shared);
+		}
+		return;
+	}
+	auto mesh = _meshes.find(name);
+	if(mesh == _meshes.end()){
+		return;
+	}
+	// Shared buffers are kept until their last user is released.
+	auto content = _meshContents.find(name);
+	if(content != _meshContents.end()){
+		auto shared = _sharedMeshes.find(content->second.hash);
+		--shared->second.users;
+		if(--content->second.registrations > 0){
+			return;
+		}
+		_meshContents.erase(content);
+		if(shared->second.users > 0){
+			_meshes.erase(mesh);
+			return;
+		}
+		_sharedMeshes.erase(shared);
+	}
+	deleteMesh(mesh->second);
+	_meshes.erase(mesh);
+}
+
+void Resources::deleteMesh(const MeshInfos & infos){
+	if(infos.pooled){
+		_meshPool.release(infos.poolId);
+		return;
+	}
+	GLUtilities::deleteVertexArray(infos.vId);
+	glDeleteBuffers(GLsizei(infos.buffers.size()), infos.buffers.data());
+}
+
+MeshPool::Stats Resources::meshPoolStats() const {
+	return _meshPool.stats();
+}
+
+void Resources::releaseTexture(const std::string & name, uint64_t hash){
+	auto pending = _pendingTextures.find(name);
+	if(pending != _pendingTextures.end() && pending->second.hash == hash){
+		if(--pending->second.registrations == 0){
+			_pendingTextures.erase(pending);
+		}
+		return;
+	}
+	// Registrations of content the name doesn't designate anymore only hold their shared texture.
+	auto stale = _staleTextures.find({name, hash});
+	if(hash != 0 && stale != _staleTextures.end()){
+		if(--stale->second == 0){
+			_staleTextures.erase(stale);
+		}
+		auto shared = _sharedTextures.find(hash);
+		if(--shared->second.users == 0){
+			glDeleteTextures(1, &(shared->second.infos.id));
+			_sharedTextures.erase(shared);
+		}
+		return;
+	}
+	auto texture = _textures.find(name);
+	if(texture == _textures.end()){
+		return;
+	}
+	// Shared textures are kept until their last user is released.
+	auto content = _textureContents.find(name);
+	// Registrations replaced while pending were dropped with their data.
+	if(hash != 0 && (content == _textureContents.end() || content->second.hash != hash)){
+		return;
+	}
+	if(content != _textureContents.end()){
+		auto shared = _sharedTextures.find(content->second.hash);
+		--shared->second.users;
+		if(--content->second.registrations > 0){
+			return;
+		}
+		_textureContents.erase(content);
+		if(shared->second.users > 0){
+			texture->second = TextureInfos();
+			return;
+		}
+		_sharedTextures.erase(shared);
+	}
+	glDeleteTextures(1, &(texture->second.id));
+	// Keep an empty entry, to avoid looking for the texture on disk.
+	texture->second = TextureInfos();
 }
 
 const TextureInfos Resources::getCubemap(const std::string & name, bool srgb){
@@ -3,11 +3,13 @@
 
 #include "../helpers/GLUtilities.hpp"
 #include "../helpers/ProgramInfos.hpp"
+#include "MeshPool.hpp"
 #include <gl3w/gl3w.h>
 #include <string>
 #include <vector>
 #include <map>
 #include <memory>
+#include <cstdint>
 
 class plMipmap;
 class plCubicEnvironmap;
@@ -37,8 +39,25 @@ private:
 	
 	const std::vector<std::string> getCubemapPaths(const std::string & name);
 	
+	/// 1x1 grey texture, bound while the real texture is waiting for its upload.
+	const TextureInfos & placeholder(bool cubemap);
+	
 	char * getRawData(const std::string & path, size_t & size);
 	
+	/// Add a registration to a name already bound to the shared content with the given hash, returns false if it isn't.
+	/// A name bound to other content is unbound, its registrations kept as stale.
+	bool retainTexture(const std::string & name, uint64_t hash);
+	
+	/// Bind name to the texture already uploaded with the same content hash, if any.
+	bool bindSharedTexture(const std::string & name, uint64_t hash, size_t registrations);
+	
+	/// Make the texture just uploaded under name available to other names with the same content hash.
+	void shareTexture(const std::string & name, uint64_t hash, size_t registrations);
+	
+	struct PendingTexture;
+	
+	void deferData(const std::string & name, const PendingTexture & data);
+	
 public:
 
 	const std::string getString(const std::string & filename);
@@ -47,14 +66,57 @@ public:
 	
 	const MeshInfos registerMesh(const std::string & name, const std::vector<unsigned int> & indices, const std::vector<glm::vec3> & positions, const std::vector<glm::vec3> & normals, const std::vector<glm::u8vec4> & colors, const std::vector<std::vector<glm::vec3>> & texcoords);
 	
+	/// Register mesh data that doesn't have to be owned by a Mesh (memory-mapped for instance).
+	/// The mesh is packed in the pool buffers of its vertex format.
+	/// Meshes registered with the same non-zero content hash share their GPU buffers.
+	const MeshInfos registerMesh(const std::string & name, const MeshView & mesh, uint64_t hash = 0);
+	
+	/// Describe a range of an already registered mesh, drawn with its buffers. The range doesn't own them.
+	const MeshInfos meshRange(const MeshInfos & buffer, const MeshView & mesh, size_t firstIndex, size_t indexCount, size_t baseVertex, size_t vertexCount);
+	
 	const TextureInfos getTexture(const std::string & name, bool srgb = true);
 	
-	const TextureInfos registerTexture(const std::string & name, const plMipmap* textureData );
+	/// Textures registered with the same non-zero content hash share their GPU texture.
+	const TextureInfos registerTexture(const std::string & name, const plMipmap* textureData, uint64_t hash = 0);
+	
+	const TextureInfos registerCubemap(const std::string & name, plCubicEnvironmap* textureData, uint64_t hash = 0);
+	
+	/// Keep a texture to upload once it is first requested through getTexture, a placeholder is returned until then.
+	/// The texture data must stay alive until the texture is uploaded or released, owner is kept until then.
+	/// The levels of chain, if any, are used for JPEG and PNG textures.
+	void deferTexture(const std::string & name, const plMipmap* textureData, const std::shared_ptr<void> & owner = nullptr, uint64_t hash = 0, const std::shared_ptr<const MipChain> & chain = nullptr);
 	
-	const TextureInfos registerCubemap(const std::string & name, plCubicEnvironmap* textureData );
+	void deferCubemap(const std::string & name, plCubicEnvironmap* textureData, const std::shared_ptr<void> & owner = nullptr, uint64_t hash = 0);
+	
+	/// Upload the requested deferred textures, for at most budget seconds. Returns the number of textures uploaded.
+	size_t uploadRequestedTextures(double budget);
+	
+	/// Number of deferred textures that were never requested.
+	size_t untouchedTextureCount() const;
+	
+	/// Number of textures currently on the GPU.
+	size_t uploadedTextureCount() const;
+	
+	/// GPU memory used by the given uploaded textures, in bytes.
+	size_t textureSize(const std::vector<std::string> & names) const;
+	
+	/// GPU memory saved by the given names reusing content uploaded under another name, in bytes.
+	/// Names are given with the content hash they were registered with.
+	size_t deduplicatedSize(const std::vector<std::pair<std::string, uint64_t>> & meshes, const std::vector<std::pair<std::string, uint64_t>> & textures) const;
 	
 	const TextureInfos getCubemap(const std::string & name, bool srgb = true);
 	
+	/// Usage and fragmentation of the buffers shared by registered meshes.
+	MeshPool::Stats meshPoolStats() const;
+	
+	/// Free the GPU data of a registered mesh, once no other name shares it.
+	/// Names registered with a hash are counted, and must be released as many times, with the same hash.
+	void releaseMesh(const std::string & name, uint64_t hash = 0);
+	
+	/// Free the GPU data of a registered texture, once no other name shares it. The name stays known, bound to no texture, until registered again.
+	/// Names deferred or registered with a hash are counted, and must be released as many times, with the same hash.
+	void releaseTexture(const std::string & name, uint64_t hash = 0);
+	
 	const std::string getShader(const std::string & name, const ShaderType & type);
 	
 	const std::shared_ptr<ProgramInfos> getProgram(const std::string & name);
@@ -90,8 +152,66 @@ private:
 	
 	std::map<std::string, TextureInfos> _textures;
 	
+	struct PendingTexture {
+		const plMipmap * mipmap;
+		plCubicEnvironmap * cubemap;
+		bool requested;
+		std::shared_ptr<void> owner;
+		uint64_t hash;
+		/// Number of times the name was deferred, the latest data is kept.
+		size_t registrations;
+		std::shared_ptr<const MipChain> chain;
+	};
+	
+	std::map<std::string, PendingTexture> _pendingTextures;
+	
+	/// Deferred textures requested since the last upload, in request order.
+	std::vector<std::string> _textureRequests;
+	
+	TextureInfos _placeholder;
+	
+	TextureInfos _placeholderCubemap;
+	
 	std::map<std::string, MeshInfos> _meshes;
 	
+	MeshPool _meshPool;
+	
+	/// Free the buffers of a mesh, or its ranges if it is pooled.
+	void deleteMesh(const MeshInfos & infos);
+	
+	/// GPU objects shared by all the names registered with the same content hash.
+	struct SharedMesh {
+		MeshInfos infos;
+		size_t users;
+	};
+	
+	struct SharedTexture {
+		TextureInfos infos;
+		size_t users;
+	};
+	
+	/// Content hash of a name, whether it reused an object uploaded under another name,
+	/// and the number of registrations of the name (from several ages for instance).
+	struct ContentRef {
+		uint64_t hash;
+		bool reused;
+		size_t registrations;
+	};
+	
+	std::map<uint64_t, SharedMesh> _sharedMeshes;
+	
+	std::map<uint64_t, SharedTexture> _sharedTextures;
+	
+	std::map<std::string, ContentRef> _meshContents;
+	
+	/// Registrations of names since bound to other content, by name and former content hash.
+	/// They still count as users of their shared object.
+	std::map<std::pair<std::string, uint64_t>, size_t> _staleMeshes;
+	
+	std::map<std::pair<std::string, uint64_t>, size_t> _staleTextures;
+	
+	std::map<std::string, ContentRef> _textureContents;
+	
 	std::map<std::string, std::shared_ptr<ProgramInfos>> _programs;
 	
 };
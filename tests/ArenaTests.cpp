@@ -0,0 +1,211 @@
+#include "helpers/Arena.hpp"
+#include "helpers/VertexUtilities.hpp"
+#include <Math/hsMatrix44.h>
+#include <PRP/Geometry/plGBufferGroup.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+
+// Stage icicles from buffer groups with VertexUtilities::allocate and stage, as Age::loadMeshes does:
+// buffers are allocated once in the page arena, and copying each icicle into its range must not allocate anything.
+
+static size_t allocationCount = 0;
+static size_t allocationSize = 0;
+
+static void countAllocation(size_t size){
+	++allocationCount;
+	allocationSize += size;
+}
+
+// Every heap allocation of the process, including the ones made by libHSPlasma.
+static size_t heapAllocations = 0;
+
+void * operator new(size_t size){
+	++heapAllocations;
+	void * ptr = std::malloc(size == 0 ? 1 : size);
+	if(!ptr){
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void operator delete(void * ptr) noexcept {
+	std::free(ptr);
+}
+
+void operator delete(void * ptr, size_t) noexcept {
+	std::free(ptr);
+}
+
+static size_t failures = 0;
+
+static void check(bool condition, const char * message){
+	if(!condition){
+		std::printf("Failed: %s\n", message);
+		++failures;
+	}
+}
+
+static bool sameBits(const void * a, const void * b, size_t size){
+	return std::memcmp(a, b, size) == 0;
+}
+
+struct Icicle {
+	VertexUtilities::Range range;
+	size_t buffer;
+	size_t baseVertex;
+	size_t firstIndex;
+};
+
+static void stagePage(size_t bufferCount, size_t icicleCount, unsigned char format){
+	const size_t uvCount = format & plGBufferGroup::kUVCountMask;
+	// Each buffer group holds one vertex and one index buffer, split in icicles of 1 to 64 vertices.
+	std::vector<std::unique_ptr<plGBufferGroup>> groups;
+	std::vector<std::vector<plGBufferVertex>> groupVerts(bufferCount);
+	std::vector<std::vector<unsigned short>> groupIndices(bufferCount);
+	std::vector<Icicle> icicles(icicleCount);
+	std::vector<MutableMeshView> targets(bufferCount);
+	for(size_t iid = 0; iid < icicleCount; ++iid){
+		Icicle & icicle = icicles[iid];
+		icicle.buffer = iid % bufferCount;
+		std::vector<plGBufferVertex> & verts = groupVerts[icicle.buffer];
+		std::vector<unsigned short> & indices = groupIndices[icicle.buffer];
+		MutableMeshView & target = targets[icicle.buffer];
+		
+		icicle.range.vertexStart = verts.size();
+		icicle.range.vertexCount = 1 + (iid * 7) % 64;
+		icicle.range.indexStart = indices.size();
+		icicle.range.indexCount = 3 * icicle.range.vertexCount;
+		for(size_t vid = 0; vid < icicle.range.vertexCount; ++vid){
+			plGBufferVertex vert;
+			const float value = float(iid) + float(vid) * 0.125f;
+			vert.fPos = hsVector3(value, -value, 2.0f * value);
+			vert.fNormal = hsVector3(0.0f, value, 1.0f);
+			vert.fColor = 0x80402010u + (unsigned int)(vid);
+			for(size_t uvid = 0; uvid < uvCount; ++uvid){
+				vert.fUVWs[uvid] = hsVector3(value + float(uvid), 0.5f, float(uvid));
+			}
+			verts.push_back(vert);
+		}
+		for(size_t tid = 0; tid < icicle.range.indexCount; ++tid){
+			indices.push_back((unsigned short)(icicle.range.vertexStart + (tid * 5) % icicle.range.vertexCount));
+		}
+		icicle.baseVertex = target.vertexCount;
+		icicle.firstIndex = target.indexCount;
+		target.vertexCount += icicle.range.vertexCount;
+		target.indexCount += icicle.range.indexCount;
+	}
+	for(size_t bid = 0; bid < bufferCount; ++bid){
+		groups.emplace_back(new plGBufferGroup(format));
+		groups.back()->addVertices(groupVerts[bid]);
+		groups.back()->addIndices(groupIndices[bid]);
+		targets[bid].texcoords.resize(uvCount);
+	}
+	for(Icicle & icicle : icicles){
+		icicle.range.group = groups[icicle.buffer].get();
+	}
+	
+	Arena arena;
+	allocationCount = 0;
+	allocationSize = 0;
+	for(auto & target : targets){
+		VertexUtilities::allocate(target, arena);
+	}
+	check(allocationCount == arena.blockCount(), "the hook sees every block of the arena");
+	check(allocationCount <= bufferCount * (4 + uvCount), "at most one block per buffer attribute");
+	
+	const hsMatrix44 transfo = hsMatrix44::Identity();
+	const size_t heapBefore = heapAllocations;
+	for(const Icicle & icicle : icicles){
+		VertexUtilities::stage(icicle.range, transfo, true, targets[icicle.buffer], icicle.baseVertex, icicle.firstIndex);
+	}
+	check(heapAllocations == heapBefore, "no allocation per icicle");
+	
+	// Staged data matches the decoding of libHSPlasma, converted the usual way.
+	for(const Icicle & icicle : icicles){
+		const plGBufferGroup & group = *icicle.range.group;
+		const MutableMeshView & target = targets[icicle.buffer];
+		const std::vector<plGBufferVertex> verts = group.getVertices(0, icicle.range.vertexStart, icicle.range.vertexCount);
+		Mesh reference;
+		reference.positions.resize(verts.size());
+		reference.normals.resize(verts.size());
+		reference.colors.resize(verts.size());
+		reference.texcoords.resize(uvCount, std::vector<glm::vec3>(verts.size()));
+		MutableMeshView referenceView;
+		referenceView.positions = reference.positions.data();
+		referenceView.normals = reference.normals.data();
+		referenceView.colors = reference.colors.data();
+		for(auto & uvs : reference.texcoords){
+			referenceView.texcoords.push_back(uvs.data());
+		}
+		VertexUtilities::convert(verts, transfo, referenceView, 0, VertexUtilities::Scalar);
+		const size_t count = verts.size();
+		bool same = sameBits(target.positions + icicle.baseVertex, reference.positions.data(), count * sizeof(glm::vec3));
+		same = same && sameBits(target.normals + icicle.baseVertex, reference.normals.data(), count * sizeof(glm::vec3));
+		same = same && sameBits(target.colors + icicle.baseVertex, reference.colors.data(), count * sizeof(glm::u8vec4));
+		for(size_t uvid = 0; uvid < uvCount; ++uvid){
+			same = same && sameBits(target.texcoords[uvid] + icicle.baseVertex, reference.texcoords[uvid].data(), count * sizeof(glm::vec3));
+		}
+		check(same, "staged vertices match getVertices");
+		
+		const std::vector<unsigned short> indices = group.getIndices(0, icicle.range.indexStart, icicle.range.indexCount, icicle.range.vertexStart);
+		bool sameIndices = true;
+		for(size_t iid = 0; iid < indices.size(); ++iid){
+			sameIndices = sameIndices && target.indices[icicle.firstIndex + iid] == indices[iid];
+		}
+		check(sameIndices, "staged indices match getIndices");
+	}
+	check(heapAllocations > heapBefore, "the heap counter sees the allocations of getVertices");
+	
+	// Ranges outside the group buffers are rejected.
+	VertexUtilities::Range outside = icicles.back().range;
+	outside.vertexCount += groupVerts[icicles.back().buffer].size();
+	bool thrown = false;
+	try {
+		VertexUtilities::stage(outside, transfo, true, targets[icicles.back().buffer], 0, 0);
+	} catch(const std::runtime_error &){
+		thrown = true;
+	}
+	check(thrown, "ranges outside the buffers throw");
+	
+	const size_t blocks = arena.blockCount();
+	arena.clear();
+	check(arena.blockCount() == 0 && arena.used() == 0, "clear releases all blocks");
+	std::printf("%zu icicles in %zu buffers: %zu allocations (%zu bytes), %zu blocks.\n", icicleCount, bufferCount, allocationCount, allocationSize, blocks);
+}
+
+int main(int, char **){
+	Arena::setAllocationHook(&countAllocation);
+	
+	{
+		Arena arena(1024);
+		allocationCount = 0;
+		check(arena.allocate<glm::vec3>(0) == nullptr && allocationCount == 0, "empty requests do not allocate");
+		for(size_t i = 0; i < 16; ++i){
+			void * ptr = arena.allocate(24, 16);
+			check((uintptr_t(ptr) & 15) == 0, "allocations are aligned");
+		}
+		check(allocationCount == 1, "small requests share a block");
+		arena.allocate(4096, 8);
+		check(allocationCount == 2 && arena.blockCount() == 2, "large requests get their own block");
+	}
+	
+	stagePage(1, 1, 0);
+	stagePage(4, 100, 2);
+	stagePage(8, 1000, 3 | plGBufferGroup::kSkin2Weights | plGBufferGroup::kSkinIndices);
+	stagePage(16, 5000, 8);
+	
+	Arena::setAllocationHook(nullptr);
+	{
+		Arena arena;
+		allocationCount = 0;
+		arena.allocate<unsigned int>(16);
+		check(allocationCount == 0, "removed hook is not called");
+	}
+	
+	std::printf("%zu failures.\n", failures);
+	return failures == 0 ? 0 : 1;
+}
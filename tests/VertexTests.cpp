@@ -0,0 +1,138 @@
+#include "helpers/VertexUtilities.hpp"
+#include <Math/hsMatrix44.h>
+#include <PRP/Geometry/plGBufferGroup.h>
+#include <cstring>
+#include <cstdio>
+#include <random>
+
+// Compare each vertex conversion kernel supported by the CPU bit for bit against the scalar kernel,
+// and the scalar kernel against hsMatrix44, for all the tail lengths of the SIMD loops and UV channel counts.
+
+static const size_t kMaxVertexCount = 35;
+static const size_t kMaxUVCount = 8;
+/// Vertices left untouched before and after the converted range, to catch overflowing stores.
+static const size_t kGuard = 3;
+
+template<typename T> static bool sameBits(const std::vector<T> & left, const std::vector<T> & right){
+	return left.size() == right.size() && std::memcmp(left.data(), right.data(), left.size() * sizeof(T)) == 0;
+}
+
+struct Buffers {
+	Mesh mesh;
+	MutableMeshView view;
+
+	Buffers(size_t vertexCount, size_t uvCount){
+		const size_t size = kGuard + vertexCount + kGuard;
+		// Fill with a pattern that no conversion produces.
+		mesh.positions.assign(size, glm::vec3(-7.0f));
+		mesh.normals.assign(size, glm::vec3(-7.0f));
+		mesh.colors.assign(size, glm::u8vec4(7));
+		mesh.texcoords.assign(uvCount, std::vector<glm::vec3>(size, glm::vec3(-7.0f)));
+		view.positions = mesh.positions.data();
+		view.normals = mesh.normals.data();
+		view.colors = mesh.colors.data();
+		for(auto & channel : mesh.texcoords){
+			view.texcoords.push_back(channel.data());
+		}
+		view.vertexCount = size;
+	}
+
+	Buffers(const Buffers &) = delete;
+	Buffers & operator=(const Buffers &) = delete;
+
+	bool operator==(const Buffers & other) const {
+		if(!sameBits(mesh.positions, other.mesh.positions) || !sameBits(mesh.normals, other.mesh.normals) || !sameBits(mesh.colors, other.mesh.colors)){
+			return false;
+		}
+		for(size_t uvid = 0; uvid < mesh.texcoords.size(); ++uvid){
+			if(!sameBits(mesh.texcoords[uvid], other.mesh.texcoords[uvid])){
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+static std::vector<plGBufferVertex> randomVertices(size_t count, std::mt19937 & rng){
+	std::uniform_real_distribution<float> coord(-1000.0f, 1000.0f);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	std::uniform_int_distribution<unsigned int> color;
+	std::vector<plGBufferVertex> verts(count);
+	for(auto & vert : verts){
+		vert.fPos = hsVector3(coord(rng), coord(rng), coord(rng));
+		vert.fNormal = hsVector3(unit(rng), unit(rng), unit(rng));
+		vert.fColor = color(rng);
+		for(auto & uvw : vert.fUVWs){
+			uvw = hsVector3(unit(rng) * 4.0f, unit(rng) * 4.0f, unit(rng));
+		}
+	}
+	return verts;
+}
+
+static hsMatrix44 randomTransform(std::mt19937 & rng){
+	std::uniform_real_distribution<float> value(-10.0f, 10.0f);
+	hsMatrix44 transfo = hsMatrix44::Identity();
+	for(int r = 0; r < 3; ++r){
+		for(int c = 0; c < 4; ++c){
+			transfo(r, c) = value(rng);
+		}
+	}
+	return transfo;
+}
+
+/// Conversion as done before the kernels, vertex by vertex with hsMatrix44.
+static void convertReference(const std::vector<plGBufferVertex> & verts, const hsMatrix44 & transfo, Mesh & mesh, size_t first){
+	for(size_t j = 0; j < verts.size(); ++j){
+		const plGBufferVertex & vert = verts[j];
+		const hsVector3 pos = transfo.multPoint(vert.fPos);
+		const hsVector3 nor = transfo.multVector(vert.fNormal);
+		mesh.positions[first + j] = glm::vec3(pos.X, pos.Y, pos.Z);
+		mesh.normals[first + j] = glm::vec3(nor.X, nor.Y, nor.Z);
+		const unsigned int color = vert.fColor;
+		mesh.colors[first + j] = glm::u8vec4((color >> 16) & 0xFF, (color >> 8) & 0xFF, color & 0xFF, (color >> 24) & 0xFF);
+		for(size_t uvid = 0; uvid < mesh.texcoords.size(); ++uvid){
+			const hsVector3 & uvw = vert.fUVWs[uvid];
+			mesh.texcoords[uvid][first + j] = glm::vec3(uvw.X, uvw.Y, uvw.Z);
+		}
+	}
+}
+
+int main(int, char **){
+	const VertexUtilities::Kernel best = VertexUtilities::bestKernel();
+	std::printf("Best kernel: %s\n", VertexUtilities::kernelName(best));
+	
+	std::mt19937 rng(1234);
+	size_t failures = 0;
+	size_t checks = 0;
+	for(size_t uvCount = 0; uvCount <= kMaxUVCount; ++uvCount){
+		for(size_t count = 0; count <= kMaxVertexCount; ++count){
+			const std::vector<plGBufferVertex> verts = randomVertices(count, rng);
+			const hsMatrix44 transfo = randomTransform(rng);
+			
+			Buffers reference(count, uvCount);
+			convertReference(verts, transfo, reference.mesh, kGuard);
+			Buffers scalar(count, uvCount);
+			VertexUtilities::convert(verts, transfo, scalar.view, kGuard, VertexUtilities::Scalar);
+			++checks;
+			if(!(scalar == reference)){
+				std::printf("scalar differs from hsMatrix44 for %zu vertices and %zu UV channels.\n", count, uvCount);
+				++failures;
+			}
+			
+			for(const VertexUtilities::Kernel kernel : {VertexUtilities::SSE41, VertexUtilities::AVX2}){
+				if(kernel > best){
+					continue;
+				}
+				Buffers result(count, uvCount);
+				VertexUtilities::convert(verts, transfo, result.view, kGuard, kernel);
+				++checks;
+				if(!(result == scalar)){
+					std::printf("%s differs from scalar for %zu vertices and %zu UV channels.\n", VertexUtilities::kernelName(kernel), count, uvCount);
+					++failures;
+				}
+			}
+		}
+	}
+	std::printf("%zu checks, %zu failures.\n", checks, failures);
+	return failures == 0 ? 0 : 1;
+}